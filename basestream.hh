@@ -73,8 +73,8 @@ public:
   stream_wrapper_t(stream_wrapper_t const &other) = default;
   stream_wrapper_t(stream_wrapper_t &&other) = delete;
 
-  stream_wrapper_t &operator == (stream_wrapper_t const &other) = default;
-  stream_wrapper_t &operator == (stream_wrapper_t &&other) = delete;
+  stream_wrapper_t &operator = (stream_wrapper_t const &other) = default;
+  stream_wrapper_t &operator = (stream_wrapper_t &&other) = delete;
 
   int read(int num_bytes, void *buffer)
   {
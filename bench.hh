@@ -0,0 +1,125 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_BENCH_HH__
+#define __SCOLEX_BENCH_HH__
+
+#include "scolex_config.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+
+namespace scolex
+{
+
+namespace bench
+{
+
+
+/*==============================================================================
+
+  Tiny helpers shared by the *_bench.cc programs. Each bench program defines a
+  table of bench_case_t and hands it to run_cases, which runs every case whose
+  name contains one of the command line arguments (or all cases if there are
+  none).
+
+==============================================================================*/
+
+
+using bench_clock_t = std::chrono::steady_clock;
+
+
+struct bench_case_t
+{
+  char const *name;
+  void (*run)();
+};
+
+
+// Returns the wall time, in seconds, taken to call fn once.
+template <typename FN>
+double time_seconds(FN &&fn)
+{
+  auto const start = bench_clock_t::now();
+  fn();
+  auto const end = bench_clock_t::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+
+// Returns the best wall time, in seconds, of reps calls to fn.
+template <typename FN>
+double best_of(int reps, FN &&fn)
+{
+  double best = time_seconds(fn);
+  for (int rep = 1; rep < reps; ++rep) {
+    double const next = time_seconds(fn);
+    if (next < best) {
+      best = next;
+    }
+  }
+  return best;
+}
+
+
+template <typename = void>
+struct keep_sink__
+{
+  static char volatile value;
+};
+
+
+template <typename U>
+char volatile keep_sink__<U>::value = 0;
+
+
+// Prevents the compiler from discarding a computed value.
+template <typename T>
+void keep(T const &value)
+{
+  keep_sink__<>::value = *reinterpret_cast<char const volatile *>(&value);
+}
+
+
+// Resident set size of the process in bytes, or 0 where it isn't known.
+inline std::size_t resident_bytes()
+{
+  std::FILE *const statm = std::fopen("/proc/self/statm", "r");
+  if (!statm) {
+    return 0;
+  }
+  long pages = 0;
+  long resident = 0;
+  int const matched = std::fscanf(statm, "%ld %ld", &pages, &resident);
+  std::fclose(statm);
+  return matched == 2 ? std::size_t(resident) * 4096 : 0;
+}
+
+
+inline int run_cases(int argc, char const *argv[], bench_case_t const *begin, bench_case_t const *end)
+{
+  for (bench_case_t const *bench = begin; bench != end; ++bench) {
+    bool selected = argc < 2;
+    for (int arg = 1; arg < argc && !selected; ++arg) {
+      selected = std::strstr(bench->name, argv[arg]) != nullptr;
+    }
+
+    if (selected) {
+      std::printf("== %s\n", bench->name);
+      bench->run();
+      std::fflush(stdout);
+    }
+  }
+  return 0;
+}
+
+
+} // namespace bench
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_BENCH_HH__ include guard */
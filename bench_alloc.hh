@@ -0,0 +1,174 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_BENCH_ALLOC_HH__
+#define __SCOLEX_BENCH_ALLOC_HH__
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+
+/*==============================================================================
+
+  Replaces the global operator new/delete with versions that count calls and
+  bytes. Include this from exactly one translation unit of a bench program --
+  it defines the replacement operators, so it must never be included by
+  library code.
+
+==============================================================================*/
+
+
+namespace scolex
+{
+
+namespace bench
+{
+
+
+struct alloc_counts_t
+{
+  long allocs;
+  long frees;
+  long bytes;
+};
+
+
+inline std::atomic<long> &alloc_count__() { static std::atomic<long> count { 0 }; return count; }
+inline std::atomic<long> &free_count__() { static std::atomic<long> count { 0 }; return count; }
+inline std::atomic<long> &alloc_bytes__() { static std::atomic<long> count { 0 }; return count; }
+
+
+// Every replacement operator allocates and frees through these, so they
+// all count the same way and each new pairs with any delete.
+inline void *counted_malloc__(std::size_t size)
+{
+  alloc_count__().fetch_add(1, std::memory_order_relaxed);
+  alloc_bytes__().fetch_add(long(size), std::memory_order_relaxed);
+  return std::malloc(size ? size : 1);
+}
+
+
+inline void counted_free__(void *ptr)
+{
+  if (ptr) {
+    free_count__().fetch_add(1, std::memory_order_relaxed);
+    std::free(ptr);
+  }
+}
+
+
+inline alloc_counts_t alloc_counts()
+{
+  return alloc_counts_t {
+    alloc_count__().load(std::memory_order_relaxed),
+    free_count__().load(std::memory_order_relaxed),
+    alloc_bytes__().load(std::memory_order_relaxed),
+  };
+}
+
+
+// Returns the allocations, frees and bytes allocated by a call to fn.
+template <typename FN>
+alloc_counts_t count_allocs(FN &&fn)
+{
+  alloc_counts_t const before = alloc_counts();
+  fn();
+  alloc_counts_t const after = alloc_counts();
+  return alloc_counts_t {
+    after.allocs - before.allocs,
+    after.frees - before.frees,
+    after.bytes - before.bytes,
+  };
+}
+
+
+} // namespace bench
+
+} // namespace scolex
+
+
+// The replacements are kept out of line: once gcc inlines one into a caller,
+// it sees malloc or free where the caller used new or delete and warns that
+// they don't match.
+#if defined(__GNUC__)
+# define SCOLEX_BENCH_NOINLINE __attribute__((noinline))
+#else
+# define SCOLEX_BENCH_NOINLINE /* no noinline attribute */
+#endif
+
+
+SCOLEX_BENCH_NOINLINE void *operator new (std::size_t size)
+{
+  if (void *ptr = scolex::bench::counted_malloc__(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+
+SCOLEX_BENCH_NOINLINE void *operator new[] (std::size_t size)
+{
+  if (void *ptr = scolex::bench::counted_malloc__(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+
+SCOLEX_BENCH_NOINLINE void *operator new (std::size_t size, std::nothrow_t const &) noexcept
+{
+  return scolex::bench::counted_malloc__(size);
+}
+
+
+SCOLEX_BENCH_NOINLINE void *operator new[] (std::size_t size, std::nothrow_t const &) noexcept
+{
+  return scolex::bench::counted_malloc__(size);
+}
+
+
+SCOLEX_BENCH_NOINLINE void operator delete (void *ptr) noexcept
+{
+  scolex::bench::counted_free__(ptr);
+}
+
+
+SCOLEX_BENCH_NOINLINE void operator delete[] (void *ptr) noexcept
+{
+  scolex::bench::counted_free__(ptr);
+}
+
+
+SCOLEX_BENCH_NOINLINE void operator delete (void *ptr, std::nothrow_t const &) noexcept
+{
+  scolex::bench::counted_free__(ptr);
+}
+
+
+SCOLEX_BENCH_NOINLINE void operator delete[] (void *ptr, std::nothrow_t const &) noexcept
+{
+  scolex::bench::counted_free__(ptr);
+}
+
+
+#if defined(__cpp_sized_deallocation)
+SCOLEX_BENCH_NOINLINE void operator delete (void *ptr, std::size_t) noexcept
+{
+  scolex::bench::counted_free__(ptr);
+}
+
+
+SCOLEX_BENCH_NOINLINE void operator delete[] (void *ptr, std::size_t) noexcept
+{
+  scolex::bench::counted_free__(ptr);
+}
+#endif
+
+
+#undef SCOLEX_BENCH_NOINLINE
+
+
+#endif /* end __SCOLEX_BENCH_ALLOC_HH__ include guard */
@@ -0,0 +1,599 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "csexp.hh"
+#include "memstream.hh"
+#include "sexpr_walk.hh"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace scolex
+{
+
+
+namespace
+{
+
+
+char const BASE64_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// The least an atom that runs past the buffered input grows by at first.
+std::size_t const MIN_ATOM_STEP = 4096;
+
+
+// Value of base64 digit c, or -1 if c isn't one.
+int base64_value(char c)
+{
+  if ('A' <= c && c <= 'Z') {
+    return c - 'A';
+  } else if ('a' <= c && c <= 'z') {
+    return c - 'a' + 26;
+  } else if ('0' <= c && c <= '9') {
+    return c - '0' + 52;
+  } else if (c == '+') {
+    return 62;
+  } else if (c == '/') {
+    return 63;
+  }
+  return -1;
+}
+
+
+// Decodes base64 text into out, skipping whitespace and stopping at padding.
+// Returns false if text holds anything else.
+bool decode_base64(string_t const &text, string_t &out)
+{
+  out.clear();
+  uint32_t bits = 0;
+  int bit_count = 0;
+
+  for (char const c : text) {
+    if (c == '=') {
+      break;
+    } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      continue;
+    }
+
+    int const value = base64_value(c);
+    if (value < 0) {
+      return false;
+    }
+
+    bits = (bits << 6) | uint32_t(value);
+    bit_count += 6;
+    if (bit_count >= 8) {
+      bit_count -= 8;
+      out.push_back(char((bits >> bit_count) & 0xFF));
+    }
+  }
+
+  return true;
+}
+
+
+void encode_base64(string_t const &data, string_t &out)
+{
+  out.clear();
+  out.reserve((data.size() + 2) / 3 * 4);
+
+  std::size_t index = 0;
+  for (; index + 3 <= data.size(); index += 3) {
+    uint32_t const bits =
+      (uint32_t(uint8_t(data[index])) << 16) |
+      (uint32_t(uint8_t(data[index + 1])) << 8) |
+      uint32_t(uint8_t(data[index + 2]));
+    out.push_back(BASE64_CHARS[(bits >> 18) & 63]);
+    out.push_back(BASE64_CHARS[(bits >> 12) & 63]);
+    out.push_back(BASE64_CHARS[(bits >> 6) & 63]);
+    out.push_back(BASE64_CHARS[bits & 63]);
+  }
+
+  std::size_t const rest = data.size() - index;
+  if (rest > 0) {
+    uint32_t bits = uint32_t(uint8_t(data[index])) << 16;
+    if (rest > 1) {
+      bits |= uint32_t(uint8_t(data[index + 1])) << 8;
+    }
+    out.push_back(BASE64_CHARS[(bits >> 18) & 63]);
+    out.push_back(BASE64_CHARS[(bits >> 12) & 63]);
+    out.push_back(rest > 1 ? BASE64_CHARS[(bits >> 6) & 63] : '=');
+    out.push_back('=');
+  }
+}
+
+
+void encode_uint64(uint64_t bits, char *out)
+{
+  for (int index = 7; index >= 0; --index) {
+    out[index] = char(bits & 0xFF);
+    bits >>= 8;
+  }
+}
+
+
+uint64_t decode_uint64(char const *in)
+{
+  uint64_t bits = 0;
+  for (int index = 0; index < 8; ++index) {
+    bits = (bits << 8) | uint8_t(in[index]);
+  }
+  return bits;
+}
+
+
+void encode_double(double num, char *out)
+{
+  uint64_t bits;
+  std::memcpy(&bits, &num, sizeof(bits));
+  encode_uint64(bits, out);
+}
+
+
+double decode_double(char const *in)
+{
+  uint64_t const bits = decode_uint64(in);
+  double num;
+  std::memcpy(&num, &bits, sizeof(num));
+  return num;
+}
+
+
+} // namespace
+
+
+// csexp reader
+
+csexp_reader_base_t::csexp_reader_base_t(int chunk_size, std::size_t max_atom_size)
+: buffer_(size_t(chunk_size > 0 ? chunk_size : DEFAULT_CHUNK_SIZE))
+, base_(buffer_.data())
+, cur_(base_)
+, end_(base_)
+, consumed_(0)
+, at_end_(false)
+, max_atom_size_(max_atom_size)
+, stack_()
+, depth_(0)
+, atom_()
+, hint_()
+, document_(nullptr)
+{
+  /* nop */
+}
+
+
+csexp_reader_base_t::csexp_reader_base_t(char const *begin, char const *end, std::size_t max_atom_size)
+: buffer_()
+, base_(begin)
+, cur_(begin)
+, end_(end)
+, consumed_(0)
+, at_end_(false)
+, max_atom_size_(max_atom_size)
+, stack_()
+, depth_(0)
+, atom_()
+, hint_()
+, document_(nullptr)
+{
+  /* nop */
+}
+
+
+bool csexp_reader_base_t::fill()
+{
+  if (at_end_) {
+    return false;
+  }
+
+  consumed_ += long(cur_ - base_);
+
+  int const count = buffer_.empty() ? 0 : refill(buffer_.data(), int(buffer_.size()));
+  if (count <= 0) {
+    at_end_ = true;
+    base_ = cur_ = end_;
+    return false;
+  }
+
+  base_ = cur_ = buffer_.data();
+  end_ = cur_ + count;
+  return true;
+}
+
+
+bool csexp_reader_base_t::peek(char &c)
+{
+  if (cur_ == end_ && !fill()) {
+    return false;
+  }
+  c = *cur_;
+  return true;
+}
+
+
+void csexp_reader_base_t::expect(char c)
+{
+  char next;
+  if (!peek(next) || next != c) {
+    fail(c == ':' ? "expected ':' after atom length" : "expected ']' after display hint");
+  }
+  ++cur_;
+}
+
+
+std::size_t csexp_reader_base_t::read_length()
+{
+  std::size_t length = 0;
+  bool any = false;
+  char c;
+
+  while (peek(c) && '0' <= c && c <= '9') {
+    if (any && length == 0) {
+      fail("atom length has a leading zero");
+    }
+    length = length * 10 + std::size_t(c - '0');
+    if (length > max_atom_size_ || length > UINT32_MAX) {
+      fail("atom too long");
+    }
+    any = true;
+    ++cur_;
+  }
+
+  if (!any) {
+    fail("expected atom length");
+  }
+  expect(':');
+  return length;
+}
+
+
+// Copies size bytes of input to out. Whatever's buffered is copied first;
+// the rest is read straight into out if it's at least a chunk long.
+void csexp_reader_base_t::read_exact(char *out, std::size_t size)
+{
+  for (;;) {
+    std::size_t const available = std::min(size, std::size_t(end_ - cur_));
+    std::memcpy(out, cur_, available);
+    cur_ += available;
+    out += available;
+    size -= available;
+
+    if (size == 0) {
+      return;
+    } else if (size >= buffer_.size() && !buffer_.empty() && !at_end_) {
+      consumed_ += long(cur_ - base_);
+      base_ = cur_ = end_;
+      while (size > 0) {
+        int const count = refill(out, int(std::min<std::size_t>(size, INT32_MAX)));
+        if (count <= 0) {
+          at_end_ = true;
+          fail("unexpected end of input inside an atom");
+        }
+        consumed_ += count;
+        out += count;
+        size -= std::size_t(count);
+      }
+      return;
+    } else if (!fill()) {
+      fail("unexpected end of input inside an atom");
+    }
+  }
+}
+
+
+// Reads an atom, returning a view of it. The view is of the input buffer if
+// the whole atom is buffered, otherwise of scratch, and is only valid until
+// the next read.
+string_view_t csexp_reader_base_t::read_atom(string_t &scratch)
+{
+  std::size_t const length = read_length();
+  std::size_t const buffered = std::size_t(end_ - cur_);
+  if (length <= buffered) {
+    string_view_t const atom { cur_, length };
+    cur_ += length;
+    return atom;
+  }
+
+  // Grow scratch no faster than the atom arrives, doubling what's been read
+  // each time, so input that ends short of the length it claims can't make
+  // it allocate much more than the input held.
+  std::size_t read = 0;
+  std::size_t step = std::max(buffered, std::max(buffer_.size(), MIN_ATOM_STEP));
+  while (read < length) {
+    std::size_t const next = std::min(length, read + step);
+    scratch.resize(next);
+    read_exact(&scratch[read], next - read);
+    read = next;
+    step = read;
+  }
+  return string_view_t { scratch.data(), length };
+}
+
+
+sexpr_t csexp_reader_base_t::make_atom(string_view_t hint, string_view_t atom)
+{
+  if (hint == "f") {
+    if (atom.size() != 8) {
+      fail("number atoms must be 8 bytes");
+    }
+    return sexpr_t(decode_double(atom.data()));
+  } else if (hint == "i") {
+    if (atom.size() != 8) {
+      fail("integer atoms must be 8 bytes");
+    }
+    return sexpr_t(int64_t(decode_uint64(atom.data())));
+  } else if (hint == "b") {
+    if (atom.size() != 1) {
+      fail("boolean atoms must be 1 byte");
+    }
+    return sexpr_t(atom[0] != 0);
+  }
+
+  // Strings, and atoms with hints we don't know, which are kept as raw bytes.
+  return document_ ? document_->string(atom) : sexpr_t(atom);
+}
+
+
+sexpr_t csexp_reader_base_t::read_hinted()
+{
+  string_view_t const hint = read_atom(atom_);
+  hint_.assign(hint.data(), hint.size());
+  expect(']');
+  return make_atom(hint_, read_atom(atom_));
+}
+
+
+sexpr_t csexp_reader_base_t::read_transport()
+{
+  // Gathers the base64 text up to the closing brace a buffer at a time.
+  hint_.clear();
+  for (;;) {
+    if (cur_ == end_ && !fill()) {
+      fail("unexpected end of input inside transport encoding");
+    }
+
+    char const *const close = static_cast<char const *>(std::memchr(cur_, '}', std::size_t(end_ - cur_)));
+    hint_.append(cur_, close ? close : end_);
+    if (close) {
+      cur_ = close + 1;
+      break;
+    }
+    cur_ = end_;
+  }
+
+  if (!decode_base64(hint_, atom_)) {
+    fail("invalid base64 in transport encoding");
+  }
+
+  csexp_buffer_reader_t reader { atom_.data(), atom_.data() + atom_.size(), max_atom_size_ };
+  reader.set_document(document_);
+  sexpr_t form;
+  sexpr_t extra;
+  if (!reader.read(form) || reader.read(extra)) {
+    fail("transport encoding must hold exactly one form");
+  }
+  return form;
+}
+
+
+bool csexp_reader_base_t::read(sexpr_t &out)
+{
+  depth_ = 0;
+
+  for (;;) {
+    char c;
+    if (!peek(c)) {
+      if (depth_ != 0) {
+        fail("unexpected end of input inside a list");
+      }
+      return false;
+    }
+
+    sexpr_t value;
+
+    switch (c) {
+    case '(':
+      ++cur_;
+      if (depth_ == stack_.size()) {
+        stack_.emplace_back();
+      }
+      stack_[depth_++].clear();
+      continue;
+
+    case ')':
+      if (depth_ == 0) {
+        fail("unexpected ')'");
+      }
+      ++cur_;
+      --depth_;
+      if (document_) {
+        value = document_->list(std::move(stack_[depth_]));
+      } else {
+        value = sexpr_t(std::move(stack_[depth_]));
+      }
+      break;
+
+    case '[':
+      ++cur_;
+      value = read_hinted();
+      break;
+
+    case '{':
+      if (depth_ != 0) {
+        fail("transport encoding inside a list");
+      }
+      ++cur_;
+      value = read_transport();
+      break;
+
+    default: {
+        string_view_t const atom = read_atom(atom_);
+        value = sexpr_t(symbol_t(atom));
+        break;
+      }
+    }
+
+    if (depth_ == 0) {
+      out = std::move(value);
+      return true;
+    }
+    stack_[depth_ - 1].push_back(std::move(value));
+  }
+}
+
+
+void csexp_reader_base_t::fail(char const *what) const
+{
+  throw std::runtime_error("csexp read error at byte " + std::to_string(offset()) + ": " + what);
+}
+
+
+// csexp writer
+
+csexp_writer_base_t::csexp_writer_base_t(int buffer_size)
+: buffer_(size_t(buffer_size > 0 ? buffer_size : DEFAULT_BUFFER_SIZE))
+, cur_(buffer_.data())
+, end_(buffer_.data() + buffer_.size())
+, drained_(0)
+{
+  /* nop */
+}
+
+
+void csexp_writer_base_t::flush()
+{
+  int const size = int(cur_ - buffer_.data());
+  if (size > 0) {
+    cur_ = buffer_.data();
+    drained_ += size;
+    drain(buffer_.data(), size);
+  }
+}
+
+
+void csexp_writer_base_t::put(char const *chars, std::size_t size)
+{
+  if (size > std::size_t(end_ - cur_)) {
+    flush();
+    if (size > buffer_.size()) {
+      drained_ += long(size);
+      drain(chars, int(size));
+      return;
+    }
+  }
+  std::memcpy(cur_, chars, size);
+  cur_ += size;
+}
+
+
+void csexp_writer_base_t::put_atom(char const *chars, std::size_t size)
+{
+  char prefix[16];
+  char *digit = prefix + sizeof(prefix);
+  *--digit = ':';
+  std::size_t length = size;
+  do {
+    *--digit = char('0' + length % 10);
+    length /= 10;
+  } while (length);
+
+  put(digit, std::size_t(prefix + sizeof(prefix) - digit));
+  put(chars, size);
+}
+
+
+void csexp_writer_base_t::put_hinted(char hint, char const *chars, std::size_t size)
+{
+  char const prefix[] = { '[', '1', ':', hint, ']' };
+  put(prefix, sizeof(prefix));
+  put_atom(chars, size);
+}
+
+
+void csexp_writer_base_t::write(sexpr_t const &expr)
+{
+  sexpr_walk_t walk { expr };
+
+  while (walk.next()) {
+    switch (walk.event()) {
+    case sexpr_walk_t::ENTER: put('('); break;
+    case sexpr_walk_t::LEAVE: put(')'); break;
+    case sexpr_walk_t::LEAF: {
+        sexpr_t const &node = walk.node();
+        switch (node.type()) {
+        case sexpr_t::SYMBOL: {
+            string_t const &name = node.symbol().value();
+            put_atom(name.data(), name.size());
+            break;
+          }
+        case sexpr_t::STRING: {
+            string_view_t const str = node.string();
+            put_hinted('s', str.data(), str.size());
+            break;
+          }
+        case sexpr_t::NUMBER: {
+            char bytes[8];
+            encode_double(node.number(), bytes);
+            put_hinted('f', bytes, sizeof(bytes));
+            break;
+          }
+        case sexpr_t::INTEGER: {
+            char bytes[8];
+            encode_uint64(uint64_t(node.integer()), bytes);
+            put_hinted('i', bytes, sizeof(bytes));
+            break;
+          }
+        case sexpr_t::BOOLEAN: {
+            char const byte = node.boolean() ? 1 : 0;
+            put_hinted('b', &byte, 1);
+            break;
+          }
+        case sexpr_t::NIL: put("()", 2); break;
+        case sexpr_t::LIST: break;
+        }
+        break;
+      }
+    }
+  }
+}
+
+
+void csexp_writer_base_t::write_transport(sexpr_t const &expr)
+{
+  string_t encoded;
+  encode_base64(to_csexp(expr), encoded);
+  put('{');
+  put(encoded.data(), encoded.size());
+  put('}');
+}
+
+
+string_t to_csexp(sexpr_t const &expr)
+{
+  memstream_t out;
+  {
+    csexp_writer_t<memstream_t> writer { out };
+    writer.write(expr);
+    writer.flush();
+  }
+  return out.release();
+}
+
+
+sexpr_t from_csexp(string_view_t data)
+{
+  csexp_buffer_reader_t reader { data.begin(), data.end() };
+  sexpr_t form;
+  if (!reader.read(form)) {
+    throw std::runtime_error("No csexp form in input");
+  } else if (reader.offset() != long(data.size())) {
+    throw std::runtime_error("Trailing data after csexp form at byte " + std::to_string(reader.offset()));
+  }
+  return form;
+}
+
+
+} // namespace scolex
@@ -0,0 +1,285 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_CSEXP_HH__
+#define __SCOLEX_CSEXP_HH__
+
+#include "scolex_config.hh"
+#include "basestream.hh"
+#include "sexpr.hh"
+#include "sexpr_document.hh"
+
+#include <stdexcept>
+#include <vector>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  Canonical s-expressions
+
+  Rivest's canonical encoding: lists are parenthesized and every atom is its
+  length in decimal, a colon and then exactly that many raw bytes, with no
+  whitespace anywhere. An atom may be preceded by a display hint, itself an
+  atom in brackets. sexprs map onto it as:
+
+    symbol    3:foo           plain atoms
+    string    [1:s]3:foo      raw chars
+    number    [1:f]8:...      IEEE 754 double, big-endian
+    integer   [1:i]8:...      two's complement int64, big-endian
+    boolean   [1:b]1:\x01     one byte, 0 or 1
+    list      (3:foo3:bar)
+    nil       ()
+
+  Atoms with any other display hint are read as strings.
+
+  The transport encoding wraps a canonical form in braces as base64 --
+  {KDM6Zm9vKQ==} -- so it can travel through text channels. Readers accept
+  either at the top level.
+
+  Since atoms say how long they are, they're read with a single copy (or a
+  single io::read when they run past the buffered input) and never
+  tokenized.
+
+==============================================================================*/
+
+
+/*==============================================================================
+
+  csexp_reader_base_t
+
+  Reads sexprs from canonical or transport encoded input, consumed a chunk at
+  a time through refill() like sexpr_reader_base_t. Malformed input throws
+  std::runtime_error, as does any atom longer than the reader's maximum atom
+  size. Atoms that run past the buffered input are collected as they
+  arrive, so a length the input doesn't live up to costs no more memory
+  than the input that's there.
+
+==============================================================================*/
+class csexp_reader_base_t
+{
+public:
+  enum : int { DEFAULT_CHUNK_SIZE = 64 * 1024 };
+  enum : std::size_t { DEFAULT_MAX_ATOM_SIZE = 64 * 1024 * 1024 };
+
+  virtual ~csexp_reader_base_t() = default;
+
+  // Reads the next top-level form into out. Returns false, leaving out
+  // untouched, if there are no more forms.
+  bool read(sexpr_t &out);
+
+  // Builds lists and strings read from here on in document, or on the heap if
+  // document is null (the default).
+  void set_document(sexpr_document_t *document) { document_ = document; }
+
+  // Number of bytes of input consumed so far.
+  long offset() const { return consumed_ + long(cur_ - base_); }
+
+protected:
+  // Reader with a chunk buffer of chunk_size bytes, filled by refill(), that
+  // fails on atoms longer than max_atom_size bytes.
+  csexp_reader_base_t(int chunk_size, std::size_t max_atom_size);
+  // Reader over [begin, end), which must outlive the reader.
+  csexp_reader_base_t(char const *begin, char const *end, std::size_t max_atom_size);
+
+  // Fills up to capacity bytes of buffer with further input, returning the
+  // number of bytes written. Returns 0 at the end of the input.
+  virtual int refill(char *buffer, int capacity) = 0;
+
+private:
+  std::vector<char> buffer_;
+  char const *base_;
+  char const *cur_;
+  char const *end_;
+  long consumed_;
+  bool at_end_;
+  std::size_t max_atom_size_;
+
+  std::vector<list_t> stack_;
+  std::size_t depth_;
+  string_t atom_;
+  string_t hint_;
+  sexpr_document_t *document_;
+
+  bool fill();
+  bool peek(char &c);
+  void expect(char c);
+  std::size_t read_length();
+  string_view_t read_atom(string_t &scratch);
+  void read_exact(char *out, std::size_t size);
+  sexpr_t read_hinted();
+  sexpr_t read_transport();
+  sexpr_t make_atom(string_view_t hint, string_view_t atom);
+
+  [[noreturn]] void fail(char const *what) const;
+};
+
+
+/*==============================================================================
+
+  csexp_reader_t<STREAM>
+
+  Reads canonical s-expressions from any stream implementing
+  read(int, void *) (see basestream.hh).
+
+==============================================================================*/
+template <class STREAM>
+class csexp_reader_t final : public csexp_reader_base_t
+{
+  STREAM &stream_;
+
+public:
+  explicit csexp_reader_t(STREAM &stream, int chunk_size = DEFAULT_CHUNK_SIZE,
+    std::size_t max_atom_size = DEFAULT_MAX_ATOM_SIZE)
+  : csexp_reader_base_t(chunk_size, max_atom_size)
+  , stream_(stream)
+  {
+    /* nop */
+  }
+
+protected:
+  int refill(char *buffer, int capacity) override
+  {
+    int const result = ::scolex::io::read(stream_, capacity, buffer);
+    if (result < 0) {
+      throw std::runtime_error("Failed to read csexp input from stream");
+    }
+    return result;
+  }
+};
+
+
+/*==============================================================================
+
+  csexp_buffer_reader_t
+
+  Reads canonical s-expressions directly out of an in-memory buffer.
+
+==============================================================================*/
+class csexp_buffer_reader_t final : public csexp_reader_base_t
+{
+public:
+  csexp_buffer_reader_t(char const *begin, char const *end,
+    std::size_t max_atom_size = DEFAULT_MAX_ATOM_SIZE)
+  : csexp_reader_base_t(begin, end, max_atom_size)
+  {
+    /* nop */
+  }
+
+protected:
+  int refill(char *buffer, int capacity) override
+  {
+    (void)buffer;
+    (void)capacity;
+    return 0;
+  }
+};
+
+
+/*==============================================================================
+
+  csexp_writer_base_t
+
+  Writes sexprs in canonical form, buffered and drained like
+  sexpr_writer_base_t. Call flush() once done.
+
+==============================================================================*/
+class csexp_writer_base_t
+{
+public:
+  enum : int { DEFAULT_BUFFER_SIZE = 64 * 1024 };
+
+  virtual ~csexp_writer_base_t() = default;
+
+  // Writes expr in canonical form.
+  void write(sexpr_t const &expr);
+  // Writes expr in transport form: its canonical form in base64, in braces.
+  void write_transport(sexpr_t const &expr);
+
+  // Drains the buffer.
+  void flush();
+
+  // Number of bytes written so far, including any still buffered.
+  long offset() const { return drained_ + long(cur_ - buffer_.data()); }
+
+protected:
+  explicit csexp_writer_base_t(int buffer_size);
+
+  // Writes all size bytes of data to the output, throwing on failure.
+  virtual void drain(char const *data, int size) = 0;
+
+private:
+  std::vector<char> buffer_;
+  char *cur_;
+  char *end_;
+  long drained_;
+
+  void put(char c)
+  {
+    if (cur_ == end_) {
+      flush();
+    }
+    *cur_++ = c;
+  }
+
+  void put(char const *chars, std::size_t size);
+  void put_atom(char const *chars, std::size_t size);
+  void put_hinted(char hint, char const *chars, std::size_t size);
+};
+
+
+/*==============================================================================
+
+  csexp_writer_t<STREAM>
+
+  Writes canonical s-expressions to any stream implementing
+  write(int, void const *). The destructor flushes, ignoring errors.
+
+==============================================================================*/
+template <class STREAM>
+class csexp_writer_t final : public csexp_writer_base_t
+{
+  STREAM &stream_;
+
+public:
+  explicit csexp_writer_t(STREAM &stream, int buffer_size = DEFAULT_BUFFER_SIZE)
+  : csexp_writer_base_t(buffer_size)
+  , stream_(stream)
+  {
+    /* nop */
+  }
+
+  ~csexp_writer_t()
+  {
+    try {
+      flush();
+    } catch (...) {
+      /* nop */
+    }
+  }
+
+protected:
+  void drain(char const *data, int size) override
+  {
+    if (::scolex::io::write(stream_, size, data) != size) {
+      throw std::runtime_error("Failed to write csexp output to stream");
+    }
+  }
+};
+
+
+// Returns expr's canonical encoding.
+string_t to_csexp(sexpr_t const &expr);
+// Reads the only form in a canonical or transport encoded string. Throws
+// std::runtime_error if there's no form, or anything after it.
+sexpr_t from_csexp(string_view_t data);
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_CSEXP_HH__ include guard */
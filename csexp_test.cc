@@ -0,0 +1,206 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "csexp.hh"
+#include "memstream.hh"
+#include "sexpr_document.hh"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+
+using namespace scolex;
+
+
+namespace
+{
+
+
+int failures = 0;
+
+
+void check(char const *label, bool passed)
+{
+  std::cout << label << " => " << std::boolalpha << passed << std::endl;
+  if (!passed) {
+    ++failures;
+  }
+}
+
+
+// Whether reading expr's canonical encoding through a stream, chunk_size
+// bytes at a time, gives back expr.
+bool round_trips(sexpr_t const &expr, int chunk_size)
+{
+  memstream_t stream { to_csexp(expr) };
+  csexp_reader_t<memstream_t> reader { stream, chunk_size };
+  sexpr_t back;
+  return reader.read(back) && back == expr && !reader.read(back);
+}
+
+
+bool throws(string_t const &input)
+{
+  try {
+    from_csexp(input);
+  } catch (std::runtime_error const &) {
+    return true;
+  }
+  return false;
+}
+
+
+sexpr_t sample()
+{
+  string_t binary { "\0(]:)[\xff\"", 8 };
+  return sexpr_t {
+    symbol_t("config"),
+    sexpr_t { symbol_t("name"), "scolex" },
+    sexpr_t { symbol_t("port"), 8080.0 },
+    sexpr_t { symbol_t("ratio"), 0.1, -0.0, 1e-310, std::numeric_limits<double>::infinity() },
+    sexpr_t {
+      symbol_t("counts"), int64_t(0), 0.0, int64_t(-1), -1.0,
+      std::numeric_limits<int64_t>::min(), -9223372036854775808.0,
+      std::numeric_limits<int64_t>::max(), 9223372036854775807.0,
+    },
+    sexpr_t { symbol_t("flags"), sexpr_t(true), sexpr_t(false), sexpr_t::nil },
+    sexpr_t { symbol_t("blob"), sexpr_t(binary), sexpr_t(string_t()) },
+    sexpr_t { symbol_t("12"), symbol_t("a b") },
+  };
+}
+
+
+} // namespace
+
+
+int main(int argc, char const *argv[])
+{
+  (void)argc;
+  (void)argv;
+
+  sexpr_t const expr = sample();
+
+  check(R"raw(to_csexp(3:foo) == "3:foo")raw", to_csexp(sexpr_t(symbol_t("foo"))) == "3:foo");
+  check(R"raw(to_csexp("foo") == "[1:s]3:foo")raw", to_csexp(sexpr_t("foo")) == "[1:s]3:foo");
+  check(R"raw(to_csexp('()) == "()")raw", to_csexp(sexpr_t::nil) == "()");
+  check(R"raw(from_csexp("0:") == ||)raw", from_csexp("0:") == sexpr_t(symbol_t("")));
+  check(R"raw(from_csexp("(3:foo())") == (foo '()))raw",
+    from_csexp("(3:foo())") == sexpr_t { symbol_t("foo"), sexpr_t::nil });
+
+  check("from_csexp(to_csexp(sample)) == sample", from_csexp(to_csexp(expr)) == expr);
+
+  bool every_chunk_size = true;
+  for (int chunk_size = 1; chunk_size <= 32; ++chunk_size) {
+    every_chunk_size = every_chunk_size && round_trips(expr, chunk_size);
+  }
+  check("sample round trips at every chunk size 1..32", every_chunk_size);
+
+  sexpr_t const big { symbol_t("big"), sexpr_t(string_t(200000, 'x')), symbol_t(string_t(70000, 'y')) };
+  check("atoms longer than a chunk round trip", round_trips(big, 4096));
+
+  sexpr_t const nan_expr { symbol_t("nan"), std::numeric_limits<double>::quiet_NaN() };
+  sexpr_t const nan_back = from_csexp(to_csexp(nan_expr));
+  check("NaN round trips as NaN", std::isnan(nan_back.cdr().car().number()));
+  check("-0 keeps its sign", std::signbit(from_csexp(to_csexp(sexpr_t(-0.0))).number()));
+  check("integers and equal doubles stay apart",
+    from_csexp(to_csexp(sexpr_t(int64_t(1)))) != from_csexp(to_csexp(sexpr_t(1.0))));
+
+  {
+    memstream_t stream;
+    {
+      csexp_writer_t<memstream_t> writer { stream };
+      writer.write_transport(expr);
+      writer.write(expr);
+      writer.flush();
+    }
+    memstream_t in { stream.data() };
+    csexp_reader_t<memstream_t> reader { in, 7 };
+    sexpr_t first, second, third;
+    bool const read_both = reader.read(first) && reader.read(second) && !reader.read(third);
+    check("transport then canonical forms read back", read_both && first == expr && second == expr);
+    check("transport encoding is braced", stream.data().front() == '{');
+  }
+
+  check(R"raw(from_csexp("{KDM6Zm9vKQ==}") == (foo))raw",
+    from_csexp("{KDM6Zm9vKQ==}") == sexpr_t { symbol_t("foo") });
+
+  {
+    sexpr_document_t document;
+    string_t const text = to_csexp(expr);
+    csexp_buffer_reader_t reader { text.data(), text.data() + text.size() };
+    reader.set_document(&document);
+    sexpr_t back;
+    check("reading into a document round trips", reader.read(back) && back == expr);
+  }
+
+  {
+    sexpr_t deep { symbol_t("leaf") };
+    for (int depth = 0; depth < 100000; ++depth) {
+      deep = sexpr_t { std::move(deep) };
+    }
+    check("100000-deep list round trips", from_csexp(to_csexp(deep)) == deep);
+  }
+
+  {
+    sexpr_t deep { symbol_t("leaf") };
+    for (int depth = 0; depth < 1000000; ++depth) {
+      deep = sexpr_t { symbol_t("x"), std::move(deep) };
+    }
+    sexpr_document_t document { sexpr_document_t::HASH_CONS };
+    sexpr_t const consed = document.hash_cons(deep);
+    std::size_t const count = document.consed_count();
+    check("1000000-deep list hash-conses", consed == deep && count == 1000001);
+    check("consing it again shares the consed copy",
+      document.hash_cons(deep).begin() == consed.begin() && document.consed_count() == count);
+  }
+
+  check(R"raw(from_csexp("(3:foo") throws)raw", throws("(3:foo"));
+  check(R"raw(from_csexp("3:fo") throws)raw", throws("3:fo"));
+  check(R"raw(from_csexp("3foo") throws)raw", throws("3foo"));
+  check(R"raw(from_csexp(")") throws)raw", throws(")"));
+  check(R"raw(from_csexp("[1:f]1:x") throws)raw", throws("[1:f]1:x"));
+  check(R"raw(from_csexp("[1:i]1:x") throws)raw", throws("[1:i]1:x"));
+  check(R"raw(from_csexp("[1:i]9:123456789") throws)raw", throws("[1:i]9:123456789"));
+  check(R"raw(from_csexp("{!!}") throws)raw", throws("{!!}"));
+  check(R"raw(from_csexp("01:x") throws)raw", throws("01:x"));
+  check(R"raw(from_csexp("(00:)") throws)raw", throws("(00:)"));
+  check(R"raw(from_csexp("4294967295:") throws)raw", throws("4294967295:"));
+  check(R"raw(from_csexp("67108864:x") throws)raw", throws("67108864:x"));
+
+  {
+    string_t const text = "(3:foo2:ab)";
+    csexp_buffer_reader_t reader { text.data(), text.data() + text.size(), 2 };
+    bool threw = false;
+    try {
+      sexpr_t form;
+      reader.read(form);
+    } catch (std::runtime_error const &) {
+      threw = true;
+    }
+    check("atoms longer than the maximum atom size throw", threw);
+  }
+
+  {
+    // Claims an atom the input doesn't hold, read through a stream so the
+    // atom runs past the buffered input.
+    memstream_t stream { string_t("60000000:abc") };
+    csexp_reader_t<memstream_t> reader { stream, 4 };
+    bool threw = false;
+    try {
+      sexpr_t form;
+      reader.read(form);
+    } catch (std::runtime_error const &) {
+      threw = true;
+    }
+    check("atoms cut short by the end of a stream throw", threw);
+  }
+  check(R"raw(from_csexp("") throws)raw", throws(""));
+  check(R"raw(from_csexp("3:foo3:bar") throws)raw", throws("3:foo3:bar"));
+  check(R"raw(from_csexp("3:foo)") throws)raw", throws("3:foo)"));
+
+  return failures == 0 ? 0 : 1;
+}
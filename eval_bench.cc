@@ -0,0 +1,188 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "scolex_config.hh"
+#include "sexpr.hh"
+#include "sexpr_reader.hh"
+#include "sexpr_vm.hh"
+#include "bench.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+
+using namespace scolex;
+using namespace scolex::bench;
+
+
+namespace
+{
+
+
+int const NUM_EVALS = 2000000;
+
+
+sexpr_t parse(string_t const &text)
+{
+  sexpr_buffer_reader_t reader { text.data(), text.data() + text.size() };
+  sexpr_t form;
+  reader.read(form);
+  return form;
+}
+
+
+/*
+  The obvious evaluator: walks the form for every evaluation, comparing its
+  head against each operator symbol and looking parameters up by symbol. Only
+  handles what the benchmarked forms use.
+*/
+struct tree_evaluator_t
+{
+  std::vector<symbol_t> const &params;
+  double const *values;
+
+  sexpr_t eval(sexpr_t const &expr) const
+  {
+    static symbol_t const sym_add { "+" };
+    static symbol_t const sym_mul { "*" };
+    static symbol_t const sym_lt { "<" };
+    static symbol_t const sym_gt { ">" };
+    static symbol_t const sym_and { "and" };
+    static symbol_t const sym_if { "if" };
+
+    switch (expr.type()) {
+    case sexpr_t::NUMBER:
+    case sexpr_t::INTEGER:
+    case sexpr_t::BOOLEAN:
+      return expr;
+
+    case sexpr_t::SYMBOL: {
+        auto const param = std::find(params.begin(), params.end(), expr.symbol());
+        if (param == params.end()) {
+          throw std::runtime_error("unknown symbol");
+        }
+        return sexpr_t(values[param - params.begin()]);
+      }
+
+    case sexpr_t::LIST: {
+        symbol_t const &head = expr.begin()->symbol();
+        sexpr_t const *const args = expr.begin() + 1;
+        int const arg_count = expr.size() - 1;
+
+        if (head == sym_add || head == sym_mul) {
+          double result = head == sym_add ? 0.0 : 1.0;
+          for (int index = 0; index < arg_count; ++index) {
+            double const value = eval(args[index]).number();
+            result = head == sym_add ? result + value : result * value;
+          }
+          return sexpr_t(result);
+        } else if (head == sym_lt || head == sym_gt) {
+          double const lhs = eval(args[0]).number();
+          double const rhs = eval(args[1]).number();
+          return sexpr_t(head == sym_lt ? lhs < rhs : lhs > rhs);
+        } else if (head == sym_and) {
+          for (int index = 0; index < arg_count; ++index) {
+            if (!eval(args[index]).boolean()) {
+              return sexpr_t(false);
+            }
+          }
+          return sexpr_t(true);
+        } else if (head == sym_if) {
+          return eval(args[0]).boolean() ? eval(args[1]) : eval(args[2]);
+        }
+        throw std::runtime_error("unknown operator");
+      }
+
+    default:
+      throw std::runtime_error("cannot evaluate");
+    }
+  }
+};
+
+
+double as_double(sexpr_t const &value)
+{
+  return value.type() == sexpr_t::BOOLEAN ? (value.boolean() ? 1.0 : 0.0) : value.number();
+}
+
+
+void report_rate(char const *label, double seconds)
+{
+  std::printf("%-10s %10.3f ms  %8.2f Mevals/s  %7.1f ns/eval\n",
+    label, seconds * 1e3, NUM_EVALS / seconds / 1e6, seconds * 1e9 / NUM_EVALS);
+}
+
+
+// Evaluates form NUM_EVALS times with each evaluator, varying the first
+// parameter so neither can be hoisted out of the loop.
+void bench_form(string_t const &text, std::vector<symbol_t> const &params, std::vector<double> values)
+{
+  sexpr_t const form = parse(text);
+  sexpr_program_t const program = sexpr_program_t::compile(form, params);
+  std::printf("%s\n  %d instructions, %d registers\n",
+    text.c_str(), int(program.code_size()), program.register_count());
+
+  double const compile_seconds = best_of(5, [&] {
+    keep(sexpr_program_t::compile(form, params).code_size());
+  });
+  std::printf("%-10s %10.3f us\n", "compile", compile_seconds * 1e6);
+
+  double tree_sum = 0;
+  double const tree_seconds = best_of(3, [&] {
+    tree_sum = 0;
+    tree_evaluator_t const evaluator { params, values.data() };
+    for (int index = 0; index < NUM_EVALS; ++index) {
+      if (!values.empty()) {
+        values[0] = double(index & 31);
+      }
+      tree_sum += as_double(evaluator.eval(form));
+    }
+  });
+
+  double vm_sum = 0;
+  double const vm_seconds = best_of(3, [&] {
+    vm_sum = 0;
+    for (int index = 0; index < NUM_EVALS; ++index) {
+      if (!values.empty()) {
+        values[0] = double(index & 31);
+      }
+      vm_sum += program.run(values.data());
+    }
+  });
+
+  report_rate("tree-walk", tree_seconds);
+  report_rate("vm", vm_seconds);
+  std::printf("%-10s %10.2fx%s\n", "speedup", tree_seconds / vm_seconds,
+    tree_sum == vm_sum ? "" : "  (results differ!)");
+}
+
+
+void bench_arith()
+{
+  bench_form("(+ 1.5 2.5 3 4.5)", {}, {});
+  bench_form("(+ x (* x 2) (* x x 0.5))", { symbol_t("x") }, { 0 });
+}
+
+
+void bench_rule()
+{
+  bench_form("(if (and (> qty 10) (< price 100)) (* price qty 0.9) (* price qty))",
+    { symbol_t("qty"), symbol_t("price") }, { 0, 80 });
+}
+
+
+bench_case_t const cases[] = {
+  { "eval/arith", bench_arith },
+  { "eval/rule", bench_rule },
+};
+
+
+} // namespace
+
+
+int main(int argc, char const *argv[])
+{
+  return run_cases(argc, argv, std::begin(cases), std::end(cases));
+}
@@ -0,0 +1,669 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "scolex_config.hh"
+#include "csexp.hh"
+#include "sexpr.hh"
+#include "sexpr_document.hh"
+#include "sexpr_image.hh"
+#include "sexpr_parallel_reader.hh"
+#include "sexpr_push_parser.hh"
+#include "sexpr_reader.hh"
+#include "sexpr_scan.hh"
+#include "sexpr_walk.hh"
+#include "sexpr_writer.hh"
+#include "fstream.hh"
+#include "memstream.hh"
+#include "bench.hh"
+#include "bench_alloc.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+
+using namespace scolex;
+using namespace scolex::bench;
+
+
+namespace
+{
+
+
+char const *const BENCH_FILE = "io_bench.sexpr~";
+char const *const IMAGE_FILE = "io_bench.sxim~";
+size_t const TEXT_SIZE = 32 * 1024 * 1024;
+
+
+sexpr_t random_form(std::mt19937 &rng, int depth)
+{
+  static char const *const names[] = {
+    "define", "lambda", "let", "if", "+", "-", "config", "value", "name", "port",
+  };
+
+  std::uniform_int_distribution<int> kind_dist(0, depth > 0 ? 5 : 3);
+  std::uniform_int_distribution<int> name_dist(0, 9);
+  std::uniform_int_distribution<int> length_dist(1, 8);
+
+  switch (kind_dist(rng)) {
+  case 0: return sexpr_t(symbol_t(names[name_dist(rng)]));
+  case 1: return sexpr_t(std::uniform_real_distribution<double>(-1e6, 1e6)(rng));
+  case 2: return sexpr_t(string_t("str \"") + names[name_dist(rng)] + "\"\n");
+  case 3: return sexpr_t(bool(name_dist(rng) & 1));
+  default: {
+      list_t items;
+      items.push_back(sexpr_t(symbol_t(names[name_dist(rng)])));
+      int const length = length_dist(rng);
+      for (int index = 0; index < length; ++index) {
+        items.push_back(random_form(rng, depth - 1));
+      }
+      return sexpr_t(std::move(items));
+    }
+  }
+}
+
+
+// Generates roughly TEXT_SIZE bytes of top-level forms.
+string_t const &bench_text()
+{
+  static string_t text;
+  if (text.empty()) {
+    std::mt19937 rng { 1234 };
+    std::ostringstream out;
+    while (size_t(out.tellp()) < TEXT_SIZE) {
+      out << random_form(rng, 6) << '\n';
+    }
+    text = out.str();
+  }
+  return text;
+}
+
+
+void report_rate(char const *label, size_t bytes, double seconds, long forms)
+{
+  std::printf("%-16s %8.1f MB in %8.3f ms  %8.1f MB/s  (%ld forms)\n",
+    label, bytes / 1e6, seconds * 1e3, bytes / 1e6 / seconds, forms);
+}
+
+
+template <typename READER>
+long count_forms(READER &reader)
+{
+  long forms = 0;
+  sexpr_t form;
+  while (reader.read(form)) {
+    ++forms;
+  }
+  return forms;
+}
+
+
+void bench_read()
+{
+  string_t const &text = bench_text();
+
+  {
+    fstream_t out { BENCH_FILE, STREAM_WRITE };
+    io::write(out, int(text.size()), text.data());
+  }
+
+  long forms = 0;
+  double seconds = best_of(3, [&] {
+    fstream_t in { BENCH_FILE, STREAM_READ };
+    sexpr_reader_t<fstream_t> reader { in };
+    forms = count_forms(reader);
+  });
+  report_rate("fstream_t", text.size(), seconds, forms);
+
+  seconds = best_of(3, [&] {
+    memstream_t in { text };
+    sexpr_reader_t<memstream_t> reader { in };
+    forms = count_forms(reader);
+  });
+  report_rate("memstream_t", text.size(), seconds, forms);
+
+  seconds = best_of(3, [&] {
+    sexpr_buffer_reader_t reader { text.data(), text.data() + text.size() };
+    forms = count_forms(reader);
+  });
+  report_rate("buffer", text.size(), seconds, forms);
+
+  seconds = best_of(3, [&] {
+    sexpr_document_t document;
+    sexpr_buffer_reader_t reader { text.data(), text.data() + text.size() };
+    reader.set_document(&document);
+    forms = count_forms(reader);
+  });
+  report_rate("buffer+document", text.size(), seconds, forms);
+
+  std::remove(BENCH_FILE);
+}
+
+
+// Writes the bench text's forms with the ostream printer and with
+// sexpr_writer_t into various streams, then checks that what the writer wrote
+// reads back as the same forms.
+void bench_write()
+{
+  string_t const &text = bench_text();
+  list_t forms;
+  {
+    sexpr_buffer_reader_t reader { text.data(), text.data() + text.size() };
+    sexpr_t form;
+    while (reader.read(form)) {
+      forms.push_back(std::move(form));
+    }
+  }
+
+  long const form_count = long(forms.size());
+  size_t bytes = 0;
+
+  double seconds = best_of(3, [&] {
+    std::ostringstream out;
+    for (sexpr_t const &form : forms) {
+      out << form << '\n';
+    }
+    bytes = size_t(out.tellp());
+  });
+  report_rate("ostream", bytes, seconds, form_count);
+
+  seconds = best_of(3, [&] {
+    nulstream_t out;
+    sexpr_writer_t<nulstream_t> writer { out };
+    writer.write_lines(forms.data(), forms.data() + forms.size());
+    writer.flush();
+    bytes = size_t(writer.offset());
+  });
+  report_rate("nulstream_t", bytes, seconds, form_count);
+
+  string_t written;
+  seconds = best_of(3, [&] {
+    memstream_t out;
+    sexpr_writer_t<memstream_t> writer { out };
+    writer.write_lines(forms.data(), forms.data() + forms.size());
+    writer.flush();
+    written = out.release();
+  });
+  report_rate("memstream_t", written.size(), seconds, form_count);
+
+  seconds = best_of(3, [&] {
+    fstream_t out { BENCH_FILE, STREAM_WRITE };
+    sexpr_writer_t<fstream_t> writer { out };
+    writer.write_lines(forms.data(), forms.data() + forms.size());
+    writer.flush();
+  });
+  report_rate("fstream_t", written.size(), seconds, form_count);
+  std::remove(BENCH_FILE);
+
+  long mismatches = 0;
+  sexpr_buffer_reader_t reader { written.data(), written.data() + written.size() };
+  sexpr_t form;
+  for (sexpr_t const &expected : forms) {
+    if (!reader.read(form) || form != expected) {
+      ++mismatches;
+    }
+  }
+  std::printf("round trip: %ld of %ld forms differ\n", mismatches, form_count);
+}
+
+
+// Encodes and decodes the bench text's forms as canonical s-expressions and
+// as text, over the same in-memory data.
+void bench_csexp()
+{
+  string_t const &text = bench_text();
+  list_t forms;
+  {
+    sexpr_buffer_reader_t reader { text.data(), text.data() + text.size() };
+    sexpr_t form;
+    while (reader.read(form)) {
+      forms.push_back(std::move(form));
+    }
+  }
+
+  long const form_count = long(forms.size());
+  string_t written;
+
+  double seconds = best_of(3, [&] {
+    memstream_t out;
+    sexpr_writer_t<memstream_t> writer { out };
+    writer.write_lines(forms.data(), forms.data() + forms.size());
+    writer.flush();
+    written = out.release();
+  });
+  report_rate("text write", written.size(), seconds, form_count);
+
+  long forms_read = 0;
+  seconds = best_of(3, [&] {
+    sexpr_buffer_reader_t reader { written.data(), written.data() + written.size() };
+    forms_read = count_forms(reader);
+  });
+  report_rate("text read", written.size(), seconds, forms_read);
+
+  seconds = best_of(3, [&] {
+    memstream_t out;
+    csexp_writer_t<memstream_t> writer { out };
+    for (sexpr_t const &form : forms) {
+      writer.write(form);
+    }
+    writer.flush();
+    written = out.release();
+  });
+  report_rate("csexp write", written.size(), seconds, form_count);
+
+  seconds = best_of(3, [&] {
+    csexp_buffer_reader_t reader { written.data(), written.data() + written.size() };
+    forms_read = count_forms(reader);
+  });
+  report_rate("csexp read", written.size(), seconds, forms_read);
+
+  seconds = best_of(3, [&] {
+    memstream_t in { written };
+    csexp_reader_t<memstream_t> reader { in };
+    forms_read = count_forms(reader);
+  });
+  report_rate("csexp memstream", written.size(), seconds, forms_read);
+}
+
+
+// Number of atoms in expr, counted by walking it.
+long count_atoms(sexpr_t const &expr)
+{
+  long atoms = 0;
+  sexpr_walk_t walk { expr };
+  while (walk.next()) {
+    if (walk.event() == sexpr_walk_t::LEAF) {
+      ++atoms;
+    }
+  }
+  return atoms;
+}
+
+
+long count_atoms(sexpr_view_t const &view)
+{
+  long atoms = 0;
+  std::vector<std::pair<sexpr_view_t::iterator, sexpr_view_t::iterator>> stack;
+  stack.emplace_back(view.begin(), view.end());
+  while (!stack.empty()) {
+    auto &top = stack.back();
+    if (top.first == top.second) {
+      stack.pop_back();
+      continue;
+    }
+    sexpr_view_t const item = *top.first++;
+    if (item.type() == sexpr_t::LIST) {
+      stack.emplace_back(item.begin(), item.end());
+    } else {
+      ++atoms;
+    }
+  }
+  return atoms;
+}
+
+
+// Compares getting at the bench text's forms by parsing the text against
+// mapping them as an image and walking the views in place. Each walk counts
+// the atoms. The parse's heap is reused from setup, so its RSS delta is
+// understated; its allocated bytes are the fairer figure.
+void bench_image()
+{
+  string_t const &text = bench_text();
+  long form_count = 0;
+  {
+    list_t forms;
+    sexpr_buffer_reader_t reader { text.data(), text.data() + text.size() };
+    sexpr_t form;
+    while (reader.read(form)) {
+      forms.push_back(std::move(form));
+    }
+    form_count = long(forms.size());
+
+    fstream_t out { BENCH_FILE, STREAM_WRITE };
+    io::write(out, int(text.size()), text.data());
+    fstream_t image_out { IMAGE_FILE, STREAM_WRITE };
+    write_sexpr_image(image_out, sexpr_t(std::move(forms)));
+  }
+
+  long atoms = 0;
+  size_t rss_before = resident_bytes();
+  alloc_counts_t const parse_allocs = count_allocs([&] {
+    fstream_t in { BENCH_FILE, STREAM_READ };
+    sexpr_reader_t<fstream_t> reader { in };
+    list_t forms;
+    sexpr_t form;
+    while (reader.read(form)) {
+      forms.push_back(std::move(form));
+    }
+    sexpr_t const root { std::move(forms) };
+    atoms = count_atoms(root);
+  });
+  std::printf("parse: %ld allocs, %.1f MB allocated, RSS +%.1f MB\n",
+    parse_allocs.allocs, parse_allocs.bytes / 1e6, (resident_bytes() - rss_before) / 1e6);
+
+  rss_before = resident_bytes();
+  size_t image_bytes = 0;
+  size_t image_rss = 0;
+  long image_atoms = 0;
+  alloc_counts_t const image_allocs = count_allocs([&] {
+    sexpr_image_t const image = sexpr_image_t::open(IMAGE_FILE);
+    image_bytes = image.byte_size();
+    image_atoms = count_atoms(image.root());
+    image_rss = resident_bytes() - rss_before;
+  });
+  std::printf("image: %ld allocs, %.1f MB allocated, RSS +%.1f MB mapped (%.1f MB image, %ld of %ld atoms)\n",
+    image_allocs.allocs, image_allocs.bytes / 1e6, image_rss / 1e6,
+    image_bytes / 1e6, image_atoms, atoms);
+
+  double seconds = best_of(3, [&] {
+    fstream_t in { BENCH_FILE, STREAM_READ };
+    sexpr_reader_t<fstream_t> reader { in };
+    list_t forms;
+    sexpr_t form;
+    while (reader.read(form)) {
+      forms.push_back(std::move(form));
+    }
+    keep(count_atoms(sexpr_t(std::move(forms))));
+  });
+  report_rate("parse+walk", text.size(), seconds, form_count);
+
+  seconds = best_of(3, [&] {
+    sexpr_image_t const image = sexpr_image_t::open(IMAGE_FILE);
+    keep(count_atoms(image.root()));
+  });
+  report_rate("map+walk", image_bytes, seconds, form_count);
+
+  seconds = best_of(3, [&] {
+    sexpr_image_t const image = sexpr_image_t::open(IMAGE_FILE);
+    keep(image.root().to_sexpr());
+  });
+  report_rate("map+to_sexpr", image_bytes, seconds, form_count);
+
+  std::remove(BENCH_FILE);
+  std::remove(IMAGE_FILE);
+}
+
+
+// Counts events, the way a filter over a log of forms might.
+class counting_handler_t final : public sexpr_handler_t
+{
+public:
+  long atoms = 0;
+  long lists = 0;
+  long forms = 0;
+
+  void begin_list() override { ++lists; }
+  void nil() override { ++atoms; }
+  void symbol(string_view_t name) override { (void)name; ++atoms; }
+  void string(string_view_t str) override { (void)str; ++atoms; }
+  void number(double num) override { (void)num; ++atoms; }
+  void boolean(bool value) override { (void)value; ++atoms; }
+  void end_form() override { ++forms; }
+};
+
+
+// Pushes the bench text through sexpr_push_parser_t many times over, in
+// chunks, to show throughput with memory that stays flat no matter how much
+// is fed. The pull reader, which builds each form, is the baseline.
+void bench_push()
+{
+  int const REPEATS = 16;
+  size_t const CHUNK_SIZE = 64 * 1024;
+  string_t const &text = bench_text();
+
+  long forms = 0;
+  double seconds = best_of(3, [&] {
+    sexpr_buffer_reader_t reader { text.data(), text.data() + text.size() };
+    forms = count_forms(reader);
+  });
+  report_rate("pull reader", text.size(), seconds, forms);
+
+  seconds = best_of(3, [&] {
+    counting_handler_t handler;
+    sexpr_push_parser_t parser { handler };
+    parser.feed(text);
+    parser.finish();
+    forms = handler.forms;
+  });
+  report_rate("push whole", text.size(), seconds, forms);
+
+  seconds = best_of(3, [&] {
+    counting_handler_t handler;
+    sexpr_push_parser_t parser { handler };
+    parser.set_validate_utf8(false);
+    parser.feed(text);
+    parser.finish();
+    forms = handler.forms;
+  });
+  report_rate("push no-utf8", text.size(), seconds, forms);
+
+  size_t const rss_before = resident_bytes();
+  counting_handler_t handler;
+  alloc_counts_t const allocs = count_allocs([&] {
+    seconds = time_seconds([&] {
+      sexpr_push_parser_t parser { handler };
+      for (int repeat = 0; repeat < REPEATS; ++repeat) {
+        for (size_t offset = 0; offset < text.size(); offset += CHUNK_SIZE) {
+          parser.feed(text.data() + offset, std::min(CHUNK_SIZE, text.size() - offset));
+        }
+      }
+      parser.finish();
+    });
+  });
+  report_rate("push chunked", text.size() * REPEATS, seconds, handler.forms);
+  std::printf("push chunked: %ld allocs, %.1f KB allocated, RSS +%.1f MB over %.0f MB\n",
+    allocs.allocs, allocs.bytes / 1e3, (resident_bytes() - rss_before) / 1e6, text.size() * REPEATS / 1e6);
+
+  {
+    fstream_t out { BENCH_FILE, STREAM_WRITE };
+    io::write(out, int(text.size()), text.data());
+  }
+
+  seconds = best_of(3, [&] {
+    counting_handler_t handler;
+    sexpr_push_parser_t parser { handler };
+    std::vector<char> chunk(CHUNK_SIZE);
+    fstream_t in { BENCH_FILE, STREAM_READ };
+    int count = 0;
+    while ((count = io::read(in, int(chunk.size()), chunk.data())) > 0) {
+      parser.feed(chunk.data(), size_t(count));
+    }
+    parser.finish();
+    forms = handler.forms;
+  });
+  report_rate("push fstream_t", text.size(), seconds, forms);
+
+  std::remove(BENCH_FILE);
+}
+
+
+// Reads the bench text with read_sexprs_parallel on 1 to N threads, N being
+// the number of hardware threads, with forms on the heap and in documents.
+void bench_parallel()
+{
+  string_t const &text = bench_text();
+  unsigned const max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<unsigned> thread_counts;
+  for (unsigned threads = 1; threads < max_threads; threads *= 2) {
+    thread_counts.push_back(threads);
+  }
+  thread_counts.push_back(max_threads);
+
+  double split_seconds = best_of(3, [&] {
+    keep(split_sexpr_forms(text.data(), text.data() + text.size(), max_threads * 4));
+  });
+  report_rate("split", text.size(), split_seconds, 0);
+
+  struct storage_case_t
+  {
+    char const *label;
+    parallel_storage_t storage;
+  };
+  storage_case_t const storages[] = {
+    { "heap", PARALLEL_HEAP },
+    { "documents", PARALLEL_DOCUMENTS },
+  };
+
+  for (storage_case_t const &storage : storages) {
+    double single_seconds = 0;
+    for (unsigned threads : thread_counts) {
+      long forms = 0;
+      double const seconds = best_of(3, [&] {
+        sexpr_forms_t const read = read_sexprs_parallel(text.data(), text.data() + text.size(), threads, storage.storage);
+        forms = long(read.forms.size());
+      });
+      if (threads == 1) {
+        single_seconds = seconds;
+      }
+
+      char label[32];
+      std::snprintf(label, sizeof(label), "%s x%u", storage.label, threads);
+      report_rate(label, text.size(), seconds, forms);
+      std::printf("%-16s %8.2fx\n", "  speedup", single_seconds / seconds);
+    }
+  }
+
+  {
+    fstream_t out { BENCH_FILE, STREAM_WRITE };
+    io::write(out, int(text.size()), text.data());
+  }
+  long forms = 0;
+  double const seconds = best_of(3, [&] {
+    forms = long(read_sexpr_file_parallel(BENCH_FILE, max_threads).forms.size());
+  });
+  report_rate("mapped file", text.size(), seconds, forms);
+  std::remove(BENCH_FILE);
+}
+
+
+// Builds the bench text's token index with each kernel this CPU supports,
+// reporting the number of tokens in place of forms.
+void bench_scan()
+{
+  string_t const &text = bench_text();
+
+  struct kernel_case_t
+  {
+    char const *label;
+    sexpr_scan_kernel_t kernel;
+  };
+  kernel_case_t const kernels[] = {
+    { "scan scalar", SCAN_SCALAR },
+    { "scan sse2", SCAN_SSE2 },
+    { "scan avx2", SCAN_AVX2 },
+  };
+
+  std::vector<uint32_t> index;
+  index.reserve(text.size() / 2);
+  for (kernel_case_t const &kernel : kernels) {
+    if (!sexpr_scanner_t::supported(kernel.kernel)) {
+      continue;
+    }
+
+    double const seconds = best_of(5, [&] {
+      index.clear();
+      sexpr_scanner_t scanner { kernel.kernel };
+      scanner.scan(text.data(), text.size(), index);
+    });
+    report_rate(kernel.label, text.size(), seconds, long(index.size()));
+  }
+}
+
+
+// Reads rows of integer ids and counts, written once as integers and once
+// with a ".0" on each, which reads them as doubles the way every number used
+// to be read, then compares each copy's rows against a second read of it.
+// Ids are 62-bit, so the doubles also show how many of them don't survive.
+void bench_integers()
+{
+  std::mt19937_64 rng { 1234 };
+  std::uniform_int_distribution<int64_t> id_dist(int64_t(1) << 53, int64_t(1) << 62);
+  std::uniform_int_distribution<int> count_dist(0, 100000);
+
+  std::ostringstream int_out;
+  std::ostringstream num_out;
+  std::vector<int64_t> ids;
+  while (size_t(int_out.tellp()) < TEXT_SIZE / 4) {
+    int64_t const id = id_dist(rng);
+    int const counts[] = { count_dist(rng), count_dist(rng), count_dist(rng), count_dist(rng) };
+    ids.push_back(id);
+    int_out << "(row " << id;
+    num_out << "(row " << id << ".0";
+    for (int const count : counts) {
+      int_out << ' ' << count;
+      num_out << ' ' << count << ".0";
+    }
+    int_out << ")\n";
+    num_out << ")\n";
+  }
+
+  struct text_case_t
+  {
+    char const *label;
+    string_t text;
+  };
+  text_case_t const texts[] = {
+    { "integers", int_out.str() },
+    { "doubles", num_out.str() },
+  };
+
+  for (text_case_t const &text : texts) {
+    auto read_all = [&text] {
+      list_t forms;
+      sexpr_buffer_reader_t reader { text.text.data(), text.text.data() + text.text.size() };
+      sexpr_t form;
+      while (reader.read(form)) {
+        forms.push_back(std::move(form));
+      }
+      return forms;
+    };
+
+    list_t forms;
+    double seconds = best_of(3, [&] { forms = read_all(); });
+    report_rate(text.label, text.text.size(), seconds, long(forms.size()));
+
+    list_t const others = read_all();
+    long equal = 0;
+    seconds = best_of(5, [&] {
+      equal = 0;
+      for (size_t index = 0; index < forms.size(); ++index) {
+        equal += forms[index] == others[index];
+      }
+    });
+    std::printf("%-16s %8.3f ms to compare %ld rows, %ld equal\n", "", seconds * 1e3, long(forms.size()), equal);
+
+    long exact = 0;
+    for (size_t index = 0; index < forms.size(); ++index) {
+      sexpr_t const &id = forms[index][1];
+      exact += id.type() == sexpr_t::INTEGER ? id.integer() == ids[index] : int64_t(id.number()) == ids[index];
+    }
+    std::printf("%-16s %ld of %ld ids read back exactly\n", "", exact, long(forms.size()));
+  }
+}
+
+
+bench_case_t const cases[] = {
+  { "io/read", bench_read },
+  { "io/write", bench_write },
+  { "io/csexp", bench_csexp },
+  { "io/image", bench_image },
+  { "io/push", bench_push },
+  { "io/parallel", bench_parallel },
+  { "io/scan", bench_scan },
+  { "io/integers", bench_integers },
+};
+
+
+} // namespace
+
+
+int main(int argc, char const *argv[])
+{
+  return run_cases(argc, argv, std::begin(cases), std::end(cases));
+}
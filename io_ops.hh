@@ -10,6 +10,9 @@
 #include "scolex_config.hh"
 #include "stream_enums.hh"
 
+#include <cstring>
+#include <stdexcept>
+
 
 namespace scolex
 {
@@ -0,0 +1,141 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "mapped_file.hh"
+
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+# define SCOLEX_HAVE_MMAP 1
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#else
+# define SCOLEX_HAVE_MMAP 0
+#endif
+
+
+namespace scolex
+{
+
+
+mapped_file_t::mapped_file_t()
+: data_(nullptr)
+, size_(0)
+, mapped_(false)
+{
+  /* nop */
+}
+
+
+mapped_file_t::mapped_file_t(string_t const &path)
+: mapped_file_t()
+{
+#if SCOLEX_HAVE_MMAP
+  int const fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open " + path);
+  }
+
+  struct stat info;
+  if (::fstat(fd, &info) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Could not stat " + path);
+  } else if (info.st_size == 0) {
+    ::close(fd);
+    return;
+  }
+
+  void *const mapped = ::mmap(nullptr, std::size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("Could not map " + path);
+  }
+
+  data_ = static_cast<char const *>(mapped);
+  size_ = std::size_t(info.st_size);
+  mapped_ = true;
+#else
+  std::FILE *const file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    throw std::runtime_error("Could not open " + path);
+  }
+
+  std::fseek(file, 0, SEEK_END);
+  long const size = std::ftell(file);
+  std::fseek(file, 0, SEEK_SET);
+  if (size <= 0) {
+    std::fclose(file);
+    return;
+  }
+
+  char *const data = new char[std::size_t(size)];
+  bool const read = std::fread(data, 1, std::size_t(size), file) == std::size_t(size);
+  std::fclose(file);
+  if (!read) {
+    delete[] data;
+    throw std::runtime_error("Could not read " + path);
+  }
+
+  data_ = data;
+  size_ = std::size_t(size);
+#endif
+}
+
+
+mapped_file_t::~mapped_file_t()
+{
+  release();
+}
+
+
+mapped_file_t::mapped_file_t(mapped_file_t &&file)
+: mapped_file_t()
+{
+  *this = std::move(file);
+}
+
+
+mapped_file_t &mapped_file_t::operator = (mapped_file_t &&file)
+{
+  if (&file != this) {
+    release();
+    data_ = file.data_;
+    size_ = file.size_;
+    mapped_ = file.mapped_;
+    file.data_ = nullptr;
+    file.size_ = 0;
+    file.mapped_ = false;
+  }
+  return *this;
+}
+
+
+void mapped_file_t::release()
+{
+  if (!data_) {
+    return;
+  }
+
+#if SCOLEX_HAVE_MMAP
+  if (mapped_) {
+    ::munmap(const_cast<char *>(data_), size_);
+  } else {
+    delete[] data_;
+  }
+#else
+  delete[] data_;
+#endif
+
+  data_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+}
+
+
+} // namespace scolex
@@ -0,0 +1,58 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_MAPPED_FILE_HH__
+#define __SCOLEX_MAPPED_FILE_HH__
+
+#include "scolex_config.hh"
+
+#include <cstddef>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  mapped_file_t
+
+  A whole file mapped read-only into memory, or, where mmap isn't available,
+  read into a buffer. Either way the contents are aligned to at least 8 bytes
+  and stay put until the mapped_file_t is destroyed or moved from.
+
+==============================================================================*/
+class mapped_file_t
+{
+public:
+  // Empty; data() is null.
+  mapped_file_t();
+  // Maps the file at path. Throws std::runtime_error if it can't be opened or
+  // read.
+  explicit mapped_file_t(string_t const &path);
+  ~mapped_file_t();
+
+  mapped_file_t(mapped_file_t &&file);
+  mapped_file_t &operator = (mapped_file_t &&file);
+  mapped_file_t(mapped_file_t const &) = delete;
+  mapped_file_t &operator = (mapped_file_t const &) = delete;
+
+  char const *data() const { return data_; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+private:
+  char const *data_;
+  std::size_t size_;
+  // Whether data_ was mapped, rather than allocated with new[].
+  bool mapped_;
+
+  void release();
+};
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_MAPPED_FILE_HH__ include guard */
@@ -0,0 +1,109 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "memstream.hh"
+
+#include <algorithm>
+
+
+namespace scolex
+{
+
+
+memstream_t::memstream_t()
+: data_()
+, pos_(0)
+{
+  /* nop */
+}
+
+
+memstream_t::memstream_t(string_t data)
+: data_(std::move(data))
+, pos_(0)
+{
+  /* nop */
+}
+
+
+int memstream_t::read(int num_bytes, void *buffer)
+{
+  if (num_bytes < 0) {
+    return -1;
+  } else if (pos_ >= data_.size()) {
+    return 0;
+  }
+
+  size_t const count = std::min(size_t(num_bytes), data_.size() - pos_);
+  std::memcpy(buffer, data_.data() + pos_, count);
+  pos_ += count;
+  return int(count);
+}
+
+
+int memstream_t::write(int num_bytes, const void *buffer)
+{
+  if (num_bytes < 0) {
+    return -1;
+  } else if (num_bytes == 0) {
+    return 0;
+  }
+
+  size_t const count = size_t(num_bytes);
+  if (pos_ == data_.size()) {
+    data_.append(static_cast<char const *>(buffer), count);
+  } else {
+    if (pos_ + count > data_.size()) {
+      data_.resize(pos_ + count);
+    }
+    data_.replace(pos_, count, static_cast<char const *>(buffer), count);
+  }
+  pos_ += count;
+  return num_bytes;
+}
+
+
+bool memstream_t::eof() const
+{
+  return pos_ >= data_.size();
+}
+
+
+int memstream_t::tell() const
+{
+  return int(pos_);
+}
+
+
+int memstream_t::seek(int pos, stream_seek_origin_t origin)
+{
+  long base = 0;
+
+  switch (origin) {
+  case STREAM_SEEK_CUR: base = long(pos_); break;
+  case STREAM_SEEK_SET: base = 0; break;
+  case STREAM_SEEK_END: base = long(data_.size()); break;
+  }
+
+  long const next = base + pos;
+  if (next < 0) {
+    return -1;
+  }
+
+  pos_ = size_t(next);
+  return tell();
+}
+
+
+string_t memstream_t::release()
+{
+  string_t result { std::move(data_) };
+  data_.clear();
+  pos_ = 0;
+  return result;
+}
+
+
+} // namespace scolex
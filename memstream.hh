@@ -0,0 +1,57 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_MEMSTREAM_HH__
+#define __SCOLEX_MEMSTREAM_HH__
+
+#include "scolex_config.hh"
+#include "basestream.hh"
+
+
+namespace scolex
+{
+
+/*==============================================================================
+
+  Memory stream
+
+  Reads from and writes to a growable in-memory buffer. Writes past the end of
+  the buffer extend it; reads past the end return short counts.
+
+==============================================================================*/
+struct memstream_t
+{
+  // Empty stream.
+  memstream_t();
+  // Stream over a copy of data, positioned at its start.
+  explicit memstream_t(string_t data);
+
+  memstream_t(const memstream_t &stream) = default;
+  memstream_t(memstream_t &&stream) = default;
+
+  memstream_t &operator = (const memstream_t &stream) = default;
+  memstream_t &operator = (memstream_t &&stream) = default;
+
+  int read(int num_bytes, void *buffer);
+  int write(int num_bytes, const void *buffer);
+
+  bool eof() const;
+  int tell() const;
+  int seek(int pos, stream_seek_origin_t origin);
+
+  // The stream's entire contents, regardless of its position.
+  string_t const &data() const { return data_; }
+  // Releases the stream's contents and resets its position to 0.
+  string_t release();
+
+private:
+  string_t data_;
+  size_t pos_;
+};
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_MEMSTREAM_HH__ include guard */
@@ -182,7 +182,8 @@ public:
   value_type &operator * () { return get(); }
   value_type const &operator * () const { return get(); }
 
-  value_type *operator -> () const { return get(); }
+  value_type *operator -> () { return &get(); }
+  value_type const *operator -> () const { return &get(); }
 
   operator bool () const { return is_defined(); }
   bool operator ! () const { return is_empty(); }
@@ -311,7 +312,7 @@ option_t<T>::option_t() noexcept
 
 
 template <typename T>
-option_t<T>::option_t(none_t const &n) noexcept
+option_t<T>::option_t(none_t const &) noexcept
 : _defined(false)
 {
   /* nop */
@@ -506,14 +507,14 @@ bool operator != (none_t const &lhs, option_t<T> const &rhs) noexcept
 
 
 
-constexpr bool operator == (none_t const &lhs, none_t const &rhs) noexcept
+constexpr bool operator == (none_t const &, none_t const &) noexcept
 {
   return true;
 }
 
 
 
-constexpr bool operator != (none_t const &lhs, none_t const &rhs) noexcept
+constexpr bool operator != (none_t const &, none_t const &) noexcept
 {
   return false;
 }
@@ -562,7 +563,7 @@ constexpr none_t none = none_t();
 
 
 
-inline std::ostream &operator << (std::ostream &out, none_t const &non)
+inline std::ostream &operator << (std::ostream &out, none_t const &)
 {
   return out << "none";
 }
@@ -641,7 +642,7 @@ public:
 
 
 
-  option_t &assign(none_t const &non) noexcept
+  option_t &assign(none_t const &) noexcept
   {
     _defined = false;
     return *this;
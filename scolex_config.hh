@@ -27,6 +27,30 @@
 #define Q_CXX_VERSION_LEVEL 11
 
 
+// Define SCOLEX_COMPACT_SYMBOLS as 1 to store each symbol_t as its 4-byte id
+// instead of a pointer to its interned data. Symbols take half the space,
+// but value() and hash() cost an extra lookup.
+#if !defined(SCOLEX_COMPACT_SYMBOLS)
+# define SCOLEX_COMPACT_SYMBOLS 0
+#endif
+
+
+// Define SCOLEX_RECLAIM_SYMBOLS as 1 to reference count interned symbols so
+// that symbol_t::collect() can free the ones no symbol_t refers to anymore.
+// Copying a symbol costs an atomic increment, and lookups by name lock.
+#if !defined(SCOLEX_RECLAIM_SYMBOLS)
+# define SCOLEX_RECLAIM_SYMBOLS 0
+#endif
+
+
+// Define SCOLEX_THREADSAFE_REFCOUNTS as 0 if sexprs are never shared between
+// threads. List and string bodies are then counted with plain increments and
+// decrements instead of atomic ones.
+#if !defined(SCOLEX_THREADSAFE_REFCOUNTS)
+# define SCOLEX_THREADSAFE_REFCOUNTS 1
+#endif
+
+
 namespace scolex
 {
 
@@ -4,80 +4,1153 @@
 // http://www.boost.org/LICENSE_1_0.txt)
 
 #include "sexpr.hh"
+#include "sexpr_document.hh"
+#include "sexpr_lex.hh"
+#include "sexpr_walk.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+
+namespace scolex
+{
+
+
+// symbol implementation
+
+/*
+  The intern table is split into SHARD_COUNT shards selected by the top bits
+  of a symbol's hash. Each shard is an open-addressed, insert-only table of
+  atomic pointers to interned symbols.
+
+  Readers never lock: they load the shard's current slot array and probe it.
+  Writers take the shard's lock, re-probe, and either store into an empty slot
+  or, when the shard is half full, publish a new slot array twice the size.
+  Retired slot arrays and interned symbols are kept for the lifetime of the
+  table, so a reader holding an old array never touches freed memory -- at
+  worst it misses a symbol inserted after it loaded the array and falls back
+  to the locked path, which re-probes the current array.
+
+  Symbols are matched by hash and then by their full string, so strings with
+  colliding hashes still intern as distinct symbols.
+
+  Each symbol is also given the next id when it's interned and stored in a
+  directory of symbols by id. The directory is a list of chunks, each twice
+  the size of the last, so chunks never move once allocated and lookups by id
+  never lock either.
+
+  With SCOLEX_RECLAIM_SYMBOLS, symbols are reference counted and collect()
+  frees those with no references, so the table above no longer keeps
+  everything forever. A count can only rise from zero while a shard's lock
+  (for lookups by name) or the directory's lock (for lookups by id) is held,
+  and collect() holds both while it decides what's dead, so nothing can
+  revive a symbol it's freeing. That means lookups by name lock too: there's
+  no lock-free probe left to race with a freed symbol or a retired slot
+  array, so collect() rebuilds each shard's slots without its dead symbols
+  and frees the old ones. Freed ids are reused before new ones are taken.
+*/
+struct symbol_t::table_t
+{
+  using sym_ptr_t = interned_sym_t const *;
+
+  enum : std::size_t {
+    SHARD_BITS = 6,
+    SHARD_COUNT = std::size_t(1) << SHARD_BITS,
+    INITIAL_CAPACITY = 64,
+    // Batches of at least this many names per thread are hashed in parallel.
+    PARALLEL_HASH_MIN = 1 << 16,
+    // How many names ahead intern_all() prefetches slots.
+    PREFETCH_DISTANCE = 8,
+  };
+
+  enum : uint32_t {
+    FIRST_CHUNK_BITS = 10,
+    // Enough chunks for every uint32_t id.
+    CHUNK_COUNT = 32 - FIRST_CHUNK_BITS + 1,
+    // The reference count collect() gives the symbols it's about to free.
+    DEAD = UINT32_MAX,
+  };
+
+  struct slots_t
+  {
+    std::size_t const mask;
+    std::unique_ptr<std::atomic<sym_ptr_t>[]> const slots;
+
+    explicit slots_t(std::size_t capacity)
+    : mask(capacity - 1)
+    , slots(new std::atomic<sym_ptr_t>[capacity])
+    {
+      for (std::size_t index = 0; index < capacity; ++index) {
+        slots[index].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+
+    std::size_t capacity() const { return mask + 1; }
+  };
+
+  struct shard_t
+  {
+    std::atomic<slots_t const *> current { nullptr };
+    std::mutex lock;
+    std::size_t count = 0;
+    // All slot arrays ever published by this shard, current one last.
+    std::vector<std::unique_ptr<slots_t>> generations;
+    std::vector<std::unique_ptr<interned_sym_t>> symbols;
+
+    shard_t()
+    {
+      generations.emplace_back(new slots_t(INITIAL_CAPACITY));
+      current.store(generations.back().get(), std::memory_order_release);
+    }
+  };
+
+  shard_t shards[SHARD_COUNT];
+
+  std::atomic<uint32_t> next_id { 0 };
+  // Symbols added by preload(), all allocated at once.
+  std::unique_ptr<interned_sym_t[]> preloaded;
+  // Symbols added by intern_all(), allocated a batch at a time.
+  std::mutex batches_lock;
+  std::vector<std::unique_ptr<interned_sym_t[]>> batches;
+  std::mutex chunks_lock;
+  std::atomic<std::atomic<sym_ptr_t> *> chunks[CHUNK_COUNT];
+#if SCOLEX_RECLAIM_SYMBOLS
+  // Ids of reclaimed symbols. Guarded by chunks_lock.
+  std::vector<uint32_t> free_ids;
+#endif
+
+  table_t()
+  {
+    for (auto &chunk : chunks) {
+      chunk.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  ~table_t()
+  {
+    for (auto &chunk : chunks) {
+      delete [] chunk.load(std::memory_order_relaxed);
+    }
+  }
+
+  // Finds the chunk holding id and id's index in it. Chunk N starts at id
+  // (2^N - 1) << FIRST_CHUNK_BITS.
+  static void locate(uint32_t id, uint32_t &chunk, uint32_t &index)
+  {
+    uint64_t const biased = uint64_t(id) + (uint64_t(1) << FIRST_CHUNK_BITS);
+#if defined(__GNUC__)
+    uint32_t const top_bit = uint32_t(63 - __builtin_clzll(biased));
+#else
+    uint32_t top_bit = 0;
+    while (biased >> (top_bit + 1)) {
+      ++top_bit;
+    }
+#endif
+    chunk = top_bit - FIRST_CHUNK_BITS;
+    index = uint32_t(biased - (uint64_t(1) << top_bit));
+  }
+
+  sym_ptr_t find_id(uint32_t id) const
+  {
+    uint32_t chunk, index;
+    locate(id, chunk, index);
+    std::atomic<sym_ptr_t> const *const slots = chunks[chunk].load(std::memory_order_acquire);
+    return slots ? slots[index].load(std::memory_order_acquire) : nullptr;
+  }
+
+  void publish_id(sym_ptr_t sym)
+  {
+    uint32_t chunk, index;
+    locate(sym->id, chunk, index);
+
+    std::atomic<sym_ptr_t> *slots = chunks[chunk].load(std::memory_order_acquire);
+    if (!slots) {
+      std::lock_guard<std::mutex> guard { chunks_lock };
+      slots = chunks[chunk].load(std::memory_order_relaxed);
+      if (!slots) {
+        std::size_t const size = std::size_t(1) << (FIRST_CHUNK_BITS + chunk);
+        slots = new std::atomic<sym_ptr_t>[size];
+        for (std::size_t slot = 0; slot < size; ++slot) {
+          slots[slot].store(nullptr, std::memory_order_relaxed);
+        }
+        chunks[chunk].store(slots, std::memory_order_release);
+      }
+    }
+
+    slots[index].store(sym, std::memory_order_release);
+  }
+
+#if SCOLEX_RECLAIM_SYMBOLS
+  // Must be called with chunks_lock held.
+  void clear_id(uint32_t id)
+  {
+    uint32_t chunk, index;
+    locate(id, chunk, index);
+    chunks[chunk].load(std::memory_order_relaxed)[index].store(nullptr, std::memory_order_release);
+  }
+#endif
+
+  static std::size_t shard_index(hash_t hash)
+  {
+    return (hash >> (sizeof(hash_t) * 8 - SHARD_BITS)) & (SHARD_COUNT - 1);
+  }
+
+  static shard_t &shard_for(table_t &table, hash_t hash)
+  {
+    return table.shards[shard_index(hash)];
+  }
+
+  static sym_ptr_t probe(slots_t const &slots, hash_t hash, string_view_t name)
+  {
+    for (std::size_t index = hash & slots.mask; ; index = (index + 1) & slots.mask) {
+      sym_ptr_t const sym = slots.slots[index].load(std::memory_order_acquire);
+      if (!sym) {
+        return nullptr;
+      } else if (sym->hash == hash && sym->string.size() == name.size() &&
+          std::memcmp(sym->string.data(), name.data(), name.size()) == 0) {
+        return sym;
+      }
+    }
+  }
+
+  static void prefetch(slots_t const &slots, hash_t hash)
+  {
+#if defined(__GNUC__)
+    __builtin_prefetch(&slots.slots[hash & slots.mask]);
+#else
+    (void)slots;
+    (void)hash;
+#endif
+  }
+
+  static void place(slots_t const &slots, sym_ptr_t sym)
+  {
+    std::size_t index = sym->hash & slots.mask;
+    while (slots.slots[index].load(std::memory_order_relaxed)) {
+      index = (index + 1) & slots.mask;
+    }
+    slots.slots[index].store(sym, std::memory_order_release);
+  }
+
+  // Grows the shard's slots, if needed, so that count symbols leave them at
+  // most half full. Must be called with the shard's lock held.
+  static void reserve(shard_t &shard, std::size_t count)
+  {
+    slots_t const &old_slots = *shard.generations.back();
+    std::size_t capacity = old_slots.capacity();
+    if (count * 2 <= capacity) {
+      return;
+    }
+    while (count * 2 > capacity) {
+      capacity *= 2;
+    }
+
+    std::unique_ptr<slots_t> next { new slots_t(capacity) };
+    for (std::size_t index = 0; index < old_slots.capacity(); ++index) {
+      sym_ptr_t const sym = old_slots.slots[index].load(std::memory_order_relaxed);
+      if (sym) {
+        place(*next, sym);
+      }
+    }
+
+    shard.generations.push_back(std::move(next));
+    shard.current.store(shard.generations.back().get(), std::memory_order_release);
+  }
+
+  uint32_t take_id()
+  {
+#if SCOLEX_RECLAIM_SYMBOLS
+    {
+      std::lock_guard<std::mutex> guard { chunks_lock };
+      if (!free_ids.empty()) {
+        uint32_t const id = free_ids.back();
+        free_ids.pop_back();
+        return id;
+      }
+    }
+#endif
+    uint32_t const id = next_id.fetch_add(1, std::memory_order_relaxed);
+    if (id == UINT32_MAX) {
+      next_id.store(UINT32_MAX, std::memory_order_relaxed);
+      throw std::runtime_error("Unable to intern symbol: out of symbol ids");
+    }
+    return id;
+  }
+
+  // Adds a numbered symbol that isn't in the shard yet. Must be called with
+  // the shard's lock held.
+  void add(shard_t &shard, sym_ptr_t sym)
+  {
+    reserve(shard, shard.count + 1);
+    publish_id(sym);
+    place(*shard.generations.back(), sym);
+    ++shard.count;
+  }
+
+  // Gives the caller a reference to sym, if it isn't null, when symbols are
+  // reclaimable. Must be called with the lock of sym's shard held.
+  static sym_ptr_t claim(sym_ptr_t sym)
+  {
+#if SCOLEX_RECLAIM_SYMBOLS
+    if (sym) {
+      retain(sym);
+    }
+#endif
+    return sym;
+  }
+
+  // Must be called with the shard's lock held.
+  sym_ptr_t insert(shard_t &shard, hash_t hash, string_view_t name, string_t *owned)
+  {
+    std::unique_ptr<interned_sym_t> ptr {
+      new interned_sym_t { hash, take_id(), owned ? std::move(*owned) : name.str()
+#if SCOLEX_RECLAIM_SYMBOLS
+        , { 0 }
+#endif
+      }
+    };
+    if (!ptr) {
+      throw std::runtime_error("Unable to allocate interned symbol data");
+    }
+
+    sym_ptr_t const sym = ptr.get();
+    shard.symbols.push_back(std::move(ptr));
+    add(shard, sym);
+    return sym;
+  }
+
+  // Never locks unless symbols are reclaimable; may miss a symbol being
+  // interned by another thread.
+  sym_ptr_t find(string_view_t name)
+  {
+    hash_t const hash = hash_name(name.data(), name.size());
+    shard_t &shard = shard_for(*this, hash);
+#if SCOLEX_RECLAIM_SYMBOLS
+    std::lock_guard<std::mutex> guard { shard.lock };
+#endif
+    return claim(probe(*shard.current.load(std::memory_order_acquire), hash, name));
+  }
+
+  // Interns name, which is the contents of owned if that isn't null; owned
+  // is moved into the new symbol rather than copying name.
+  sym_ptr_t intern(string_view_t name, string_t *owned)
+  {
+    hash_t const hash = hash_name(name.data(), name.size());
+    shard_t &shard = shard_for(*this, hash);
+
+#if !SCOLEX_RECLAIM_SYMBOLS
+    sym_ptr_t const found = probe(*shard.current.load(std::memory_order_acquire), hash, name);
+    if (found) {
+      return found;
+    }
+#endif
+
+    std::lock_guard<std::mutex> guard { shard.lock };
+
+    sym_ptr_t const sym = probe(*shard.generations.back(), hash, name);
+    return claim(sym ? sym : insert(shard, hash, name, owned));
+  }
+
+  static void hash_names(string_view_t const *names, std::size_t count, hash_t *hashes)
+  {
+    for (std::size_t index = 0; index < count; ++index) {
+      hashes[index] = hash_name(names[index].data(), names[index].size());
+    }
+  }
+
+  // Hashes names on as many threads as the batch is big enough for, the
+  // calling thread taking the first slice.
+  static void hash_names_parallel(string_view_t const *names, std::size_t count, hash_t *hashes)
+  {
+    std::size_t const cores = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t const threads = std::min(cores, count / PARALLEL_HASH_MIN);
+    if (threads <= 1) {
+      hash_names(names, count, hashes);
+      return;
+    }
+
+    std::size_t const slice = (count + threads - 1) / threads;
+    std::vector<std::thread> workers;
+    std::size_t hashed_from = slice;
+    try {
+      for (; hashed_from < count; hashed_from += slice) {
+        std::size_t const size = std::min(slice, count - hashed_from);
+        workers.emplace_back(hash_names, names + hashed_from, size, hashes + hashed_from);
+      }
+    } catch (...) {
+      // Couldn't start a thread: hash what's left here instead.
+      hash_names(names + hashed_from, count - hashed_from, hashes + hashed_from);
+    }
+
+    hash_names(names, std::min(slice, count), hashes);
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+  }
+
+  void intern_all(string_view_t const *names, std::size_t count, sym_ptr_t *out)
+  {
+    std::vector<hash_t> hashes(count);
+    hash_names_parallel(names, count, hashes.data());
+
+    std::vector<std::unique_lock<std::mutex>> guards;
+#if SCOLEX_RECLAIM_SYMBOLS
+    // Lookups have to lock, so lock every shard the batch touches first.
+    bool touched[SHARD_COUNT] = {};
+    for (hash_t const hash : hashes) {
+      touched[shard_index(hash)] = true;
+    }
+    for (std::size_t index = 0; index < SHARD_COUNT; ++index) {
+      if (touched[index]) {
+        guards.emplace_back(shards[index].lock);
+      }
+    }
+#endif
+
+    // Find what's already interned without locking, counting what's missing
+    // from each shard.
+    std::size_t shard_missing[SHARD_COUNT] = {};
+    std::size_t missing = 0;
+    for (std::size_t index = 0; index < count; ++index) {
+      if (index + PREFETCH_DISTANCE < count) {
+        hash_t const ahead = hashes[index + PREFETCH_DISTANCE];
+        prefetch(*shard_for(*this, ahead).current.load(std::memory_order_acquire), ahead);
+      }
+      out[index] = probe(*shard_for(*this, hashes[index]).current.load(std::memory_order_acquire),
+        hashes[index], names[index]);
+      if (!out[index]) {
+        ++shard_missing[shard_index(hashes[index])];
+        ++missing;
+      }
+    }
+    if (missing == 0) {
+      claim_all(out, count);
+      return;
+    }
+
+    // Lock every shard that's missing a name, in order, and make room for
+    // all of them at once. Adding names in the order given then keeps reads
+    // of them sequential and numbers new symbols in that order.
+    for (std::size_t index = 0; index < SHARD_COUNT; ++index) {
+      if (shard_missing[index]) {
+#if !SCOLEX_RECLAIM_SYMBOLS
+        guards.emplace_back(shards[index].lock);
+#endif
+        reserve(shards[index], shards[index].count + shard_missing[index]);
+      }
+    }
+
+#if !SCOLEX_RECLAIM_SYMBOLS
+    // One allocation for all the new symbols -- a few too many if names
+    // repeat or another thread interned some of them first. Reclaimable
+    // symbols are freed one at a time, so they're allocated that way too.
+    interned_sym_t *next = nullptr;
+    {
+      std::unique_ptr<interned_sym_t[]> batch { new interned_sym_t[missing] };
+      next = batch.get();
+      std::lock_guard<std::mutex> guard { batches_lock };
+      batches.push_back(std::move(batch));
+    }
+#endif
+
+    for (std::size_t index = 0; index < count; ++index) {
+      // The slot a name lands in is almost always a cache miss; fetching a
+      // few names ahead lets those misses overlap.
+      if (index + PREFETCH_DISTANCE < count && !out[index + PREFETCH_DISTANCE]) {
+        hash_t const ahead = hashes[index + PREFETCH_DISTANCE];
+        prefetch(*shard_for(*this, ahead).generations.back(), ahead);
+      }
+      if (out[index]) {
+        continue;
+      }
+
+      shard_t &shard = shard_for(*this, hashes[index]);
+      sym_ptr_t sym = probe(*shard.generations.back(), hashes[index], names[index]);
+      if (!sym) {
+#if SCOLEX_RECLAIM_SYMBOLS
+        sym = insert(shard, hashes[index], names[index], nullptr);
+#else
+        next->hash = hashes[index];
+        next->id = take_id();
+        next->string.assign(names[index].data(), names[index].size());
+        sym = next++;
+        add(shard, sym);
+#endif
+      }
+      out[index] = sym;
+    }
+    claim_all(out, count);
+  }
+
+  // Must be called with the lock of every shard in syms held.
+  static void claim_all(sym_ptr_t const *syms, std::size_t count)
+  {
+#if SCOLEX_RECLAIM_SYMBOLS
+    for (std::size_t index = 0; index < count; ++index) {
+      claim(syms[index]);
+    }
+#else
+    (void)syms;
+    (void)count;
+#endif
+  }
+
+  void preload(string_view_t const *names, hash_t const *hashes, uint32_t count)
+  {
+    std::vector<std::unique_lock<std::mutex>> guards;
+    for (shard_t &shard : shards) {
+      guards.emplace_back(shard.lock);
+    }
+
+    if (next_id.load(std::memory_order_relaxed) != 0) {
+      throw std::runtime_error("Cannot preload symbols once any have been interned");
+    }
+
+    std::unique_ptr<interned_sym_t[]> syms { new interned_sym_t[count] };
+    std::size_t shard_counts[SHARD_COUNT] = {};
+    for (uint32_t id = 0; id < count; ++id) {
+      interned_sym_t &sym = syms[id];
+      sym.string.assign(names[id].data(), names[id].size());
+      sym.hash = hashes ? hashes[id] : hash_name(sym.string.data(), sym.string.size());
+      sym.id = id;
+#if SCOLEX_RECLAIM_SYMBOLS
+      sym.refs.store(1, std::memory_order_relaxed);
+#endif
+      ++shard_counts[&shard_for(*this, sym.hash) - shards];
+    }
+
+    // Place everything into new slot arrays, sized for each shard's share,
+    // and only publish them once no name turned out to repeat.
+    for (std::size_t index = 0; index < SHARD_COUNT; ++index) {
+      std::size_t capacity = INITIAL_CAPACITY;
+      while (capacity < (shard_counts[index] + 1) * 2) {
+        capacity *= 2;
+      }
+      shards[index].generations.emplace_back(new slots_t(capacity));
+    }
+
+    for (uint32_t id = 0; id < count; ++id) {
+      interned_sym_t const &sym = syms[id];
+      slots_t const &slots = *shard_for(*this, sym.hash).generations.back();
+      if (probe(slots, sym.hash, string_view_t(sym.string))) {
+        for (shard_t &shard : shards) {
+          shard.generations.pop_back();
+        }
+        throw std::runtime_error("Cannot preload symbol '" + sym.string + "' twice");
+      }
+      place(slots, &sym);
+    }
+
+    for (uint32_t id = 0; id < count; ++id) {
+      publish_id(&syms[id]);
+    }
+    for (std::size_t index = 0; index < SHARD_COUNT; ++index) {
+      shard_t &shard = shards[index];
+      shard.count = shard_counts[index];
+      shard.current.store(shard.generations.back().get(), std::memory_order_release);
+    }
+    preloaded = std::move(syms);
+    next_id.store(count, std::memory_order_release);
+  }
+
+#if SCOLEX_RECLAIM_SYMBOLS
+
+  // Must be called with chunks_lock held.
+  sym_ptr_t claim_id(uint32_t id)
+  {
+    sym_ptr_t const sym = id < next_id.load(std::memory_order_relaxed) ? find_id(id) : nullptr;
+    if (sym) {
+      retain(sym);
+    }
+    return sym;
+  }
+
+  std::size_t collect()
+  {
+    std::size_t freed = 0;
+    for (shard_t &shard : shards) {
+      std::lock_guard<std::mutex> guard { shard.lock };
+      std::lock_guard<std::mutex> ids_guard { chunks_lock };
+
+      // Nothing can retain a symbol with no references while both locks are
+      // held, so marking one dead here is final.
+      std::size_t dead = 0;
+      for (std::unique_ptr<interned_sym_t> const &sym : shard.symbols) {
+        uint32_t unused = 0;
+        if (sym->refs.compare_exchange_strong(unused, DEAD, std::memory_order_acquire)) {
+          clear_id(sym->id);
+          free_ids.push_back(sym->id);
+          ++dead;
+        }
+      }
+      if (dead == 0) {
+        continue;
+      }
+
+      shard.count -= dead;
+      std::size_t capacity = INITIAL_CAPACITY;
+      while (shard.count * 2 > capacity) {
+        capacity *= 2;
+      }
+      std::unique_ptr<slots_t> next { new slots_t(capacity) };
+      slots_t const &old_slots = *shard.generations.back();
+      for (std::size_t index = 0; index < old_slots.capacity(); ++index) {
+        sym_ptr_t const sym = old_slots.slots[index].load(std::memory_order_relaxed);
+        if (sym && sym->refs.load(std::memory_order_relaxed) != DEAD) {
+          place(*next, sym);
+        }
+      }
+
+      // No reader probes without the lock, so old slot arrays can go too.
+      shard.generations.clear();
+      shard.generations.push_back(std::move(next));
+      shard.current.store(shard.generations.back().get(), std::memory_order_release);
+
+      shard.symbols.erase(
+        std::remove_if(shard.symbols.begin(), shard.symbols.end(),
+          [](std::unique_ptr<interned_sym_t> const &sym) {
+            return sym->refs.load(std::memory_order_relaxed) == DEAD;
+          }),
+        shard.symbols.end());
+      freed += dead;
+    }
+    return freed;
+  }
+
+#endif
+};
+
+
+auto symbol_t::table() -> table_t &
+{
+  static table_t interned_symbols;
+  return interned_symbols;
+}
+
+
+auto symbol_t::interned_sym(string_view_t name) -> interned_sym_t const *
+{
+  return table().intern(name, nullptr);
+}
+
+
+auto symbol_t::interned_sym(string_t &&string) -> interned_sym_t const *
+{
+  return table().intern(string_view_t(string), &string);
+}
+
+
+std::vector<symbol_t> symbol_t::intern_all(string_view_t const *names, std::size_t count)
+{
+  std::vector<interned_sym_t const *> syms(count);
+  table().intern_all(names, count, syms.data());
+
+  std::vector<symbol_t> symbols;
+  symbols.reserve(count);
+  for (interned_sym_t const *sym : syms) {
+    symbols.push_back(symbol_t(sym));
+  }
+  return symbols;
+}
+
+
+bool symbol_t::find(string_view_t name, symbol_t &out)
+{
+  interned_sym_t const *const sym = table().find(name);
+  if (sym) {
+    out = symbol_t(sym);
+  }
+  return sym != nullptr;
+}
+
+
+// Hashes 8 bytes at a time, so that short names -- most of them -- take one
+// or two multiplies, and then mixes the result so its top bits (which pick a
+// shard) are as good as its low bits (which pick a slot).
+hash_t symbol_t::hash_name(char const *chars, std::size_t size)
+{
+  uint64_t const MULTIPLIER = 0x9fb21c651e98df25ull;
+  uint64_t hash = 0x9e3779b97f4a7c15ull ^ (uint64_t(size) * MULTIPLIER);
+
+  for (; size >= 8; chars += 8, size -= 8) {
+    uint64_t word;
+    std::memcpy(&word, chars, 8);
+    hash = (hash ^ word) * MULTIPLIER;
+    hash ^= hash >> 29;
+  }
+  if (size > 0) {
+    uint64_t word = 0;
+    std::memcpy(&word, chars, size);
+    hash = (hash ^ word) * MULTIPLIER;
+    hash ^= hash >> 29;
+  }
+
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash_t(hash);
+}
+
+
+auto symbol_t::by_id(uint32_t id) -> interned_sym_t const *
+{
+  return table().find_id(id);
+}
+
+
+void symbol_t::preload(string_view_t const *names, hash_t const *hashes, uint32_t count)
+{
+  table().preload(names, hashes, count);
+}
+
+
+uint32_t symbol_t::count()
+{
+  return table().next_id.load(std::memory_order_acquire);
+}
+
+
+std::size_t symbol_t::collect()
+{
+#if SCOLEX_RECLAIM_SYMBOLS
+  return table().collect();
+#else
+  return 0;
+#endif
+}
+
+
+symbol_t symbol_t::from_id(uint32_t id)
+{
+#if SCOLEX_RECLAIM_SYMBOLS
+  table_t &symbols = table();
+  std::unique_lock<std::mutex> guard { symbols.chunks_lock };
+  interned_sym_t const *const sym = symbols.claim_id(id);
+  guard.unlock();
+#else
+  interned_sym_t const *const sym = id < count() ? by_id(id) : nullptr;
+#endif
+  if (!sym) {
+    throw std::out_of_range("No symbol with id " + std::to_string(id));
+  }
+  return symbol_t(sym);
+}
+
+
+#if SCOLEX_COMPACT_SYMBOLS
+
+
+symbol_t::symbol_t(interned_sym_t const *sym)
+: id_(sym->id)
+{
+  /* nop */
+}
+
+
+#else
+
+
+symbol_t::symbol_t(interned_sym_t const *sym)
+: sym_(sym)
+{
+  /* nop */
+}
+
+
+#endif
+
+
+symbol_t::symbol_t(const string_t &v)
+: symbol_t(interned_sym(string_view_t(v)))
+{
+  /* nop */
+}
+
+
+symbol_t::symbol_t(string_view_t name)
+: symbol_t(interned_sym(name))
+{
+  /* nop */
+}
+
+
+symbol_t::symbol_t(char const *name)
+: symbol_t(interned_sym(string_view_t(name)))
+{
+  /* nop */
+}
+
+
+symbol_t::symbol_t(char const *chars, std::size_t size)
+: symbol_t(interned_sym(string_view_t(chars, size)))
+{
+  /* nop */
+}
+
+
+symbol_t::symbol_t(string_t &&v)
+: symbol_t(interned_sym(std::forward<string_t>(v)))
+{
+  /* nop */
+}
+
+
+std::ostream &operator << (std::ostream &out, symbol_t const &in)
+{
+  return out << in.value() << ':' << in.hash();
+}
+
+
+// sexpr body reference counts
+
+namespace
+{
+
+
+void add_ref(std::atomic<uint32_t> &refs)
+{
+#if SCOLEX_THREADSAFE_REFCOUNTS
+  refs.fetch_add(1, std::memory_order_relaxed);
+#else
+  refs.store(refs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+#endif
+}
+
+
+// Returns true if that was the last reference.
+bool drop_ref(std::atomic<uint32_t> &refs)
+{
+#if SCOLEX_THREADSAFE_REFCOUNTS
+  return refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+#else
+  uint32_t const left = refs.load(std::memory_order_relaxed) - 1;
+  refs.store(left, std::memory_order_relaxed);
+  return left == 0;
+#endif
+}
+
+
+} // namespace
+
+
+// sexpr list bodies
+
+// Offset of a list body's items from the start of the body.
+std::size_t sexpr_t::list_body_t::items_offset()
+{
+  return (sizeof(list_body_t) + alignof(sexpr_t) - 1) & ~(alignof(sexpr_t) - 1);
+}
+
+
+sexpr_t *sexpr_t::list_body_t::items()
+{
+  return reinterpret_cast<sexpr_t *>(reinterpret_cast<char *>(this) + items_offset());
+}
+
+
+sexpr_t const *sexpr_t::list_body_t::items() const
+{
+  return reinterpret_cast<sexpr_t const *>(reinterpret_cast<char const *>(this) + items_offset());
+}
+
+
+auto sexpr_t::list_body_t::allocate(std::size_t count, sexpr_document_t *document) -> list_body_t *
+{
+  if (count > UINT32_MAX) {
+    throw std::runtime_error("List too long for a sexpr");
+  }
+
+  std::size_t const bytes = items_offset() + count * sizeof(sexpr_t);
+  void *memory = document ? document->allocate(bytes) : ::operator new (bytes);
+
+  list_body_t *body = new (memory) list_body_t;
+  body->refs.store(1, std::memory_order_relaxed);
+  body->size = 0;
+  body->flags = document ? uint32_t(ARENA) : 0;
+  body->hash = 0;
+  return body;
+}
+
+
+auto sexpr_t::list_body_t::copy(sexpr_t const *begin, sexpr_t const *end, sexpr_document_t *document) -> list_body_t *
+{
+  list_body_t *body = allocate(std::size_t(end - begin), document);
+  sexpr_t *item = body->items();
+
+  try {
+    for (; begin != end; ++begin, ++item, ++body->size) {
+      new (item) sexpr_t(*begin);
+      if (document) {
+        document->adopt(item);
+      }
+    }
+  } catch (...) {
+    release(body);
+    throw;
+  }
+
+  return body;
+}
+
+
+auto sexpr_t::list_body_t::move(sexpr_t *begin, sexpr_t *end, sexpr_document_t *document) -> list_body_t *
+{
+  list_body_t *body = allocate(std::size_t(end - begin), document);
+  sexpr_t *item = body->items();
+
+  try {
+    for (; begin != end; ++begin, ++item, ++body->size) {
+      new (item) sexpr_t(std::move(*begin));
+      if (document) {
+        document->adopt(item);
+      }
+    }
+  } catch (...) {
+    release(body);
+    throw;
+  }
+
+  return body;
+}
+
+
+void sexpr_t::list_body_t::retain(list_body_t *body)
+{
+  if (!(body->flags & ARENA)) {
+    add_ref(body->refs);
+  }
+}
+
+
+// Frees bodies whose last reference is released without recursing: items
+// holding the last reference to another body hand it to an explicit stack
+// instead of releasing it themselves, so tearing down a tree of any depth
+// uses bounded native stack.
+void sexpr_t::list_body_t::release(list_body_t *body)
+{
+  if ((body->flags & ARENA) || !drop_ref(body->refs)) {
+    return;
+  }
+
+  walk_stack_t<list_body_t *> dead;
+  dead.push(body);
+
+  while (!dead.empty()) {
+    body = dead.top();
+    dead.pop();
+
+    sexpr_t *items = body->items();
+    for (uint32_t index = body->size; index > 0; --index) {
+      sexpr_t &item = items[index - 1];
+      if (item.type_ == LIST) {
+        list_body_t *const child = item.list_;
+        if (!(child->flags & ARENA) && drop_ref(child->refs)) {
+          dead.push(child);
+        }
+        // The item's reference is gone, so there's nothing left to destroy.
+        item.type_ = NIL;
+      } else {
+        item.~sexpr_t();
+      }
+    }
+
+    body->~list_body_t();
+    ::operator delete (body);
+  }
+}
 
-#include <stdexcept>
 
+// sexpr string bodies
 
-namespace scolex
+std::size_t sexpr_t::string_body_t::chars_offset()
 {
+  return sizeof(string_body_t);
+}
 
 
-// symbol implementation
+char *sexpr_t::string_body_t::chars()
+{
+  return reinterpret_cast<char *>(this) + chars_offset();
+}
 
-std::hash<string_t> symbol_t::hash_fn;
-std::unordered_map<hash_t, std::unique_ptr<symbol_t::interned_sym_t>, symbol_t::map_hash_fn> symbol_t::interned_symbols;
-std::mutex symbol_t::interned_symbols_lock;
+
+char const *sexpr_t::string_body_t::chars() const
+{
+  return reinterpret_cast<char const *>(this) + chars_offset();
+}
 
 
-auto symbol_t::interned_sym(string_t const &string) -> interned_sym_t const *
+auto sexpr_t::string_body_t::make(char const *chars, std::size_t size, sexpr_document_t *document) -> string_body_t *
 {
-  std::lock_guard<std::mutex> guard { interned_symbols_lock };
+  if (size > UINT32_MAX) {
+    throw std::runtime_error("String too long for a sexpr");
+  }
+
+  std::size_t const bytes = chars_offset() + size + 1;
+  void *memory = document ? document->allocate(bytes) : ::operator new (bytes);
+
+  string_body_t *body = new (memory) string_body_t;
+  body->refs.store(document ? 0 : 1, std::memory_order_relaxed);
+  body->size = uint32_t(size);
+  body->flags = document ? uint32_t(ARENA) : 0;
+  body->hash = 0;
+  std::memcpy(body->chars(), chars, size);
+  body->chars()[size] = '\0';
+  return body;
+}
 
-  hash_t hash = hash_fn(string);
-  auto sym = interned_symbols.find(hash);
-  if (sym != interned_symbols.end()) {
-    return sym->second.get();
+
+void sexpr_t::string_body_t::retain(string_body_t *body)
+{
+  if (!(body->flags & ARENA)) {
+    add_ref(body->refs);
   }
+}
+
 
-  // auto ptr = std::make_unique<interned_sym_t>(hash, string);
-  std::unique_ptr<interned_sym_t> ptr { new interned_sym_t { hash, string } };
-  if (!ptr) {
-    throw std::runtime_error("Unable to allocate interned symbol data");
+void sexpr_t::string_body_t::release(string_body_t *body)
+{
+  if (!(body->flags & ARENA) && drop_ref(body->refs)) {
+    body->~string_body_t();
+    ::operator delete (body);
   }
+}
+
+
+// sexpr hashing
+
+namespace
+{
+
+
+uint32_t const NIL_HASH = 0x5eb0b1d5u;
+uint32_t const TRUE_HASH = 0x2f7f1d35u;
+uint32_t const FALSE_HASH = 0x6a09e667u;
+uint32_t const LIST_SEED = 0x9e3779b9u;
+// Keeps integers from hashing the same as the doubles sharing their bits.
+uint64_t const INTEGER_SEED = 0xbb67ae8584caa73bull;
 
-  auto result = interned_symbols.emplace(hash, std::move(ptr));
-  return result.first->second.get();
+
+uint32_t fold_hash(uint64_t value)
+{
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccdull;
+  value ^= value >> 33;
+  return uint32_t(value);
 }
 
 
-auto symbol_t::interned_sym(string_t &&string) -> interned_sym_t const *
+uint32_t combine_hash(uint32_t seed, uint32_t value)
 {
-  std::lock_guard<std::mutex> guard { interned_symbols_lock };
+  return seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
 
-  hash_t hash = hash_fn(string);
-  auto sym = interned_symbols.find(hash);
-  if (sym != interned_symbols.end()) {
-    return sym->second.get();
-  }
 
-  // auto ptr = std::make_unique<interned_sym_t>(hash, std::forward<string_t>(string));
-  std::unique_ptr<interned_sym_t> ptr { new interned_sym_t { hash, std::forward<string_t>(string) } };
-  if (!ptr) {
-    throw std::runtime_error("Unable to allocate interned symbol data");
+uint32_t hash_number(double num)
+{
+  // 0 and -0 compare equal, so they have to hash equally too.
+  if (num == 0) {
+    num = 0;
   }
+  uint64_t bits;
+  std::memcpy(&bits, &num, sizeof(bits));
+  return fold_hash(bits);
+}
+
 
-  auto result = interned_symbols.emplace(hash, std::move(ptr));
-  return result.first->second.get();
+} // namespace
+
+
+uint32_t sexpr_t::hash_chars(char const *chars, std::size_t size)
+{
+  // FNV-1a
+  uint32_t hash = 0x811c9dc5u;
+  for (std::size_t index = 0; index < size; ++index) {
+    hash = (hash ^ uint8_t(chars[index])) * 0x01000193u;
+  }
+  return hash;
 }
 
 
-symbol_t::symbol_t(const string_t &v)
-: sym_(interned_sym(v))
+// Hashes nested lists in postorder with an explicit stack, each frame holding
+// the hash of a list's items so far. Consed lists have their hash cached and
+// aren't descended into.
+uint32_t sexpr_t::hash_items(sexpr_t const *begin, sexpr_t const *end)
 {
-  /* nop */
+  struct frame_t
+  {
+    sexpr_t const *cur;
+    sexpr_t const *end;
+    uint32_t hash;
+  };
+
+  walk_stack_t<frame_t> stack;
+  stack.push(frame_t { begin, end, combine_hash(LIST_SEED, uint32_t(end - begin)) });
+
+  for (;;) {
+    frame_t &frame = stack.top();
+    if (frame.cur == frame.end) {
+      uint32_t const hash = frame.hash;
+      stack.pop();
+      if (stack.empty()) {
+        return hash;
+      }
+      stack.top().hash = combine_hash(stack.top().hash, hash);
+      continue;
+    }
+
+    sexpr_t const &item = *frame.cur++;
+    if (item.type_ == LIST && !item.consed_by()) {
+      stack.push(frame_t { item.begin(), item.end(), combine_hash(LIST_SEED, uint32_t(item.size())) });
+    } else {
+      frame.hash = combine_hash(frame.hash, uint32_t(item.hash()));
+    }
+  }
 }
 
 
-symbol_t::symbol_t(string_t &&v)
-: sym_(interned_sym(std::forward<string_t>(v)))
+uint32_t sexpr_t::consed_by() const
 {
-  /* nop */
+  switch (type_) {
+  case STRING:
+    return (string_->flags & string_body_t::CONSED) ? string_->refs.load(std::memory_order_relaxed) : 0;
+  case LIST:
+    if (offset_ == 0 && (list_->flags & list_body_t::CONSED)) {
+      return list_->refs.load(std::memory_order_relaxed);
+    }
+    return 0;
+  default:
+    return 0;
+  }
 }
 
 
-std::ostream &operator << (std::ostream &out, symbol_t const &in)
+hash_t sexpr_t::hash() const
 {
-  return out << in.value() << ':' << in.hash();
+  switch (type_) {
+  case NIL: return NIL_HASH;
+  case BOOLEAN: return bool_ ? TRUE_HASH : FALSE_HASH;
+  case NUMBER: return hash_number(number_);
+  case INTEGER: return fold_hash(uint64_t(integer_) ^ INTEGER_SEED);
+  case SYMBOL: return fold_hash(symbol_ptr()->hash());
+  case STRING:
+    if (string_->flags & string_body_t::CONSED) {
+      return string_->hash;
+    }
+    return hash_chars(string_->chars(), string_->size);
+  case LIST:
+    if (consed_by()) {
+      return list_->hash;
+    }
+    return hash_items(begin(), end());
+  }
+  return 0;
 }
 
 
@@ -98,18 +1171,27 @@ sexpr_t::sexpr_t(sexpr_t const &expr)
 {
   switch (type_) {
   case SYMBOL: new (symbol_ptr()) symbol_t(expr.symbol()); break;
-  case STRING: new (string_ptr()) string_t(expr.string()); break;
+  case STRING:
+    string_ = expr.string_;
+    string_body_t::retain(string_);
+    break;
   case NUMBER: number_ = expr.number_; break;
+  case INTEGER: integer_ = expr.integer_; break;
   case BOOLEAN: bool_ = expr.bool_; break;
-  case LIST: new (list_ptr()) list_t(expr.list()); break;
+  case LIST:
+    list_ = expr.list_;
+    offset_ = expr.offset_;
+    list_body_t::retain(list_);
+    break;
   case NIL: return;
   }
 }
 
 
-sexpr_t::sexpr_t(sexpr_t &&expr)
+sexpr_t::sexpr_t(sexpr_t &&expr) noexcept
+: type_(NIL)
 {
-  *this = std::forward<sexpr_t>(expr);
+  take(expr);
 }
 
 
@@ -118,14 +1200,8 @@ sexpr_t::sexpr_t(std::initializer_list<sexpr_t> expr_list)
 : type_(expr_list.size() > 0 ? LIST : NIL)
 {
   if (type_ == LIST) {
-    new (list_ptr()) list_t();
-    list_ptr()->reserve(expr_list.size());
-    auto expr = std::begin(expr_list);
-    auto sentinel = std::end(expr_list);
-    while (expr != sentinel) {
-      list_ptr()->push_back(*expr);
-      ++expr;
-    }
+    list_ = list_body_t::copy(std::begin(expr_list), std::end(expr_list), nullptr);
+    offset_ = 0;
   }
 }
 
@@ -135,7 +1211,8 @@ sexpr_t::sexpr_t(list_t const &expr_list)
 : type_(expr_list.size() > 0 ? LIST : NIL)
 {
   if (type_ == LIST) {
-    new (&data_) list_t(expr_list);
+    list_ = list_body_t::copy(expr_list.data(), expr_list.data() + expr_list.size(), nullptr);
+    offset_ = 0;
   }
 }
 
@@ -145,7 +1222,8 @@ sexpr_t::sexpr_t(list_t &&expr_list)
 : type_(expr_list.size() > 0 ? LIST : NIL)
 {
   if (type_ == LIST) {
-    new (list_ptr()) list_t(std::move(expr_list));
+    list_ = list_body_t::move(expr_list.data(), expr_list.data() + expr_list.size(), nullptr);
+    offset_ = 0;
   }
 }
 
@@ -155,7 +1233,8 @@ sexpr_t::sexpr_t(sexpr_t const *begin, sexpr_t const *end)
 : type_(begin != end ? LIST : NIL)
 {
   if (type_ == LIST) {
-    new (list_ptr()) list_t(begin, end);
+    list_ = list_body_t::copy(begin, end, nullptr);
+    offset_ = 0;
   }
 }
 
@@ -163,32 +1242,48 @@ sexpr_t::sexpr_t(sexpr_t const *begin, sexpr_t const *end)
 /* string (cstr) */
 sexpr_t::sexpr_t(char const *sym_cstr)
 : type_(STRING)
+, string_(string_body_t::make(sym_cstr, std::strlen(sym_cstr), nullptr))
 {
-  new (string_ptr()) string_t(sym_cstr);
 }
 
 
 /* string (char list) */
 sexpr_t::sexpr_t(std::initializer_list<char> sym_cl)
 : type_(STRING)
+, string_(string_body_t::make(sym_cl.begin(), sym_cl.size(), nullptr))
 {
-  new (string_ptr()) string_t(std::forward<std::initializer_list<char>>(sym_cl));
 }
 
 
 /* string (copy) */
 sexpr_t::sexpr_t(string_t const &sym)
 : type_(STRING)
+, string_(string_body_t::make(sym.data(), sym.size(), nullptr))
 {
-  new (string_ptr()) string_t(sym);
 }
 
 
-/* string (move) */
+/* string (copy) */
 sexpr_t::sexpr_t(string_t &&sym)
 : type_(STRING)
+, string_(string_body_t::make(sym.data(), sym.size(), nullptr))
+{
+}
+
+
+/* string (copy view) */
+sexpr_t::sexpr_t(string_view_t sym)
+: type_(STRING)
+, string_(string_body_t::make(sym.data(), sym.size(), nullptr))
+{
+}
+
+
+/* string (owned body) */
+sexpr_t::sexpr_t(string_body_t *body)
+: type_(STRING)
+, string_(body)
 {
-  new (string_ptr()) string_t(std::move(sym));
 }
 
 
@@ -216,13 +1311,46 @@ sexpr_t::sexpr_t(bool val)
 }
 
 
-void sexpr_t::dispose()
+/* list (shared tail) */
+sexpr_t::sexpr_t(list_body_t *body, uint32_t offset)
+: type_(LIST)
+, offset_(offset)
+, list_(body)
+{
+  list_body_t::retain(body);
+}
+
+
+void sexpr_t::take(sexpr_t &expr) noexcept
+{
+  switch (type_ = expr.type_) {
+  case STRING: string_ = expr.string_; break;
+  case SYMBOL:
+    new (symbol_ptr()) symbol_t(std::move(*expr.symbol_ptr()));
+    expr.symbol_ptr()->~symbol_t();
+    break;
+  case LIST:
+    list_ = expr.list_;
+    offset_ = expr.offset_;
+    break;
+  case NUMBER: number_ = expr.number_; break;
+  case INTEGER: integer_ = expr.integer_; break;
+  case BOOLEAN: bool_ = expr.bool_; break;
+  case NIL: return;
+  }
+  // expr no longer owns a string or list body, so there's nothing to release.
+  expr.type_ = NIL;
+}
+
+
+void sexpr_t::dispose() noexcept
 {
   switch (type_) {
-  case STRING: string_ptr()->~string_t(); break;
+  case STRING: string_body_t::release(string_); break;
   case SYMBOL: symbol_ptr()->~symbol_t(); break;
-  case LIST: list_ptr()->~list_t(); break;
+  case LIST: list_body_t::release(list_); break;
   case NUMBER: break;
+  case INTEGER: break;
   case BOOLEAN: break;
   case NIL: return;
   }
@@ -236,91 +1364,41 @@ sexpr_t::~sexpr_t()
 }
 
 
-sexpr_t &sexpr_t::operator = (sexpr_t &&expr)
+// Both assignments take hold of expr before releasing the old value, since
+// expr may live inside the body the old value releases, as in
+// x = x.item(1).
+sexpr_t &sexpr_t::operator = (sexpr_t &&expr) noexcept
 {
-  if (&expr == this) {
-    return *this;
-  }
-
-  dispose();
-  std::swap(type_, expr.type_);
-  switch (type_) {
-  case STRING:
-    new (string_ptr()) string_t(std::move(*expr.string_ptr()));
-    break;
-  case SYMBOL:
-    new (symbol_ptr()) symbol_t(expr.symbol());
-    break;
-  case LIST:
-    new (list_ptr()) list_t(std::move(*expr.list_ptr()));
-    break;
-  case NUMBER: number_ = expr.number_; break;
-  case BOOLEAN: bool_ = expr.bool_; break;
-  case NIL: break;
+  if (&expr != this) {
+    sexpr_t taken(std::move(expr));
+    dispose();
+    take(taken);
   }
-
-  expr.dispose();
-
   return *this;
 }
 
 
 sexpr_t &sexpr_t::operator = (sexpr_t const &expr)
 {
-  if (&expr == this) {
-    return *this;
-  }
-
-  dispose();
-  switch (type_ = expr.type_) {
-  case STRING:
-    new (string_ptr()) string_t(expr.string());
-    break;
-  case SYMBOL:
-    new (symbol_ptr()) symbol_t(expr.symbol());
-    break;
-  case LIST:
-    new (list_ptr()) list_t(expr.list());
-    break;
-  case NUMBER: number_ = expr.number_; break;
-  case BOOLEAN: bool_ = expr.bool_; break;
-  case NIL: break;
+  if (&expr != this) {
+    sexpr_t copy(expr);
+    dispose();
+    take(copy);
   }
-
   return *this;
 }
 
 
-auto sexpr_t::string_ptr() -> string_t * {
-  return (string_t *)&data_;
-}
-
-
 auto sexpr_t::symbol_ptr() -> symbol_t * {
   return (symbol_t *)&data_;
 }
 
 
-auto sexpr_t::list_ptr() -> list_t * {
-  return (list_t *)&data_;
-}
-
-
-auto sexpr_t::string_ptr() const -> string_t const * {
-  return (string_t *)&data_;
-}
-
-
 auto sexpr_t::symbol_ptr() const -> symbol_t const * {
   return (symbol_t *)&data_;
 }
 
 
-auto sexpr_t::list_ptr() const -> list_t const * {
-  return (list_t *)&data_;
-}
-
-
 auto sexpr_t::type() const -> type_t
 {
   return type_;
@@ -338,13 +1416,24 @@ bool sexpr_t::boolean() const
 
 double sexpr_t::number() const
 {
-  if (type_ != NUMBER) {
+  if (type_ == INTEGER) {
+    return double(integer_);
+  } else if (type_ != NUMBER) {
     throw std::runtime_error("Invalid sexpr type - not a number");
   }
   return number_;
 }
 
 
+int64_t sexpr_t::integer() const
+{
+  if (type_ != INTEGER) {
+    throw std::runtime_error("Invalid sexpr type - not an integer");
+  }
+  return integer_;
+}
+
+
 auto sexpr_t::symbol() const -> symbol_t const &
 {
   if (type_ != SYMBOL) {
@@ -354,21 +1443,21 @@ auto sexpr_t::symbol() const -> symbol_t const &
 }
 
 
-auto sexpr_t::string() const -> string_t const &
+auto sexpr_t::string() const -> string_view_t
 {
   if (type_ != STRING) {
     throw std::runtime_error("Invalid sexpr type - not a string");
   }
-  return *string_ptr();
+  return string_view_t { string_->chars(), string_->size };
 }
 
 
-auto sexpr_t::list() const -> list_t const &
+auto sexpr_t::list() const -> list_view_t
 {
   if (type_ != LIST) {
     throw std::runtime_error("Invalid sexpr type - not a list");
   }
-  return *list_ptr();
+  return list_view_t { begin(), end() };
 }
 
 
@@ -378,10 +1467,160 @@ sexpr_t const &sexpr_t::item(int index) const
     throw std::runtime_error("Invalid sexpr type - not a list");
   } else if (index < 0) {
     throw std::runtime_error("Index less than 0 out of bounds");
-  } else if (size_t(index) > list_ptr()->size()) {
+  } else if (index >= size()) {
+    throw std::runtime_error("Index greater than length of list out of bounds");
+  }
+  return list_->items()[offset_ + size_t(index)];
+}
+
+
+auto sexpr_t::try_boolean() const -> optional<bool>
+{
+  if (type_ != BOOLEAN) {
+    return none;
+  }
+  return some(bool_);
+}
+
+
+auto sexpr_t::try_number() const -> optional<double>
+{
+  if (type_ == INTEGER) {
+    return some(double(integer_));
+  } else if (type_ != NUMBER) {
+    return none;
+  }
+  return some(number_);
+}
+
+
+auto sexpr_t::try_integer() const -> optional<int64_t>
+{
+  if (type_ != INTEGER) {
+    return none;
+  }
+  return some(integer_);
+}
+
+
+auto sexpr_t::try_symbol() const -> symbol_t const *
+{
+  return type_ == SYMBOL ? symbol_ptr() : nullptr;
+}
+
+
+auto sexpr_t::try_string() const -> optional<string_view_t>
+{
+  if (type_ != STRING) {
+    return none;
+  }
+  return some(string_view_t { string_->chars(), string_->size });
+}
+
+
+auto sexpr_t::try_list() const -> optional<list_view_t>
+{
+  if (type_ != LIST) {
+    return none;
+  }
+  return some(list_view_t { begin(), end() });
+}
+
+
+sexpr_t const *sexpr_t::try_item(int index) const
+{
+  if (type_ != LIST || index < 0 || index >= size()) {
+    return nullptr;
+  }
+  return list_->items() + offset_ + size_t(index);
+}
+
+
+void sexpr_t::set_item(int index, sexpr_t value)
+{
+  item(index); // Throws if this isn't a list or index is out of bounds.
+  unshare();
+  list_->items()[offset_ + size_t(index)] = std::move(value);
+}
+
+
+void sexpr_t::insert_item(int index, sexpr_t value)
+{
+  if (type_ != LIST && type_ != NIL) {
+    throw std::runtime_error("Invalid sexpr type - not a list");
+  } else if (index < 0) {
+    throw std::runtime_error("Index less than 0 out of bounds");
+  } else if (index > size()) {
     throw std::runtime_error("Index greater than length of list out of bounds");
   }
-  return (*list_ptr())[size_t(index)];
+  splice(index, 0, &value);
+}
+
+
+void sexpr_t::erase_item(int index)
+{
+  item(index); // Throws if this isn't a list or index is out of bounds.
+  splice(index, 1, nullptr);
+}
+
+
+sexpr_t sexpr_t::take_item(int index)
+{
+  unshare();
+  return std::move(list_->items()[offset_ + size_t(index)]);
+}
+
+
+void sexpr_t::splice(int index, int erase_count, sexpr_t *inserted)
+{
+  sexpr_t *const items = type_ == LIST ? list_->items() + offset_ : nullptr;
+  int const count = size();
+  int const new_count = count - erase_count + (inserted ? 1 : 0);
+  if (new_count == 0) {
+    dispose();
+    return;
+  }
+
+  // Copying a sexpr never allocates or throws, so neither does filling the
+  // new body once it's allocated.
+  bool const owned = items && !(list_->flags & list_body_t::ARENA) &&
+    list_->refs.load(std::memory_order_acquire) == 1;
+  list_body_t *const body = list_body_t::allocate(std::size_t(new_count), nullptr);
+  sexpr_t *next = body->items();
+  auto const keep_items = [&](int from, int to) {
+    for (int source = from; source < to; ++source, ++next) {
+      if (owned) {
+        new (next) sexpr_t(std::move(items[source]));
+      } else {
+        new (next) sexpr_t(items[source]);
+      }
+    }
+  };
+
+  keep_items(0, index);
+  if (inserted) {
+    new (next++) sexpr_t(std::move(*inserted));
+  }
+  keep_items(index + erase_count, count);
+  body->size = uint32_t(new_count);
+
+  dispose();
+  type_ = LIST;
+  list_ = body;
+  offset_ = 0;
+}
+
+
+void sexpr_t::unshare()
+{
+  if (!(list_->flags & list_body_t::ARENA) && list_->refs.load(std::memory_order_acquire) == 1) {
+    return;
+  }
+
+  list_body_t *const body = list_body_t::copy(begin(), end(), nullptr);
+  list_body_t::release(list_);
+  list_ = body;
+  offset_ = 0;
 }
 
 
@@ -391,8 +1630,9 @@ int sexpr_t::size() const
   case BOOLEAN: Q_FALLTHROUGH();
   case SYMBOL: Q_FALLTHROUGH();
   case STRING: Q_FALLTHROUGH();
-  case NUMBER: return 1;
-  case LIST: return int(list_ptr()->size());
+  case NUMBER: Q_FALLTHROUGH();
+  case INTEGER: return 1;
+  case LIST: return int(list_->size - offset_);
   case NIL: return 0;
   }
 }
@@ -401,10 +1641,11 @@ int sexpr_t::size() const
 sexpr_t const *sexpr_t::begin() const
 {
   switch (type_) {
-  case LIST: return &(list()[0]);
+  case LIST: return list_->items() + offset_;
   case SYMBOL: Q_FALLTHROUGH();
   case STRING: Q_FALLTHROUGH();
   case NUMBER: Q_FALLTHROUGH();
+  case INTEGER: Q_FALLTHROUGH();
   case BOOLEAN: Q_FALLTHROUGH();
   case NIL: return this;
   }
@@ -414,11 +1655,12 @@ sexpr_t const *sexpr_t::begin() const
 sexpr_t const *sexpr_t::end() const
 {
   switch (type_) {
-  case LIST: return (&(list()[size() - 1])) + 1;
+  case LIST: return list_->items() + list_->size;
   case SYMBOL: Q_FALLTHROUGH();
   case STRING: Q_FALLTHROUGH();
   case BOOLEAN: Q_FALLTHROUGH();
-  case NUMBER: return this + 1;
+  case NUMBER: Q_FALLTHROUGH();
+  case INTEGER: return this + 1;
   case NIL: return this;
   }
 }
@@ -430,42 +1672,109 @@ bool sexpr_t::operator != (const sexpr_t &other) const
 }
 
 
-bool sexpr_t::operator == (const sexpr_t &other) const
+// Compares this and other without looking inside lists, except to check
+// their sizes. Lists that can't be told apart that way are left to the
+// caller to DESCEND into.
+auto sexpr_t::match(sexpr_t const &other) const -> match_t
 {
   if (type_ != other.type_) {
-    return false;
+    return MISMATCH;
   }
 
   switch (type_) {
-  case NIL: return true;
-  case BOOLEAN: return boolean() == other.boolean();
-  case SYMBOL: return symbol() == other.symbol();
-  case STRING: return string() == other.string();
-  case NUMBER: return number() == other.number();
+  case NIL: return MATCH;
+  case BOOLEAN: return bool_ == other.bool_ ? MATCH : MISMATCH;
+  case SYMBOL: return *symbol_ptr() == *other.symbol_ptr() ? MATCH : MISMATCH;
+  case NUMBER: return number_ == other.number_ ? MATCH : MISMATCH;
+  case INTEGER: return integer_ == other.integer_ ? MATCH : MISMATCH;
+  case STRING:
   case LIST:
-    for (int index = 0; index < size(); ++index) {
-      if (item(index) != other.item(index)) {
-        return false;
-      }
+    break;
+  }
+
+  if (type_ == STRING ? string_ == other.string_ : (list_ == other.list_ && offset_ == other.offset_)) {
+    return MATCH;
+  }
+
+  // A document never conses two equal bodies, so distinct bodies consed by
+  // the same document are unequal. Bodies with different hashes are too.
+  uint32_t const owner = consed_by();
+  uint32_t const other_owner = other.consed_by();
+  if (owner && other_owner) {
+    if (owner == other_owner) {
+      return MISMATCH;
+    }
+    uint32_t const hash = type_ == STRING ? string_->hash : list_->hash;
+    uint32_t const other_hash = type_ == STRING ? other.string_->hash : other.list_->hash;
+    if (hash != other_hash) {
+      return MISMATCH;
     }
-    return true;
   }
-  return false;
+
+  if (type_ == STRING) {
+    return string() == other.string() ? MATCH : MISMATCH;
+  }
+  return size() == other.size() ? DESCEND : MISMATCH;
 }
 
 
-std::ostream &operator << (std::ostream &out, sexpr_t const &in)
+bool sexpr_t::operator == (const sexpr_t &other) const
+{
+  match_t const result = match(other);
+  if (result != DESCEND) {
+    return result == MATCH;
+  }
+
+  // Walks both lists in step. Each frame holds the remaining items of a list
+  // from each side; the lists are known to be the same size.
+  struct frame_t
+  {
+    sexpr_t const *cur;
+    sexpr_t const *end;
+    sexpr_t const *other;
+  };
+
+  walk_stack_t<frame_t> stack;
+  stack.push(frame_t { begin(), end(), other.begin() });
+
+  while (!stack.empty()) {
+    frame_t &frame = stack.top();
+    if (frame.cur == frame.end) {
+      stack.pop();
+      continue;
+    }
+
+    sexpr_t const &lhs = *frame.cur++;
+    sexpr_t const &rhs = *frame.other++;
+    switch (lhs.match(rhs)) {
+    case MISMATCH: return false;
+    case MATCH: break;
+    case DESCEND: stack.push(frame_t { lhs.begin(), lhs.end(), rhs.begin() }); break;
+    }
+  }
+
+  return true;
+}
+
+
+namespace
+{
+
+
+void write_atom(std::ostream &out, sexpr_t const &in)
 {
   switch (in.type()) {
   case sexpr_t::BOOLEAN:
-    if (in.boolean()) {
-      return out << "#!t";
-    } else {
-      return out << "#!f";
+    out << (in.boolean() ? "#!t" : "#!f");
+    return;
+  case sexpr_t::NUMBER: {
+      char buffer[lex::NUMBER_BUFFER_SIZE];
+      out.write(buffer, lex::format_number(buffer, sizeof(buffer), in.number()));
+      return;
     }
-  case sexpr_t::NUMBER: return out << in.number();
-  case sexpr_t::NIL: return out << "'()";
-  case sexpr_t::SYMBOL: return out << in.symbol();
+  case sexpr_t::INTEGER: out << in.integer(); return;
+  case sexpr_t::NIL: out << "'()"; return;
+  case sexpr_t::SYMBOL: out << in.symbol().value(); return;
   case sexpr_t::STRING:
     out << '"';
     for (char const c : in.string()) {
@@ -479,28 +1788,50 @@ std::ostream &operator << (std::ostream &out, sexpr_t const &in)
       case '\f': out << "\\f"; continue;
       case '\v': out << "\\v"; continue;
       case '\0': out << "\\0"; continue;
-      case '\\': case '"': out << c;
+      case '\\': case '"': out << '\\' << c; continue;
       default: out << c;
       }
     }
-    return out << '"';
-
+    out << '"';
+    return;
   case sexpr_t::LIST:
-    auto expr = std::begin(in);
-    auto sentinel = std::end(in);
+    return;
+  }
+}
+
 
-    out << '(';
+} // namespace
 
-    while (expr != sentinel) {
-      out << *expr;
-      ++expr;
-      if (expr != sentinel) {
+
+std::ostream &operator << (std::ostream &out, sexpr_t const &in)
+{
+  sexpr_walk_t walk { in };
+  bool separate = false;
+
+  while (walk.next()) {
+    switch (walk.event()) {
+    case sexpr_walk_t::ENTER:
+      if (separate) {
         out << ' ';
       }
+      out << '(';
+      separate = false;
+      break;
+    case sexpr_walk_t::LEAVE:
+      out << ')';
+      separate = true;
+      break;
+    case sexpr_walk_t::LEAF:
+      if (separate) {
+        out << ' ';
+      }
+      write_atom(out, walk.node());
+      separate = true;
+      break;
     }
-
-    return out << ')';
   }
+
+  return out;
 }
 
 
@@ -7,13 +7,14 @@
 #define __SCOLEX_SEXPR_HH__
 
 #include "scolex_config.hh"
+#include "option.hh"
+#include "string_view.hh"
 
+#include <atomic>
 #include <functional>
 #include <iterator>
 #include <memory>
-#include <mutex>
 #include <ostream>
-#include <unordered_map>
 #include <vector>
 
 
@@ -24,46 +25,199 @@ namespace scolex
 using list_t = std::vector<struct sexpr_t>;
 using hash_t = std::size_t;
 
+class sexpr_document_t;
+class sexpr_cursor_t;
+
+
+// Read-only view of the items of a list sexpr. Only valid for as long as the
+// sexpr it was taken from.
+struct list_view_t
+{
+  sexpr_t const *first;
+  sexpr_t const *last;
+
+  sexpr_t const *begin() const { return first; }
+  sexpr_t const *end() const { return last; }
+  std::size_t size() const;
+  bool empty() const { return first == last; }
+  sexpr_t const &operator [] (std::size_t index) const;
+};
+
 
 class symbol_t
 {
   struct interned_sym_t
   {
     hash_t hash;
+    uint32_t id;
     string_t string;
+#if SCOLEX_RECLAIM_SYMBOLS
+    // The number of symbol_ts referring to this symbol. Preloaded symbols
+    // hold one more, so they're never reclaimed.
+    mutable std::atomic<uint32_t> refs;
+#endif
   };
 
+  // Concurrent intern table, defined in sexpr.cc. Lookups of symbols that
+  // are already interned never take a lock unless symbols are reclaimable.
+  struct table_t;
+
+#if SCOLEX_COMPACT_SYMBOLS
+  uint32_t id_;
+
+  interned_sym_t const *sym() const { return by_id(id_); }
+#else
   interned_sym_t const *sym_;
 
-  struct map_hash_fn
-  {
-    constexpr std::size_t operator () (hash_t h) const { return h; }
-  };
+  interned_sym_t const *sym() const { return sym_; }
+#endif
 
-  static std::hash<string_t> hash_fn;
-  static std::unordered_map<hash_t, std::unique_ptr<interned_sym_t>, map_hash_fn> interned_symbols;
-  static std::mutex interned_symbols_lock;
+  static table_t &table();
 
-  static interned_sym_t const *interned_sym(string_t const &str);
+  static interned_sym_t const *interned_sym(string_view_t name);
   static interned_sym_t const *interned_sym(string_t &&str);
+  // Returns the symbol with the given id, or null if there isn't one.
+  static interned_sym_t const *by_id(uint32_t id);
+
+  // Takes over a reference to sym if symbols are reclaimable: every table
+  // function returning a symbol has already retained it for the caller.
+  explicit symbol_t(interned_sym_t const *sym);
+
+#if SCOLEX_RECLAIM_SYMBOLS
+  static void retain(interned_sym_t const *sym)
+  {
+    sym->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static void release(interned_sym_t const *sym)
+  {
+    sym->refs.fetch_sub(1, std::memory_order_release);
+  }
+#endif
+
+  // Interns names[0] through names[count - 1] with ids 0 through count - 1,
+  // taking their hashes from hashes unless it's null. Throws
+  // std::runtime_error if any symbol was interned before, or a name repeats.
+  static void preload(string_view_t const *names, hash_t const *hashes, uint32_t count);
+
+  friend void load_symbol_snapshot(char const *data, std::size_t size);
 
 public:
 
-  string_t const &value() const { return sym_->string; }
-  hash_t hash() const { return sym_->hash; }
+  string_t const &value() const { return sym()->string; }
+  hash_t hash() const { return sym()->hash; }
+
+  // Symbols are numbered from zero in the order they're interned, so ids are
+  // dense and never change: they can index flat arrays and bitsets of
+  // count() entries. If symbols are reclaimable, a reclaimed symbol's id is
+  // handed to the next new symbol, so an id only names a symbol while that
+  // symbol is referenced.
+#if SCOLEX_COMPACT_SYMBOLS
+  uint32_t id() const { return id_; }
+#else
+  uint32_t id() const { return sym_->id; }
+#endif
+
+  // The number of symbols interned so far. Every id below it belongs to a
+  // symbol, though one still being interned by another thread may not be
+  // visible to from_id() yet. Once collect() has reclaimed symbols, this is
+  // the most ids ever in use and some ids below it may be free.
+  static uint32_t count();
+  // Returns the symbol with the given id. Throws std::out_of_range if no
+  // symbol has that id.
+  static symbol_t from_id(uint32_t id);
 
   symbol_t() = delete;
   symbol_t(const string_t &v);
   symbol_t(string_t &&v);
+  // Symbols can also be interned straight from a buffer: name is only copied
+  // if it isn't interned already.
+  explicit symbol_t(string_view_t name);
+  explicit symbol_t(char const *name);
+  symbol_t(char const *chars, std::size_t size);
+
+  // Interns every name in [first, last) -- strings, string views, or
+  // anything else a string_view_t can be made from -- returning their
+  // symbols in order. Cheaper than interning them one at a time: names are
+  // hashed up front (on several threads, for large batches), and each shard
+  // of the intern table is locked once, and grown at most once, for all of
+  // the batch's new symbols.
+  template <class IT>
+  static std::vector<symbol_t> intern_all(IT first, IT last)
+  {
+    std::vector<string_view_t> names;
+    for (; first != last; ++first) {
+      names.push_back(string_view_t(*first));
+    }
+    return intern_all(names.data(), names.size());
+  }
+
+  static std::vector<symbol_t> intern_all(string_view_t const *names, std::size_t count);
+
+  // Looks up the symbol named name without interning it, and without
+  // locking or allocating. Returns true and sets out to the symbol if it's
+  // interned, otherwise returns false and leaves out alone.
+  static bool find(string_view_t name, symbol_t &out);
+
+  // The hash() of the symbol named [chars, chars + size).
+  static hash_t hash_name(char const *chars, std::size_t size);
+
+  // Frees every interned symbol that no symbol_t refers to, returning how
+  // many were freed, if SCOLEX_RECLAIM_SYMBOLS is set. Otherwise symbols live
+  // as long as the program and this returns 0. Safe to call at any time from
+  // any thread, and meant to be called periodically by programs interning
+  // names they don't control.
+  static std::size_t collect();
+
+#if SCOLEX_RECLAIM_SYMBOLS
+
+  symbol_t(const symbol_t &sym) noexcept
+#if SCOLEX_COMPACT_SYMBOLS
+  : id_(sym.id_)
+#else
+  : sym_(sym.sym_)
+#endif
+  {
+    retain(this->sym());
+  }
+
+  symbol_t &operator = (const symbol_t &sym) noexcept
+  {
+    retain(sym.sym());
+    release(this->sym());
+#if SCOLEX_COMPACT_SYMBOLS
+    id_ = sym.id_;
+#else
+    sym_ = sym.sym_;
+#endif
+    return *this;
+  }
+
+  // Moves are copies, so a moved-from symbol is still the same symbol.
+  symbol_t(symbol_t &&sym) noexcept : symbol_t(static_cast<symbol_t const &>(sym)) { /* nop */ }
+  symbol_t &operator = (symbol_t &&sym) noexcept { return *this = static_cast<symbol_t const &>(sym); }
+
+  ~symbol_t() { release(sym()); }
+
+#else
 
   symbol_t(const symbol_t &sym) = default;
   symbol_t &operator = (const symbol_t &sym) = default;
 
-  symbol_t(symbol_t &&sym) = delete;
-  symbol_t &operator = (symbol_t &&sym) = delete;
+  // Symbols are just a pointer to (or the id of) their interned data, so
+  // moves are copies.
+  symbol_t(symbol_t &&sym) noexcept = default;
+  symbol_t &operator = (symbol_t &&sym) noexcept = default;
 
+#endif
+
+#if SCOLEX_COMPACT_SYMBOLS
+  bool operator == (symbol_t const &other) const { return id_ == other.id_; }
+  bool operator != (symbol_t const &other) const { return id_ != other.id_; }
+#else
   bool operator == (symbol_t const &other) const { return sym_ == other.sym_; }
   bool operator != (symbol_t const &other) const { return sym_ != other.sym_; }
+#endif
 
   // Returns the interned copy of a symbol or the interned symbol for a string.
   // If not already interned, the string will be interned as a result.
@@ -80,12 +234,15 @@ struct sexpr_t
     BOOLEAN,
     LIST,
     NIL,
+    INTEGER,
   };
 
   sexpr_t(); // nil
 
   sexpr_t(sexpr_t const &expr);
-  sexpr_t(sexpr_t &&expr);
+  // Moves take over expr's value, leaving expr nil. They never allocate, so
+  // list_t moves its elements rather than copying them when it grows.
+  sexpr_t(sexpr_t &&expr) noexcept;
 
   /* list */
   sexpr_t(std::initializer_list<sexpr_t> expr_list); // init_list
@@ -96,7 +253,8 @@ struct sexpr_t
   /* string */
   sexpr_t(char const *sym_cstr); // cstr
   sexpr_t(string_t &&sym_cstr); // copy
-  sexpr_t(const string_t &sym_cstr); // move
+  sexpr_t(const string_t &sym_cstr); // copy
+  sexpr_t(string_view_t sym_view); // copy
   sexpr_t(std::initializer_list<char> sym_cl); // init_list
 
   /* symbol */
@@ -105,54 +263,221 @@ struct sexpr_t
   /* number */
   sexpr_t(double num);
 
+  /* integer */
+  // Integers are kept exactly as int64_ts, so sexpr_t { 1, 2, 3 } is a list
+  // of INTEGERs rather than NUMBERs. Unsigned values above INT64_MAX wrap.
+  template <
+    typename INT,
+    typename std::enable_if<std::is_integral<INT>::value && !std::is_same<INT, bool>::value, int>::type = 0
+    >
+  sexpr_t(INT num)
+  : type_(INTEGER)
+  , integer_(int64_t(num))
+  {
+    /* nop */
+  }
+
   /* boolean */
   explicit sexpr_t(bool val);
 
   ~sexpr_t();
 
-  sexpr_t &operator = (sexpr_t &&expr);
+  sexpr_t &operator = (sexpr_t &&expr) noexcept;
   sexpr_t &operator = (sexpr_t const &expr);
 
+  // Numbers and integers never compare equal, even if their values do, so
+  // 1 and 1.0 are different sexprs.
   bool operator != (sexpr_t const &other) const;
   bool operator == (sexpr_t const &other) const;
 
+  // Structural hash: sexprs that compare equal hash equally. Hash-consed
+  // lists and strings (see sexpr_document_t) return a cached hash, anything
+  // else is hashed on demand.
+  hash_t hash() const;
+
 private:
+  friend class sexpr_document_t;
+  friend class sexpr_cursor_t;
+
+  // Lists share their items through a reference-counted body. A list sexpr is
+  // the body's items starting at offset_, so cdr() only has to bump the
+  // reference count and the offset rather than copy the remaining items.
+  // Bodies are only modified, by set_item(), while a single sexpr refers to
+  // them; shared bodies are copied first.
+  //
+  // A body's items are stored inline, directly after it. Bodies allocated in
+  // a sexpr_document_t are flagged ARENA: they aren't reference counted and
+  // are only freed along with their document.
+  //
+  // Bodies hash-consed by a document are also flagged CONSED and carry their
+  // structural hash. Since arena bodies aren't counted, refs holds the id of
+  // the document that consed them instead.
+  struct list_body_t
+  {
+    enum : uint32_t { ARENA = 0x1, CONSED = 0x2 };
+
+    std::atomic<uint32_t> refs;
+    uint32_t size;
+    uint32_t flags;
+    uint32_t hash;
+
+    static std::size_t items_offset();
+    sexpr_t *items();
+    sexpr_t const *items() const;
+
+    // Allocates a body for count items from the heap or, if document is
+    // non-null, from the document. The body's items are left unconstructed
+    // and its size 0 -- the caller constructs them and sets size.
+    static list_body_t *allocate(std::size_t count, sexpr_document_t *document);
+    // Builds a body from a copy of / by moving the items in [begin, end).
+    static list_body_t *copy(sexpr_t const *begin, sexpr_t const *end, sexpr_document_t *document);
+    static list_body_t *move(sexpr_t *begin, sexpr_t *end, sexpr_document_t *document);
+
+    static void retain(list_body_t *body);
+    static void release(list_body_t *body);
+  };
+
+  // Strings are stored out of line in a body holding their chars, followed by
+  // a NUL. String bodies are never modified, so copies share them: heap
+  // bodies are reference counted like lists, while bodies allocated in a
+  // sexpr_document_t are flagged ARENA and freed with their document.
+  // Hash-consed string bodies are flagged CONSED, like lists, and record
+  // their hash and, in refs, their document.
+  struct string_body_t
+  {
+    enum : uint32_t { ARENA = 0x1, CONSED = 0x2 };
+
+    std::atomic<uint32_t> refs;
+    uint32_t size;
+    uint32_t flags;
+    uint32_t hash;
+
+    static std::size_t chars_offset();
+    char *chars();
+    char const *chars() const;
+
+    static string_body_t *make(char const *chars, std::size_t size, sexpr_document_t *document);
+    static void retain(string_body_t *body);
+    static void release(string_body_t *body);
+  };
+
+  // Every node is 16 bytes: a word of payload (the value itself for numbers,
+  // integers, booleans and symbols, otherwise a pointer to the string or list body) and
+  // a word holding the type and, for lists, the offset of the list's first
+  // item in its body.
   type_t type_;
+  uint32_t offset_;
 
   union {
     bool bool_;
     double number_;
+    int64_t integer_;
+    list_body_t *list_;
+    string_body_t *string_;
     std::aligned_union<
         sizeof(number_),
-        string_t,
-        symbol_t,
-        list_t
+        symbol_t
       >::type data_;
   };
 
-  string_t *string_ptr();
-  symbol_t *symbol_ptr();
-  list_t *list_ptr();
+  // Shares body, starting at offset. Retains the body.
+  sexpr_t(list_body_t *body, uint32_t offset);
+  // Takes ownership of body.
+  explicit sexpr_t(string_body_t *body);
 
-  string_t const *string_ptr() const;
+  symbol_t *symbol_ptr();
   symbol_t const *symbol_ptr() const;
-  list_t const *list_ptr() const ;
 
-  void dispose();
+  enum match_t : int { MISMATCH, MATCH, DESCEND };
+  match_t match(sexpr_t const &other) const;
+
+  // Returns the id of the document that hash-consed this sexpr's body, or 0
+  // if it isn't a consed list or string. Tails of consed lists aren't consed.
+  uint32_t consed_by() const;
+
+  static uint32_t hash_chars(char const *chars, std::size_t size);
+  static uint32_t hash_items(sexpr_t const *begin, sexpr_t const *end);
+
+  // Takes over expr's value, leaving expr nil. This must not hold a value.
+  void take(sexpr_t &expr) noexcept;
+  void dispose() noexcept;
+
+  // Gives this list a body of its own, copying its items out of the shared
+  // or arena body it refers to, if that's not the case already.
+  void unshare();
+  // Moves the item at index, which must be in bounds, out of this list,
+  // which is unshared first, leaving nil in its place.
+  sexpr_t take_item(int index);
+  // Replaces this list with a heap list of its items with erase_count of
+  // them, starting at index, replaced by inserted if it's non-null. Items
+  // are moved out of the old body if nothing else refers to it.
+  void splice(int index, int erase_count, sexpr_t *inserted);
 
 public:
 
   type_t type() const;
 
   bool boolean() const;
+  // Returns a NUMBER, or an INTEGER converted to double, which is inexact
+  // above 2^53.
   double number() const;
+  int64_t integer() const;
   symbol_t const &symbol() const;
-  string_t const &string() const;
-  list_t const &list() const;
+  string_view_t string() const;
+  list_view_t list() const;
   sexpr_t const &item(int index) const;
   inline sexpr_t const &operator [] (int index) const { return item(index); }
   int size() const;
 
+  // The same accessors without the exceptions: each returns none, or null,
+  // if this isn't of its type -- or for try_item(), if this isn't a list
+  // with that item -- so a type can be probed for without a try or a
+  // separate type() check.
+  optional<bool> try_boolean() const;
+  optional<double> try_number() const;
+  optional<int64_t> try_integer() const;
+  symbol_t const *try_symbol() const;
+  optional<string_view_t> try_string() const;
+  optional<list_view_t> try_list() const;
+  sexpr_t const *try_item(int index) const;
+
+  // Passed to visitors in place of nil's value.
+  struct nil_tag_t {};
+
+  template <typename VISITOR>
+  using visit_result_t = typename std::common_type<
+      decltype(std::declval<VISITOR &>()(std::declval<symbol_t const &>())),
+      decltype(std::declval<VISITOR &>()(std::declval<string_view_t>())),
+      decltype(std::declval<VISITOR &>()(std::declval<double>())),
+      decltype(std::declval<VISITOR &>()(std::declval<bool>())),
+      decltype(std::declval<VISITOR &>()(std::declval<list_view_t>())),
+      decltype(std::declval<VISITOR &>()(std::declval<nil_tag_t>())),
+      decltype(std::declval<VISITOR &>()(std::declval<int64_t>()))
+    >::type;
+
+  // Calls visitor with this sexpr's value as a symbol_t const &,
+  // string_view_t, double, int64_t, bool, list_view_t or nil_tag_t, picking
+  // the call from a table indexed by type() rather than testing the type
+  // case by case. visitor must be callable with each of them, usually
+  // through a set of overloads, and visit() returns the common type of what
+  // they return.
+  template <typename VISITOR>
+  auto visit(VISITOR &&visitor) const -> visit_result_t<VISITOR>;
+
+  // Replaces the item at index. Copies of a list share its items, so if
+  // anything else refers to them -- another copy, a cdr(), a document --
+  // this list gets a copy of its items first, and the others are unchanged.
+  // Throws std::runtime_error if this isn't a list or index is out of bounds.
+  void set_item(int index, sexpr_t value);
+  // Inserts value before the item at index, or appends it if index is
+  // size(). Nil is the empty list, so inserting into nil makes a list of
+  // one item. Lists are stored at their exact size, so this always builds a
+  // new body, but the items are moved to it unless they're shared.
+  void insert_item(int index, sexpr_t value);
+  // Removes the item at index, with the same costs as insert_item().
+  // Removing a list's only item leaves nil.
+  void erase_item(int index);
+
   sexpr_t const *begin() const;
   sexpr_t const *end() const;
 
@@ -164,12 +489,15 @@ public:
     return *begin();
   }
 
+  // Returns the rest of the list after its car. The result shares this list's
+  // items, so this never copies or allocates. The cdr of a one-item list is
+  // an empty list, not nil.
   sexpr_t cdr() const {
     if (type_ != LIST || size() < 1) {
       return nil;
     }
 
-    return sexpr_t(begin() + 1, end());
+    return sexpr_t(list_, offset_ + 1);
   }
 
   bool is_nil() const { return type_ == NIL || (type_ == LIST && size() == 0); }
@@ -178,13 +506,129 @@ public:
   operator bool () const { return !is_nil(); }
 
   static sexpr_t const nil;
+
+private:
+  // visit() entries, one per type, in type_t order.
+  template <typename VISITOR>
+  static auto visit_symbol(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>;
+  template <typename VISITOR>
+  static auto visit_string(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>;
+  template <typename VISITOR>
+  static auto visit_number(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>;
+  template <typename VISITOR>
+  static auto visit_boolean(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>;
+  template <typename VISITOR>
+  static auto visit_list(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>;
+  template <typename VISITOR>
+  static auto visit_nil(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>;
+  template <typename VISITOR>
+  static auto visit_integer(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>;
 };
 
 
+static_assert(sizeof(sexpr_t) <= 16, "sexpr_t nodes should fit in 16 bytes");
+static_assert(std::is_nothrow_move_constructible<sexpr_t>::value, "list_t must move sexprs when it grows");
+static_assert(std::is_nothrow_move_constructible<symbol_t>::value, "symbol_t moves must not throw");
+
+
+template <typename VISITOR>
+auto sexpr_t::visit(VISITOR &&visitor) const -> visit_result_t<VISITOR>
+{
+  using entry_t = visit_result_t<VISITOR> (*)(sexpr_t const &, VISITOR &);
+  static entry_t const entries[] = {
+    &visit_symbol<VISITOR>,
+    &visit_string<VISITOR>,
+    &visit_number<VISITOR>,
+    &visit_boolean<VISITOR>,
+    &visit_list<VISITOR>,
+    &visit_nil<VISITOR>,
+    &visit_integer<VISITOR>,
+  };
+  static_assert(sizeof(entries) / sizeof(entries[0]) == INTEGER + 1, "visit() needs an entry for every type");
+  return entries[type_](*this, visitor);
+}
+
+
+template <typename VISITOR>
+auto sexpr_t::visit_symbol(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>
+{
+  return visitor(*expr.symbol_ptr());
+}
+
+
+template <typename VISITOR>
+auto sexpr_t::visit_string(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>
+{
+  return visitor(expr.string());
+}
+
+
+template <typename VISITOR>
+auto sexpr_t::visit_number(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>
+{
+  return visitor(expr.number_);
+}
+
+
+template <typename VISITOR>
+auto sexpr_t::visit_boolean(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>
+{
+  return visitor(expr.bool_);
+}
+
+
+template <typename VISITOR>
+auto sexpr_t::visit_list(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>
+{
+  return visitor(list_view_t { expr.begin(), expr.end() });
+}
+
+
+template <typename VISITOR>
+auto sexpr_t::visit_nil(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>
+{
+  (void)expr;
+  return visitor(nil_tag_t {});
+}
+
+
+template <typename VISITOR>
+auto sexpr_t::visit_integer(sexpr_t const &expr, VISITOR &visitor) -> visit_result_t<VISITOR>
+{
+  return visitor(expr.integer_);
+}
+
+
+inline std::size_t list_view_t::size() const
+{
+  return std::size_t(last - first);
+}
+
+
+inline sexpr_t const &list_view_t::operator [] (std::size_t index) const
+{
+  return first[index];
+}
+
+
 std::ostream &operator << (std::ostream &out, sexpr_t const &in);
 std::ostream &operator << (std::ostream &out, symbol_t const &in);
 
 
 } // namespace scolex
 
+
+namespace std
+{
+
+
+template <>
+struct hash<::scolex::sexpr_t>
+{
+  std::size_t operator () (::scolex::sexpr_t const &expr) const { return expr.hash(); }
+};
+
+
+} // namespace std
+
 #endif /* end __SCOLEX_SEXPR_HH__ include guard */
@@ -0,0 +1,885 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "scolex_config.hh"
+#include "sexpr.hh"
+#include "sexpr_cursor.hh"
+#include "sexpr_document.hh"
+#include "sexpr_index.hh"
+#include "sexpr_reader.hh"
+#include "sexpr_walk.hh"
+#include "bench.hh"
+#include "bench_alloc.hh"
+
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+
+using namespace scolex;
+using namespace scolex::bench;
+
+
+namespace
+{
+
+
+sexpr_t make_number_list(int length)
+{
+  list_t items;
+  items.reserve(size_t(length));
+  for (int index = 0; index < length; ++index) {
+    items.emplace_back(double(index));
+  }
+  return sexpr_t(std::move(items));
+}
+
+
+void report_walk(char const *label, int length, double seconds, alloc_counts_t allocs)
+{
+  std::printf("%-14s n=%-7d %10.3f ms  %8.2f ns/elem  %9ld allocs\n",
+    label, length, seconds * 1e3, seconds * 1e9 / length, allocs.allocs);
+}
+
+
+// Walks a list with car/cdr the way scolex.cc does, comparing the shared-tail
+// cdr against copying the remainder of the list for every step (which is what
+// cdr used to do).
+void bench_cdr_walk()
+{
+  int const lengths[] = { 1000, 10000, 100000 };
+
+  for (int length : lengths) {
+    sexpr_t const list = make_number_list(length);
+    double sum = 0;
+    double seconds = 0;
+
+    alloc_counts_t const allocs = count_allocs([&] {
+      seconds = time_seconds([&] {
+        sexpr_t rest = list;
+        while (rest) {
+          sum += rest.car().number();
+          rest = rest.cdr();
+        }
+      });
+    });
+
+    keep(sum);
+    report_walk("shared-cdr", length, seconds, allocs);
+  }
+
+  for (int length : lengths) {
+    if (length > 10000) {
+      std::printf("%-14s n=%-7d skipped (quadratic)\n", "copying-cdr", length);
+      continue;
+    }
+
+    sexpr_t const list = make_number_list(length);
+    double sum = 0;
+    double seconds = 0;
+
+    alloc_counts_t const allocs = count_allocs([&] {
+      seconds = time_seconds([&] {
+        sexpr_t rest = list;
+        while (rest) {
+          sum += rest.car().number();
+          rest = sexpr_t(rest.begin() + 1, rest.end());
+        }
+      });
+    });
+
+    keep(sum);
+    report_walk("copying-cdr", length, seconds, allocs);
+  }
+}
+
+
+// A copy that shares nothing with expr, which is what copying a sexpr holding
+// strings used to cost.
+sexpr_t deep_copy(sexpr_t const &expr)
+{
+  switch (expr.type()) {
+  case sexpr_t::STRING:
+    return sexpr_t(expr.string());
+  case sexpr_t::LIST: {
+      list_t items;
+      items.reserve(size_t(expr.size()));
+      for (sexpr_t const &item : expr.list()) {
+        items.push_back(deep_copy(item));
+      }
+      return sexpr_t(std::move(items));
+    }
+  default:
+    return expr;
+  }
+}
+
+
+// A configuration tree of entries like (name "value" (option "detail" 1)).
+sexpr_t make_config(int entries)
+{
+  symbol_t const option_sym { "option" };
+  list_t items;
+  for (int index = 0; index < entries; ++index) {
+    string_t const suffix = std::to_string(index);
+    items.push_back(sexpr_t {
+      symbol_t("setting-" + suffix),
+      "a value long enough to live on the heap #" + suffix,
+      sexpr_t { option_sym, "some detail for the setting #" + suffix, double(index) },
+    });
+  }
+  return sexpr_t(std::move(items));
+}
+
+
+// Reads every entry of a config passed by value, taking each part by value
+// as scolex.cc does, with copies that share bodies and with deep copies.
+void bench_config_copy()
+{
+  int const entries = 1000;
+  int const reps = 200;
+  sexpr_t const config = make_config(entries);
+
+  auto read_config = [](sexpr_t (*copy)(sexpr_t const &), sexpr_t const &from) {
+    std::size_t chars = 0;
+    sexpr_t rest = copy(from);
+    while (rest) {
+      sexpr_t const entry = copy(rest.car());
+      sexpr_t const value = copy(entry[1]);
+      sexpr_t const detail = copy(entry[2][1]);
+      chars += value.string().size() + detail.string().size();
+      rest = rest.cdr();
+    }
+    return chars;
+  };
+  sexpr_t (*const share)(sexpr_t const &) = [](sexpr_t const &expr) { return expr; };
+
+  char const *const labels[] = { "shared", "deep-copy" };
+  sexpr_t (*const copies[])(sexpr_t const &) = { share, deep_copy };
+  for (int index = 0; index < 2; ++index) {
+    std::size_t chars = 0;
+    double seconds = 0;
+    alloc_counts_t const allocs = count_allocs([&] {
+      seconds = time_seconds([&] {
+        for (int rep = 0; rep < reps; ++rep) {
+          chars += read_config(copies[index], config);
+        }
+      });
+    });
+    keep(chars);
+    std::printf("%-10s %9.3f us/pass  %9.1f allocs/pass\n",
+      labels[index], seconds * 1e6 / reps, double(allocs.allocs) / reps);
+  }
+
+  // Writing to a copy leaves the original alone.
+  sexpr_t edited = config;
+  edited.set_item(0, sexpr_t("replaced"));
+  std::printf("set_item on a copy: %s\n",
+    edited[0] != config[0] && edited[1] == config[1] ? "original unchanged" : "ORIGINAL CHANGED");
+}
+
+
+// Builds a tree of nested lists, fanout items wide and depth lists deep, with
+// numbers, symbols and short strings at the leaves. Lists are built in
+// document if it's non-null, otherwise on the heap. scratch holds one item
+// vector per level, reused so the only allocations are the tree's own.
+sexpr_t build_tree(int fanout, int depth, sexpr_document_t *document, std::vector<list_t> &scratch)
+{
+  static symbol_t const leaf_sym { "leaf" };
+
+  if (scratch.size() < size_t(depth)) {
+    scratch.resize(size_t(depth));
+  }
+
+  list_t &items = scratch[size_t(depth - 1)];
+  items.clear();
+  for (int index = 0; index < fanout; ++index) {
+    if (depth > 1) {
+      items.push_back(build_tree(fanout, depth - 1, document, scratch));
+    } else {
+      switch (index % 3) {
+      case 0: items.emplace_back(double(index)); break;
+      case 1: items.emplace_back(leaf_sym); break;
+      default: items.emplace_back("str"); break;
+      }
+    }
+  }
+
+  return document ? document->list(std::move(items)) : sexpr_t(std::move(items));
+}
+
+
+// Returns a copy of tree with the node at path replaced, rebuilding every
+// list around it the way the read-only API needs.
+sexpr_t patch_rebuild(sexpr_t const &tree, int const *path, int depth, sexpr_t const &value)
+{
+  if (depth == 0) {
+    return value;
+  }
+  list_t items(tree.begin(), tree.end());
+  items[size_t(path[0])] = patch_rebuild(items[size_t(path[0])], path + 1, depth - 1, value);
+  return sexpr_t(std::move(items));
+}
+
+
+// Patches leaves scattered through a large tree one at a time, rebuilding
+// the lists around each leaf, and with a cursor kept on a copy of the tree
+// (which unshares each list the first time it goes into it) and on a tree
+// moved into it (which it can edit in place).
+void bench_patch()
+{
+  int const fanout = 16;
+  int const depth = 5;
+  int const patches = 1000;
+
+  std::vector<list_t> scratch;
+  sexpr_t const tree = build_tree(fanout, depth, nullptr, scratch);
+  std::vector<int> paths(size_t(patches * depth));
+  uint32_t seed = 12345;
+  for (int &step : paths) {
+    seed = seed * 1664525u + 1013904223u;
+    step = int((seed >> 16) % fanout);
+  }
+
+  sexpr_t rebuilt = tree;
+  double rebuild_seconds = 0;
+  alloc_counts_t const rebuild_allocs = count_allocs([&] {
+    rebuild_seconds = time_seconds([&] {
+      for (int patch = 0; patch < patches; ++patch) {
+        rebuilt = patch_rebuild(rebuilt, &paths[size_t(patch * depth)], depth, sexpr_t(double(patch)));
+      }
+    });
+  });
+
+  std::printf("%-14s %8.3f us/patch  %6.1f allocs/patch\n",
+    "rebuild", rebuild_seconds * 1e6 / patches, double(rebuild_allocs.allocs) / patches);
+
+  char const *const labels[] = { "cursor (copy)", "cursor (moved)" };
+  for (int index = 0; index < 2; ++index) {
+    sexpr_t owned = index == 0 ? tree : build_tree(fanout, depth, nullptr, scratch);
+    sexpr_t patched;
+    double seconds = 0;
+    alloc_counts_t const allocs = count_allocs([&] {
+      seconds = time_seconds([&] {
+        sexpr_cursor_t cursor { std::move(owned) };
+        for (int patch = 0; patch < patches; ++patch) {
+          cursor.top();
+          for (int level = 0; level < depth; ++level) {
+            cursor.down(paths[size_t(patch * depth + level)]);
+          }
+          cursor.replace(sexpr_t(double(patch)));
+        }
+        patched = cursor.release();
+      });
+    });
+    std::printf("%-14s %8.3f us/patch  %6.1f allocs/patch%s\n",
+      labels[index], seconds * 1e6 / patches, double(allocs.allocs) / patches,
+      patched == rebuilt && patched != tree ? "" : "  (MISMATCH)");
+  }
+}
+
+// Builds a random form of nested lists headed by one of heads, with symbols
+// and integers for arguments.
+sexpr_t random_indexed_form(uint32_t &seed, std::vector<symbol_t> const &heads, int depth)
+{
+  auto next = [&seed](uint32_t range) {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) % range;
+  };
+
+  list_t items;
+  items.push_back(sexpr_t(heads[next(uint32_t(heads.size()))]));
+  uint32_t const length = 1 + next(4);
+  for (uint32_t index = 0; index < length; ++index) {
+    switch (next(depth > 0 ? 4 : 2)) {
+    case 0: items.emplace_back(heads[next(uint32_t(heads.size()))]); break;
+    case 1: items.emplace_back(int64_t(next(1000))); break;
+    default: items.push_back(random_indexed_form(seed, heads, depth - 1)); break;
+    }
+  }
+  return sexpr_t(std::move(items));
+}
+
+
+// Counts the lists in forms headed by sym, at the top level only or
+// anywhere, the way queries work without an index.
+long scan_heads(list_t const &forms, symbol_t const &sym, bool nested)
+{
+  long count = 0;
+  for (sexpr_t const &form : forms) {
+    if (!nested) {
+      sexpr_t const *const head = form.try_item(0);
+      count += head && head->try_symbol() && *head->try_symbol() == sym;
+      continue;
+    }
+
+    sexpr_walk_t walk { form };
+    while (walk.next()) {
+      if (walk.event() == sexpr_walk_t::ENTER) {
+        sexpr_t const &head = *walk.node().begin();
+        count += head.type() == sexpr_t::SYMBOL && head.symbol() == sym;
+      }
+    }
+  }
+  return count;
+}
+
+
+long index_heads(sexpr_index_t const &index, symbol_t const &sym, bool nested)
+{
+  long count = 0;
+  for (sexpr_index_t::posting_t const &posting : index.heads(sym)) {
+    count += nested || posting.depth == 0;
+  }
+  return count;
+}
+
+
+// Indexes 200k random forms, then looks up the lists headed by each head
+// symbol with the index and by scanning every form, and replaces a tenth of
+// the forms to show what keeping the index up to date costs.
+void bench_index()
+{
+  int const form_count = 200000;
+  char const *const head_names[] = { "define", "let", "if", "quote", "list", "set!", "lambda", "begin" };
+  std::vector<symbol_t> heads;
+  for (char const *name : head_names) {
+    heads.push_back(symbol_t(name));
+  }
+
+  uint32_t seed = 12345;
+  list_t forms;
+  forms.reserve(form_count);
+  for (int index = 0; index < form_count; ++index) {
+    forms.push_back(random_indexed_form(seed, heads, 3));
+  }
+
+  sexpr_index_t index;
+  std::vector<uint32_t> ids;
+  double const build_seconds = time_seconds([&] {
+    for (sexpr_t const &form : forms) {
+      ids.push_back(index.add(form));
+    }
+  });
+  std::printf("%-20s %8.2f ms  %6.3f us/form\n", "build", build_seconds * 1e3, build_seconds * 1e6 / form_count);
+
+  char const *const labels[] = { "top-level", "nested" };
+  for (int nested = 0; nested < 2; ++nested) {
+    long scan_count = 0;
+    long index_count = 0;
+    double const scan_seconds = best_of(3, [&] {
+      scan_count = 0;
+      for (symbol_t const &sym : heads) {
+        scan_count += scan_heads(forms, sym, nested != 0);
+      }
+    });
+    double const index_seconds = best_of(3, [&] {
+      index_count = 0;
+      for (symbol_t const &sym : heads) {
+        index_count += index_heads(index, sym, nested != 0);
+      }
+    });
+    std::printf("%-10s scan %10.1f us/symbol  index %8.1f us/symbol  (%ld lists)%s\n",
+      labels[nested], scan_seconds * 1e6 / heads.size(), index_seconds * 1e6 / heads.size(),
+      index_count, scan_count == index_count ? "" : "  (MISMATCH)");
+  }
+
+  int const updates = form_count / 10;
+  double const update_seconds = time_seconds([&] {
+    for (int update = 0; update < updates; ++update) {
+      std::size_t const slot = std::size_t(update) * 10;
+      index.remove(ids[slot]);
+      forms[slot] = random_indexed_form(seed, heads, 3);
+      ids[slot] = index.add(forms[slot]);
+    }
+  });
+  std::printf("%-20s %8.2f ms  %6.3f us/update\n", "replace", update_seconds * 1e3, update_seconds * 1e6 / updates);
+
+  long mismatches = 0;
+  for (symbol_t const &sym : heads) {
+    mismatches += scan_heads(forms, sym, true) != index_heads(index, sym, true);
+  }
+  std::printf("%ld of %zu symbols' postings differ from a scan after replacing\n", mismatches, heads.size());
+}
+
+
+// Replica of the node layout before it was compacted: a type tag and an
+// aligned_union big enough to hold a string, symbol or list in place.
+struct legacy_sexpr_t
+{
+  int type;
+  std::aligned_union<1, double, string_t, symbol_t, list_t>::type data;
+};
+
+
+// Counts every node in tree, summing its numbers along the way.
+long count_nodes(sexpr_t const &tree, double &sum)
+{
+  if (tree.type() != sexpr_t::LIST) {
+    if (tree.type() == sexpr_t::NUMBER) {
+      sum += tree.number();
+    }
+    return 1;
+  }
+
+  long nodes = 1;
+  for (sexpr_t const &item : tree) {
+    nodes += count_nodes(item, sum);
+  }
+  return nodes;
+}
+
+
+// What a walk over a tree's leaves adds up: the sum of its numbers, its
+// symbol count and its strings' total length.
+struct leaf_tally_t
+{
+  double sum;
+  long symbols;
+  long chars;
+
+  bool operator == (leaf_tally_t const &other) const
+  {
+    return sum == other.sum && symbols == other.symbols && chars == other.chars;
+  }
+};
+
+
+// Probes each node's type by calling accessors until one doesn't throw.
+void tally_throwing(sexpr_t const &tree, leaf_tally_t &tally)
+{
+  try {
+    for (sexpr_t const &item : tree.list()) {
+      tally_throwing(item, tally);
+    }
+    return;
+  } catch (std::runtime_error const &) {
+    /* nop */
+  }
+
+  try {
+    tally.sum += tree.number();
+    return;
+  } catch (std::runtime_error const &) {
+    /* nop */
+  }
+
+  try {
+    tree.symbol();
+    ++tally.symbols;
+    return;
+  } catch (std::runtime_error const &) {
+    /* nop */
+  }
+
+  tally.chars += long(tree.string().size());
+}
+
+
+// Checks type() and then calls the accessor, which checks it again.
+void tally_checked(sexpr_t const &tree, leaf_tally_t &tally)
+{
+  switch (tree.type()) {
+  case sexpr_t::LIST:
+    for (sexpr_t const &item : tree.list()) {
+      tally_checked(item, tally);
+    }
+    break;
+  case sexpr_t::NUMBER: tally.sum += tree.number(); break;
+  case sexpr_t::SYMBOL: tree.symbol(); ++tally.symbols; break;
+  case sexpr_t::STRING: tally.chars += long(tree.string().size()); break;
+  default: break;
+  }
+}
+
+
+void tally_try(sexpr_t const &tree, leaf_tally_t &tally)
+{
+  if (optional<list_view_t> const items = tree.try_list()) {
+    for (sexpr_t const &item : *items) {
+      tally_try(item, tally);
+    }
+  } else if (optional<double> const num = tree.try_number()) {
+    tally.sum += *num;
+  } else if (tree.try_symbol()) {
+    ++tally.symbols;
+  } else if (optional<string_view_t> const str = tree.try_string()) {
+    tally.chars += long(str->size());
+  }
+}
+
+
+struct tally_visitor_t
+{
+  leaf_tally_t &tally;
+
+  void operator () (list_view_t items) const
+  {
+    for (sexpr_t const &item : items) {
+      item.visit(*this);
+    }
+  }
+
+  void operator () (double num) const { tally.sum += num; }
+  void operator () (symbol_t const &) const { ++tally.symbols; }
+  void operator () (string_view_t str) const { tally.chars += long(str.size()); }
+  void operator () (int64_t) const { /* nop */ }
+  void operator () (bool) const { /* nop */ }
+  void operator () (sexpr_t::nil_tag_t) const { /* nop */ }
+};
+
+
+// Walks a tree of numbers, symbols and strings, telling them apart by
+// catching exceptions, by type() and the checked accessors, by the try_
+// accessors, and with visit().
+void bench_dispatch()
+{
+  int const fanout = 8;
+  int const depth = 5;
+
+  std::vector<list_t> scratch;
+  sexpr_t const tree = build_tree(fanout, depth, nullptr, scratch);
+  double sum = 0;
+  long const nodes = count_nodes(tree, sum);
+
+  struct walker_t
+  {
+    char const *label;
+    void (*walk)(sexpr_t const &tree, leaf_tally_t &tally);
+  };
+  walker_t const walkers[] = {
+    { "try/catch", tally_throwing },
+    { "type() check", tally_checked },
+    { "try_ accessors", tally_try },
+    { "visit()", [](sexpr_t const &tree, leaf_tally_t &tally) { tree.visit(tally_visitor_t { tally }); } },
+  };
+
+  leaf_tally_t expected = { 0, 0, 0 };
+  tally_checked(tree, expected);
+
+  for (walker_t const &walker : walkers) {
+    leaf_tally_t tally = { 0, 0, 0 };
+    double const seconds = best_of(3, [&] {
+      tally = leaf_tally_t { 0, 0, 0 };
+      walker.walk(tree, tally);
+    });
+    std::printf("%-14s %8.3f ms  %7.2f ns/node%s\n",
+      walker.label, seconds * 1e3, seconds * 1e9 / nodes,
+      tally == expected ? "" : "  (MISMATCH)");
+  }
+}
+
+// Reports sizeof(sexpr_t) against the old layout, the heap bytes a large tree
+// costs per node, and how long it takes to walk it.
+void bench_layout()
+{
+  std::printf("sizeof(sexpr_t) %zu bytes (was %zu)\n", sizeof(sexpr_t), sizeof(legacy_sexpr_t));
+
+  int const fanout = 8;
+  int const depth = 7;
+  std::vector<list_t> scratch;
+  build_tree(fanout, depth, nullptr, scratch);
+
+  sexpr_t tree;
+  alloc_counts_t const allocs = count_allocs([&] {
+    tree = build_tree(fanout, depth, nullptr, scratch);
+  });
+
+  double sum = 0;
+  long nodes = 0;
+  double const seconds = best_of(3, [&] { nodes = count_nodes(tree, sum); });
+  keep(sum);
+
+  std::printf("%ld nodes  %.1f MB  %.2f bytes/node  walk %.2f ms  %.2f ns/node\n",
+    nodes, allocs.bytes / 1e6, double(allocs.bytes) / nodes,
+    seconds * 1e3, seconds * 1e9 / nodes);
+}
+
+
+void report_tree(char const *label, double build, double teardown, alloc_counts_t allocs)
+{
+  std::printf("%-10s build %8.2f ms  teardown %8.2f ms  %9ld allocs  %9ld frees\n",
+    label, build * 1e3, teardown * 1e3, allocs.allocs, allocs.frees);
+}
+
+
+// Builds and tears down the same ~2.4M node tree with heap-allocated list
+// bodies and in a document.
+void bench_document()
+{
+  int const fanout = 8;
+  int const depth = 7;
+  std::vector<list_t> scratch;
+  build_tree(fanout, depth, nullptr, scratch);
+
+  {
+    double build = 0;
+    double teardown = 0;
+    alloc_counts_t const allocs = count_allocs([&] {
+      sexpr_t tree;
+      build = time_seconds([&] { tree = build_tree(fanout, depth, nullptr, scratch); });
+      teardown = time_seconds([&] { tree = sexpr_t::nil; });
+    });
+    report_tree("heap", build, teardown, allocs);
+  }
+
+  {
+    double build = 0;
+    double teardown = 0;
+    std::size_t reserved = 0;
+    alloc_counts_t const allocs = count_allocs([&] {
+      sexpr_document_t document;
+      sexpr_t tree;
+      build = time_seconds([&] { tree = build_tree(fanout, depth, &document, scratch); });
+      reserved = document.bytes_reserved();
+      teardown = time_seconds([&] { tree = sexpr_t::nil; document.clear(); });
+    });
+    report_tree("document", build, teardown, allocs);
+    std::printf("document reserved %.1f MB\n", reserved / 1e6);
+  }
+}
+
+
+// Builds two copies of the same tree in a plain document and in a
+// hash-consing one, then compares and hashes them. build_tree repeats the
+// same subtrees over and over, like a config with many identical sections.
+void bench_hash_cons()
+{
+  int const fanout = 8;
+  int const depth = 7;
+  std::vector<list_t> scratch;
+
+  sexpr_document_t plain;
+  sexpr_document_t consed { sexpr_document_t::HASH_CONS };
+  sexpr_document_t *const documents[] = { &plain, &consed };
+  char const *const labels[] = { "plain", "hash-consed" };
+
+  for (int index = 0; index < 2; ++index) {
+    sexpr_document_t &document = *documents[index];
+    sexpr_t lhs, rhs;
+    double const build = time_seconds([&] {
+      lhs = build_tree(fanout, depth, &document, scratch);
+      rhs = build_tree(fanout, depth, &document, scratch);
+    });
+
+    bool equal = false;
+    double const compare = best_of(5, [&] { equal = lhs == rhs; });
+    hash_t hash = 0;
+    double const hashing = best_of(5, [&] { hash = lhs.hash(); });
+    keep(equal);
+    keep(hash);
+
+    std::printf("%-12s build %8.2f ms  %10.1f KB used  compare %10.4f ms  hash %10.4f ms%s\n",
+      labels[index], build * 1e3, document.bytes_used() / 1e3, compare * 1e3, hashing * 1e3,
+      equal ? "" : "  (MISMATCH)");
+  }
+}
+
+
+void report_allocs(char const *label, double seconds, int reps, alloc_counts_t allocs)
+{
+  std::printf("%-24s %9.1f ns  %6.2f allocs  %6.2f frees\n",
+    label, seconds * 1e9 / reps, double(allocs.allocs) / reps, double(allocs.frees) / reps);
+}
+
+
+// Counts the allocations made by the constructors scolex.cc uses, plus growing
+// a list_t of lists one push_back at a time. Lists are moved when a list_t
+// reallocates, so growing it only allocates its own storage.
+void bench_allocs()
+{
+  int const reps = 100000;
+  symbol_t const quote_sym { "quote" };
+  symbol_t const sum_sym { "sum" };
+  sexpr_t const expr = "foobar";
+  sexpr_t const expr2 { expr, expr, expr };
+  sexpr_t const expr4 { quote_sym, expr2, sexpr_t::nil };
+
+  struct case_t
+  {
+    char const *label;
+    std::function<void()> fn;
+  };
+
+  case_t const cases[] = {
+    { "string (cstr)", [&] { sexpr_t value = "foobar"; keep(value); } },
+    { "list (3 strings)", [&] { sexpr_t value { expr, expr, expr }; keep(value); } },
+    { "list (nested)", [&] { sexpr_t value { quote_sym, expr2, sexpr_t::nil }; keep(value); } },
+    { "list (mixed)", [&] {
+        sexpr_t value { sum_sym, sexpr_t(true), 1.5, 2, "foo", 3, expr4, sexpr_t::nil, sexpr_t::nil };
+        keep(value);
+      } },
+    { "copy (string)", [&] { sexpr_t value = expr; keep(value); } },
+    { "copy (list)", [&] { sexpr_t value = expr4; keep(value); } },
+    { "move (list)", [&] { sexpr_t from = expr4; sexpr_t value = std::move(from); keep(value); } },
+    { "set_item (shared)", [&] { sexpr_t value = expr2; value.set_item(1, sexpr_t(1.0)); keep(value); } },
+  };
+
+  for (case_t const &entry : cases) {
+    double seconds = 0;
+    alloc_counts_t const allocs = count_allocs([&] {
+      seconds = time_seconds([&] {
+        for (int rep = 0; rep < reps; ++rep) {
+          entry.fn();
+        }
+      });
+    });
+    report_allocs(entry.label, seconds, reps, allocs);
+  }
+
+  // Copies of lists and strings share their bodies, so anything past list_t's
+  // own storage is a copy that shouldn't have happened.
+  sexpr_t const *const items[] = { &expr2, &expr };
+  char const *const labels[] = { "list_t growth (lists)", "list_t growth (strings)" };
+  int const length = 10000;
+  for (int index = 0; index < 2; ++index) {
+    list_t grown;
+    double seconds = 0;
+    alloc_counts_t const allocs = count_allocs([&] {
+      seconds = time_seconds([&] {
+        for (int count = 0; count < length; ++count) {
+          grown.push_back(*items[index]);
+        }
+      });
+    });
+    report_allocs(labels[index], seconds, length, allocs);
+  }
+}
+
+
+// Recursive versions of printing, comparison and hashing, for comparison
+// against the explicit-stack ones in sexpr.cc.
+void print_recursive(std::ostream &out, sexpr_t const &expr)
+{
+  if (expr.type() != sexpr_t::LIST) {
+    out << expr;
+    return;
+  }
+
+  out << '(';
+  for (sexpr_t const *item = expr.begin(); item != expr.end(); ++item) {
+    if (item != expr.begin()) {
+      out << ' ';
+    }
+    print_recursive(out, *item);
+  }
+  out << ')';
+}
+
+
+bool equal_recursive(sexpr_t const &lhs, sexpr_t const &rhs)
+{
+  if (lhs.type() != sexpr_t::LIST || rhs.type() != sexpr_t::LIST) {
+    return lhs == rhs;
+  } else if (lhs.size() != rhs.size()) {
+    return false;
+  }
+  for (int index = 0; index < lhs.size(); ++index) {
+    if (!equal_recursive(lhs.begin()[index], rhs.begin()[index])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+hash_t hash_recursive(sexpr_t const &expr)
+{
+  if (expr.type() != sexpr_t::LIST) {
+    return expr.hash();
+  }
+  hash_t hash = hash_t(expr.size());
+  for (sexpr_t const &item : expr) {
+    hash ^= hash_recursive(item) + 0x9e3779b9u + (hash << 6) + (hash >> 2);
+  }
+  return hash;
+}
+
+
+// Right-nested list depth lists deep: (n (n-1 (... (0 leaf)))).
+sexpr_t build_nested(int depth)
+{
+  sexpr_t tree { symbol_t("leaf") };
+  for (int index = 0; index < depth; ++index) {
+    tree = sexpr_t { sexpr_t(double(index)), std::move(tree) };
+  }
+  return tree;
+}
+
+
+void report_traversal(char const *label, char const *kind, double seconds)
+{
+  std::printf("%-10s %-10s %10.2f ms\n", label, kind, seconds * 1e3);
+}
+
+
+void time_traversals(char const *label, sexpr_t const &lhs, sexpr_t const &rhs, bool recursive)
+{
+  std::ostringstream out;
+  bool equal = false;
+  hash_t hash = 0;
+
+  report_traversal(label, "print", best_of(3, [&] { out.str(string_t()); out << lhs; }));
+  report_traversal(label, "equal", best_of(3, [&] { equal = lhs == rhs; }));
+  report_traversal(label, "hash", best_of(3, [&] { hash = lhs.hash(); }));
+  keep(equal);
+  keep(hash);
+
+  if (!recursive) {
+    std::printf("%-10s recursive versions skipped (would overflow the stack)\n", label);
+    return;
+  }
+
+  report_traversal(label, "print-rec", best_of(3, [&] { out.str(string_t()); print_recursive(out, lhs); }));
+  report_traversal(label, "equal-rec", best_of(3, [&] { equal = equal_recursive(lhs, rhs); }));
+  report_traversal(label, "hash-rec", best_of(3, [&] { hash = hash_recursive(lhs); }));
+  keep(equal);
+  keep(hash);
+}
+
+
+// Prints, compares, hashes and tears down a wide tree and a 1M-deep one.
+void bench_traversal()
+{
+  std::vector<list_t> scratch;
+  {
+    sexpr_t lhs = build_tree(8, 7, nullptr, scratch);
+    sexpr_t rhs = build_tree(8, 7, nullptr, scratch);
+    time_traversals("wide", lhs, rhs, true);
+    report_traversal("wide", "teardown", time_seconds([&] { lhs = rhs = sexpr_t::nil; }));
+  }
+
+  {
+    int const depth = 1000000;
+    sexpr_t lhs = build_nested(depth);
+    sexpr_t rhs = build_nested(depth);
+    time_traversals("deep", lhs, rhs, false);
+    report_traversal("deep", "teardown", time_seconds([&] { lhs = rhs = sexpr_t::nil; }));
+  }
+}
+
+
+bench_case_t const cases[] = {
+  { "sexpr/cdr-walk", bench_cdr_walk },
+  { "sexpr/document", bench_document },
+  { "sexpr/layout", bench_layout },
+  { "sexpr/hash-cons", bench_hash_cons },
+  { "sexpr/allocs", bench_allocs },
+  { "sexpr/config-copy", bench_config_copy },
+  { "sexpr/patch", bench_patch },
+  { "sexpr/dispatch", bench_dispatch },
+  { "sexpr/index", bench_index },
+  { "sexpr/traversal", bench_traversal },
+};
+
+
+} // namespace
+
+
+int main(int argc, char const *argv[])
+{
+  return run_cases(argc, argv, std::begin(cases), std::end(cases));
+}
@@ -0,0 +1,119 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sexpr_cursor.hh"
+
+
+namespace scolex
+{
+
+
+sexpr_cursor_t::sexpr_cursor_t(sexpr_t root)
+: path_()
+, focus_(std::move(root))
+{
+  /* nop */
+}
+
+
+bool sexpr_cursor_t::down(int index)
+{
+  if (focus_.type() != sexpr_t::LIST || index < 0 || index >= focus_.size()) {
+    return false;
+  }
+
+  sexpr_t child = focus_.take_item(index);
+  path_.push_back(frame_t { std::move(focus_), index });
+  focus_ = std::move(child);
+  return true;
+}
+
+
+bool sexpr_cursor_t::up()
+{
+  if (path_.empty()) {
+    return false;
+  }
+
+  frame_t &frame = path_.back();
+  frame.parent.set_item(frame.index, std::move(focus_));
+  focus_ = std::move(frame.parent);
+  path_.pop_back();
+  return true;
+}
+
+
+bool sexpr_cursor_t::next()
+{
+  if (path_.empty() || path_.back().index + 1 >= path_.back().parent.size()) {
+    return false;
+  }
+
+  frame_t &frame = path_.back();
+  frame.parent.set_item(frame.index, std::move(focus_));
+  focus_ = frame.parent.take_item(++frame.index);
+  return true;
+}
+
+
+bool sexpr_cursor_t::prev()
+{
+  if (path_.empty() || path_.back().index == 0) {
+    return false;
+  }
+
+  frame_t &frame = path_.back();
+  frame.parent.set_item(frame.index, std::move(focus_));
+  focus_ = frame.parent.take_item(--frame.index);
+  return true;
+}
+
+
+void sexpr_cursor_t::top()
+{
+  while (up()) {
+    /* nop */
+  }
+}
+
+
+void sexpr_cursor_t::replace(sexpr_t value)
+{
+  focus_ = std::move(value);
+}
+
+
+void sexpr_cursor_t::insert(int index, sexpr_t value)
+{
+  focus_.insert_item(index, std::move(value));
+}
+
+
+void sexpr_cursor_t::erase(int index)
+{
+  focus_.erase_item(index);
+}
+
+
+sexpr_t sexpr_cursor_t::root() const
+{
+  sexpr_t node = focus_;
+  for (auto frame = path_.rbegin(); frame != path_.rend(); ++frame) {
+    sexpr_t parent = frame->parent;
+    parent.set_item(frame->index, std::move(node));
+    node = std::move(parent);
+  }
+  return node;
+}
+
+
+sexpr_t sexpr_cursor_t::release()
+{
+  top();
+  return std::move(focus_);
+}
+
+
+} // namespace scolex
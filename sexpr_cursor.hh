@@ -0,0 +1,97 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SEXPR_CURSOR_HH__
+#define __SCOLEX_SEXPR_CURSOR_HH__
+
+#include "scolex_config.hh"
+#include "sexpr.hh"
+
+#include <vector>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  sexpr_cursor_t
+
+  Zipper over a tree of sexprs: a cursor focuses on one node of the tree,
+  moves between nodes, and replaces the focus or inserts and removes its
+  items, so a leaf deep in a large tree can be patched without rebuilding
+  every list around it by hand.
+
+  The cursor owns its tree. Going down into a list moves the item out of
+  its parent, and the parents on the way down are kept on a path with the
+  focus missing from them; going up puts the focus back. A parent is
+  unshared the first time the cursor goes down into it, so if the tree was
+  copied into the cursor, each list on the path costs one copy of its items
+  -- reference count bumps, never copies of the subtrees under them -- and
+  the lists off the path aren't touched at all. After that, or if the tree
+  was moved in, edits are made in place. Either way, nothing else holding the
+  tree sees the edits.
+
+  Moves return false, and leave the cursor where it was, if there's nowhere
+  to go. Edits of the focus's items throw std::runtime_error like the
+  sexpr_t functions they use.
+
+==============================================================================*/
+class sexpr_cursor_t
+{
+  struct frame_t
+  {
+    // The parent list, with nil where the focus was taken out of it.
+    sexpr_t parent;
+    int index;
+  };
+
+  std::vector<frame_t> path_;
+  sexpr_t focus_;
+
+public:
+  explicit sexpr_cursor_t(sexpr_t root);
+
+  sexpr_t const &get() const { return focus_; }
+  sexpr_t const &operator * () const { return focus_; }
+  sexpr_t const *operator -> () const { return &focus_; }
+
+  // How many lists deep the focus is; the root is at depth 0.
+  int depth() const { return int(path_.size()); }
+  // The focus's index in its parent, or -1 at the root.
+  int index() const { return path_.empty() ? -1 : path_.back().index; }
+
+  // Focuses on item index of the focus, if it's a list with that item.
+  bool down(int index = 0);
+  // Focuses on the focus's parent.
+  bool up();
+  // Focuses on the focus's next or previous sibling.
+  bool next();
+  bool prev();
+  // Goes all the way up to the root.
+  void top();
+
+  // Replaces the focus, and with it the subtree under it.
+  void replace(sexpr_t value);
+  // Inserts value before item index of the focus, or appends it if index is
+  // the focus's size. Nil is the empty list, so inserting into it makes a
+  // list.
+  void insert(int index, sexpr_t value);
+  // Removes item index of the focus.
+  void erase(int index);
+
+  // Returns the whole tree as edited so far, leaving the cursor where it
+  // is. Costs a copy of each list on the path above the focus.
+  sexpr_t root() const;
+  // Goes up to the root and moves the tree out of the cursor, leaving it
+  // focused on nil.
+  sexpr_t release();
+};
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SEXPR_CURSOR_HH__ include guard */
@@ -0,0 +1,358 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sexpr_document.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+
+namespace scolex
+{
+
+
+namespace
+{
+
+
+std::size_t const ARENA_ALIGNMENT = alignof(sexpr_t);
+
+
+std::size_t const INITIAL_CONS_CAPACITY = 256;
+
+
+std::size_t align_up(std::size_t size)
+{
+  return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+
+uint32_t next_document_id()
+{
+  static std::atomic<uint32_t> last_id { 0 };
+  uint32_t id;
+  do {
+    id = last_id.fetch_add(1, std::memory_order_relaxed) + 1;
+  } while (id == 0);
+  return id;
+}
+
+
+// Returns the body in slots with the given hash that match accepts, or null.
+template <typename BODY, typename MATCH>
+BODY *find_consed(std::vector<BODY *> const &slots, uint32_t hash, MATCH &&match)
+{
+  if (slots.empty()) {
+    return nullptr;
+  }
+
+  std::size_t const mask = slots.size() - 1;
+  for (std::size_t index = hash & mask; slots[index]; index = (index + 1) & mask) {
+    if (slots[index]->hash == hash && match(slots[index])) {
+      return slots[index];
+    }
+  }
+  return nullptr;
+}
+
+
+template <typename BODY>
+void place_consed(std::vector<BODY *> &slots, BODY *body)
+{
+  std::size_t const mask = slots.size() - 1;
+  std::size_t index = body->hash & mask;
+  while (slots[index]) {
+    index = (index + 1) & mask;
+  }
+  slots[index] = body;
+}
+
+
+// Adds body to slots, which hold count bodies, growing them at half full.
+template <typename BODY>
+void insert_consed(std::vector<BODY *> &slots, std::size_t &count, BODY *body)
+{
+  if ((count + 1) * 2 > slots.size()) {
+    std::vector<BODY *> next(std::max(INITIAL_CONS_CAPACITY, slots.size() * 2), nullptr);
+    for (BODY *existing : slots) {
+      if (existing) {
+        place_consed(next, existing);
+      }
+    }
+    slots.swap(next);
+  }
+
+  place_consed(slots, body);
+  ++count;
+}
+
+
+} // namespace
+
+
+sexpr_document_t::sexpr_document_t(std::size_t block_size)
+: sexpr_document_t(NO_HASH_CONS, block_size)
+{
+  /* nop */
+}
+
+
+sexpr_document_t::sexpr_document_t(cons_mode_t mode, std::size_t block_size)
+: block_size_(align_up(block_size > 0 ? block_size : std::size_t(DEFAULT_BLOCK_SIZE)))
+, blocks_()
+, cur_(nullptr)
+, end_(nullptr)
+, used_(0)
+, reserved_(0)
+, finalize_()
+, id_(mode == HASH_CONS ? next_document_id() : 0)
+, lists_()
+, strings_()
+, consed_lists_(0)
+, consed_strings_(0)
+{
+  /* nop */
+}
+
+
+sexpr_document_t::~sexpr_document_t()
+{
+  clear();
+}
+
+
+void sexpr_document_t::clear()
+{
+  for (sexpr_t *item : finalize_) {
+    item->dispose();
+  }
+  finalize_.clear();
+
+  lists_.clear();
+  strings_.clear();
+  consed_lists_ = consed_strings_ = 0;
+
+  for (char *block : blocks_) {
+    ::operator delete (block);
+  }
+  blocks_.clear();
+
+  cur_ = end_ = nullptr;
+  used_ = reserved_ = 0;
+}
+
+
+void *sexpr_document_t::allocate(std::size_t bytes)
+{
+  bytes = align_up(bytes);
+
+  if (bytes > std::size_t(end_ - cur_)) {
+    // Oversized requests get a block of their own so they don't waste the
+    // rest of the current block.
+    blocks_.reserve(blocks_.size() + 1);
+
+    if (bytes > block_size_ / 4) {
+      char *block = static_cast<char *>(::operator new (bytes));
+      blocks_.push_back(block);
+      used_ += bytes;
+      reserved_ += bytes;
+      return block;
+    }
+
+    cur_ = static_cast<char *>(::operator new (block_size_));
+    end_ = cur_ + block_size_;
+    blocks_.push_back(cur_);
+    reserved_ += block_size_;
+  }
+
+  void *result = cur_;
+  cur_ += bytes;
+  used_ += bytes;
+  return result;
+}
+
+
+void sexpr_document_t::adopt(sexpr_t *item)
+{
+  switch (item->type_) {
+  case sexpr_t::STRING:
+    if (!(item->string_->flags & sexpr_t::string_body_t::ARENA)) {
+      sexpr_t::string_body_t *body = sexpr_t::string_body_t::make(item->string_->chars(), item->string_->size, this);
+      sexpr_t::string_body_t::release(item->string_);
+      item->string_ = body;
+    }
+    break;
+  case sexpr_t::LIST:
+    if (!(item->list_->flags & sexpr_t::list_body_t::ARENA)) {
+      finalize_.push_back(item);
+    }
+    break;
+#if SCOLEX_RECLAIM_SYMBOLS
+  case sexpr_t::SYMBOL:
+    // Arena items aren't destroyed unless finalized, and a symbol's reference
+    // has to be dropped for it to be reclaimed.
+    finalize_.push_back(item);
+    break;
+#endif
+  default:
+    break;
+  }
+}
+
+
+sexpr_t sexpr_document_t::string(string_view_t str)
+{
+  if (id_) {
+    return cons_string(str);
+  }
+  return sexpr_t(sexpr_t::string_body_t::make(str.data(), str.size(), this));
+}
+
+
+sexpr_t sexpr_document_t::list(std::initializer_list<sexpr_t> items)
+{
+  return list(items.begin(), items.end());
+}
+
+
+sexpr_t sexpr_document_t::list(sexpr_t const *begin, sexpr_t const *end)
+{
+  if (begin == end) {
+    return sexpr_t::nil;
+  } else if (id_) {
+    return cons_list(list_t(begin, end));
+  }
+  return sexpr_t(sexpr_t::list_body_t::copy(begin, end, this), 0);
+}
+
+
+sexpr_t sexpr_document_t::list(list_t &&items)
+{
+  if (items.empty()) {
+    return sexpr_t::nil;
+  } else if (id_) {
+    sexpr_t result = cons_list(std::move(items));
+    items.clear();
+    return result;
+  }
+  sexpr_t result { sexpr_t::list_body_t::move(items.data(), items.data() + items.size(), this), 0 };
+  items.clear();
+  return result;
+}
+
+
+sexpr_t sexpr_document_t::hash_cons(sexpr_t const &expr)
+{
+  if (!id_) {
+    throw std::runtime_error("Document isn't hash-consing");
+  }
+
+  switch (expr.type_) {
+  case sexpr_t::STRING:
+    return expr.consed_by() == id_ ? expr : cons_string(expr.string());
+  case sexpr_t::LIST:
+    return expr.consed_by() == id_ ? expr : cons_list(list_t(expr.begin(), expr.end()));
+  default:
+    return expr;
+  }
+}
+
+
+sexpr_t sexpr_document_t::cons_string(string_view_t str)
+{
+  using body_t = sexpr_t::string_body_t;
+
+  uint32_t const hash = sexpr_t::hash_chars(str.data(), str.size());
+  body_t *body = find_consed(strings_, hash, [&](body_t const *candidate) {
+    return candidate->size == str.size() && std::memcmp(candidate->chars(), str.data(), str.size()) == 0;
+  });
+
+  if (!body) {
+    body = body_t::make(str.data(), str.size(), this);
+    body->flags |= body_t::CONSED;
+    body->hash = hash;
+    body->refs.store(id_, std::memory_order_relaxed);
+    insert_consed(strings_, consed_strings_, body);
+  }
+
+  return sexpr_t(body);
+}
+
+
+// Conses items, which must not be empty, and every part of them that isn't
+// consed already. Nested lists are consed bottom-up with an explicit stack,
+// each frame holding a list's items and the next of them to cons, so deep
+// trees don't recurse. items keeps its capacity.
+sexpr_t sexpr_document_t::cons_list(list_t &&items)
+{
+  struct frame_t
+  {
+    list_t items;
+    std::size_t next;
+  };
+
+  std::vector<frame_t> stack;
+  stack.push_back(frame_t { list_t(), 0 });
+  stack.back().items.swap(items);
+
+  for (;;) {
+    frame_t &frame = stack.back();
+    if (frame.next == frame.items.size()) {
+      sexpr_t consed = cons_items(frame.items);
+      if (stack.size() == 1) {
+        items.swap(frame.items);
+        return consed;
+      }
+      stack.pop_back();
+      frame_t &parent = stack.back();
+      parent.items[parent.next++] = std::move(consed);
+      continue;
+    }
+
+    sexpr_t &item = frame.items[frame.next];
+    if (item.type_ == sexpr_t::STRING && item.consed_by() != id_) {
+      item = cons_string(item.string());
+    } else if (item.type_ == sexpr_t::LIST && item.consed_by() != id_) {
+      // Invalidates frame and item; the list is put in item's place once
+      // it's consed.
+      list_t nested(item.begin(), item.end());
+      stack.push_back(frame_t { std::move(nested), 0 });
+      continue;
+    }
+    ++frame.next;
+  }
+}
+
+
+// Conses a list of items that are all consed already, moving them out of
+// items. Since they're consed, comparing them against a candidate's items is
+// shallow.
+sexpr_t sexpr_document_t::cons_items(list_t &items)
+{
+  using body_t = sexpr_t::list_body_t;
+
+  sexpr_t const *const begin = items.data();
+  sexpr_t const *const end = begin + items.size();
+  uint32_t const hash = sexpr_t::hash_items(begin, end);
+  body_t *body = find_consed(lists_, hash, [&](body_t const *candidate) {
+    return candidate->size == items.size() && std::equal(begin, end, candidate->items());
+  });
+
+  if (!body) {
+    body = body_t::move(items.data(), items.data() + items.size(), this);
+    body->flags |= body_t::CONSED;
+    body->hash = hash;
+    body->refs.store(id_, std::memory_order_relaxed);
+    insert_consed(lists_, consed_lists_, body);
+  }
+
+  return sexpr_t(body, 0);
+}
+
+
+} // namespace scolex
@@ -0,0 +1,117 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SEXPR_DOCUMENT_HH__
+#define __SCOLEX_SEXPR_DOCUMENT_HH__
+
+#include "scolex_config.hh"
+#include "sexpr.hh"
+
+#include <vector>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  sexpr_document_t
+
+  Arena that owns the list and string storage of a tree of sexprs. Lists and
+  strings built through a document are allocated from a few large blocks
+  rather than one heap allocation each, aren't reference counted or copied,
+  and are all freed at once when the document is cleared or destroyed --
+  there's no walk over the tree to tear it down.
+
+  Sexprs referring to document storage (including copies, cars and cdrs of
+  them) are only valid for as long as the document: they must not outlive it
+  or a call to clear(). A document isn't safe to build into from more than one
+  thread at a time, though trees in it may be read from any number of threads.
+
+  Heap strings placed in a document's lists are copied into the document.
+  Heap lists placed in a document's lists are shared rather than copied, so
+  they're recorded when added and released on teardown in a single flat pass.
+
+  A document created with HASH_CONS hash-conses everything built through it:
+  equal lists and strings are only stored once, and every later request for
+  an equal one returns the stored node. Consed nodes carry their structural
+  hash, so hashing them is free, and comparing two nodes consed by the same
+  document is a pointer comparison. Items placed in a consing document's
+  lists are consed along with the list.
+
+==============================================================================*/
+class sexpr_document_t
+{
+public:
+  enum : std::size_t { DEFAULT_BLOCK_SIZE = 1024 * 1024 };
+  enum cons_mode_t : int { NO_HASH_CONS, HASH_CONS };
+
+  explicit sexpr_document_t(std::size_t block_size = DEFAULT_BLOCK_SIZE);
+  explicit sexpr_document_t(cons_mode_t mode, std::size_t block_size = DEFAULT_BLOCK_SIZE);
+  ~sexpr_document_t();
+
+  sexpr_document_t(sexpr_document_t const &) = delete;
+  sexpr_document_t &operator = (sexpr_document_t const &) = delete;
+
+  // Builds a list whose items live in the document. Empty lists are nil.
+  sexpr_t list(std::initializer_list<sexpr_t> items);
+  sexpr_t list(sexpr_t const *begin, sexpr_t const *end);
+  // Moves items' elements into the document, leaving items empty (but with
+  // its capacity intact, so it can be reused).
+  sexpr_t list(list_t &&items);
+
+  // Builds a string whose chars live in the document.
+  sexpr_t string(string_view_t str);
+
+  // Returns the consed copy of expr, consing any part of it that isn't
+  // already. Throws std::runtime_error if the document isn't hash-consing.
+  sexpr_t hash_cons(sexpr_t const &expr);
+
+  bool hash_consing() const { return id_ != 0; }
+
+  // Frees all storage owned by the document.
+  void clear();
+
+  // Bytes handed out to lists and strings so far.
+  std::size_t bytes_used() const { return used_; }
+  // Bytes held in blocks, used or not.
+  std::size_t bytes_reserved() const { return reserved_; }
+  std::size_t block_count() const { return blocks_.size(); }
+  // Distinct lists and strings consed so far.
+  std::size_t consed_count() const { return consed_lists_ + consed_strings_; }
+
+private:
+  friend struct sexpr_t;
+
+  std::size_t block_size_;
+  std::vector<char *> blocks_;
+  char *cur_;
+  char *end_;
+  std::size_t used_;
+  std::size_t reserved_;
+  // Items in document storage that own something outside of it.
+  std::vector<sexpr_t *> finalize_;
+
+  // Nonzero if hash-consing. Identifies this document's consed bodies.
+  uint32_t id_;
+  // Open-addressed sets of consed bodies, by hash.
+  std::vector<sexpr_t::list_body_t *> lists_;
+  std::vector<sexpr_t::string_body_t *> strings_;
+  std::size_t consed_lists_;
+  std::size_t consed_strings_;
+
+  void *allocate(std::size_t bytes);
+  void adopt(sexpr_t *item);
+
+  sexpr_t cons_list(list_t &&items);
+  sexpr_t cons_items(list_t &items);
+  sexpr_t cons_string(string_view_t str);
+};
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SEXPR_DOCUMENT_HH__ include guard */
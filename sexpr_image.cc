@@ -0,0 +1,509 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sexpr_image.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+
+
+namespace scolex
+{
+
+
+namespace
+{
+
+
+uint32_t const IMAGE_VERSION = 1;
+uint32_t const IMAGE_BYTE_ORDER = 0x01020304;
+char const IMAGE_MAGIC[4] = { 'S', 'X', 'I', 'M' };
+
+
+struct image_header_t
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t reserved;
+  uint64_t node_offset;
+  uint64_t node_count;
+  uint64_t symbol_offset;
+  uint64_t symbol_count;
+  uint64_t pool_offset;
+  uint64_t pool_size;
+};
+
+
+std::size_t align8(std::size_t size)
+{
+  return (size + 7) & ~std::size_t(7);
+}
+
+
+// The header of a loaded image, which load() has checked.
+image_header_t const &image_header(char const *data)
+{
+  return *reinterpret_cast<image_header_t const *>(data);
+}
+
+
+sexpr_image_node_t const *image_nodes(char const *data)
+{
+  return reinterpret_cast<sexpr_image_node_t const *>(data + image_header(data).node_offset);
+}
+
+
+[[noreturn]] void image_error(char const *what)
+{
+  throw std::runtime_error(string_t("Invalid sexpr image: ") + what);
+}
+
+
+} // namespace
+
+
+// sexpr_view_t
+
+auto sexpr_view_t::type() const -> type_t
+{
+  return node_ ? type_t(node_->type) : sexpr_t::NIL;
+}
+
+
+void sexpr_view_t::check_type(type_t type, char const *what) const
+{
+  if (this->type() != type) {
+    throw std::runtime_error(string_t("Invalid sexpr type - not a ") + what);
+  }
+}
+
+
+bool sexpr_view_t::boolean() const
+{
+  check_type(sexpr_t::BOOLEAN, "boolean");
+  return node_->payload != 0;
+}
+
+
+double sexpr_view_t::number() const
+{
+  if (type() == sexpr_t::INTEGER) {
+    return double(integer());
+  }
+  check_type(sexpr_t::NUMBER, "number");
+  double num;
+  std::memcpy(&num, &node_->payload, sizeof(num));
+  return num;
+}
+
+
+int64_t sexpr_view_t::integer() const
+{
+  check_type(sexpr_t::INTEGER, "integer");
+  return int64_t(node_->payload);
+}
+
+
+string_view_t sexpr_view_t::string() const
+{
+  check_type(sexpr_t::STRING, "string");
+  return string_view_t { data_ + image_header(data_).pool_offset + node_->payload, node_->size };
+}
+
+
+string_view_t sexpr_view_t::symbol_name() const
+{
+  check_type(sexpr_t::SYMBOL, "symbol");
+  image_header_t const &header = image_header(data_);
+  auto const *const symbols = reinterpret_cast<sexpr_image_t::symbol_entry_t const *>(data_ + header.symbol_offset);
+  sexpr_image_t::symbol_entry_t const &entry = symbols[node_->payload];
+  return string_view_t { data_ + header.pool_offset + entry.offset, entry.size };
+}
+
+
+symbol_t sexpr_view_t::symbol() const
+{
+  return symbol_t(symbol_name());
+}
+
+
+auto sexpr_view_t::items() const -> sexpr_image_node_t const *
+{
+  return image_nodes(data_) + node_->payload + offset_;
+}
+
+
+sexpr_view_t sexpr_view_t::item(int index) const
+{
+  check_type(sexpr_t::LIST, "list");
+  if (index < 0) {
+    throw std::runtime_error("Index less than 0 out of bounds");
+  } else if (index >= size()) {
+    throw std::runtime_error("Index greater than length of list out of bounds");
+  }
+  return sexpr_view_t(data_, items() + index, 0);
+}
+
+
+int sexpr_view_t::size() const
+{
+  switch (type()) {
+  case sexpr_t::LIST: return int(node_->size - offset_);
+  case sexpr_t::NIL: return 0;
+  default: return 1;
+  }
+}
+
+
+auto sexpr_view_t::begin() const -> iterator
+{
+  return iterator(data_, type() == sexpr_t::LIST ? items() : nullptr);
+}
+
+
+auto sexpr_view_t::end() const -> iterator
+{
+  return iterator(data_, type() == sexpr_t::LIST ? image_nodes(data_) + node_->payload + node_->size : nullptr);
+}
+
+
+sexpr_view_t sexpr_view_t::car() const
+{
+  if (type() != sexpr_t::LIST || size() < 1) {
+    return sexpr_view_t();
+  }
+  return sexpr_view_t(data_, items(), 0);
+}
+
+
+sexpr_view_t sexpr_view_t::cdr() const
+{
+  if (type() != sexpr_t::LIST || size() <= 1) {
+    return sexpr_view_t();
+  }
+  return sexpr_view_t(data_, node_, offset_ + 1);
+}
+
+
+sexpr_t sexpr_view_t::to_sexpr(sexpr_document_t *document) const
+{
+  struct frame_t
+  {
+    iterator cur;
+    iterator end;
+    list_t items;
+  };
+
+  auto make_atom = [document](sexpr_view_t const &view) -> sexpr_t {
+    switch (view.type()) {
+    case sexpr_t::BOOLEAN: return sexpr_t(view.boolean());
+    case sexpr_t::NUMBER: return sexpr_t(view.number());
+    case sexpr_t::INTEGER: return sexpr_t(view.integer());
+    case sexpr_t::STRING: return document ? document->string(view.string()) : sexpr_t(view.string());
+    case sexpr_t::SYMBOL: return sexpr_t(view.symbol());
+    default: return sexpr_t();
+    }
+  };
+
+  if (type() != sexpr_t::LIST) {
+    return make_atom(*this);
+  }
+
+  std::vector<frame_t> stack;
+  stack.push_back(frame_t { begin(), end(), list_t() });
+
+  for (;;) {
+    frame_t &frame = stack.back();
+    if (frame.cur == frame.end) {
+      sexpr_t list = document ? document->list(std::move(frame.items)) : sexpr_t(std::move(frame.items));
+      stack.pop_back();
+      if (stack.empty()) {
+        return list;
+      }
+      stack.back().items.push_back(std::move(list));
+      continue;
+    }
+
+    sexpr_view_t const item = *frame.cur;
+    ++frame.cur;
+    if (item.type() == sexpr_t::LIST) {
+      stack.push_back(frame_t { item.begin(), item.end(), list_t() });
+    } else {
+      frame.items.push_back(make_atom(item));
+    }
+  }
+}
+
+
+// sexpr_image_t
+
+sexpr_image_t::sexpr_image_t()
+: file_()
+, data_(nullptr)
+, size_(0)
+, nodes_(nullptr)
+, node_count_(0)
+, symbols_(nullptr)
+, symbol_count_(0)
+, pool_(nullptr)
+, pool_size_(0)
+{
+  /* nop */
+}
+
+
+sexpr_image_t::sexpr_image_t(char const *data, std::size_t size)
+: sexpr_image_t()
+{
+  data_ = data;
+  size_ = size;
+  load();
+}
+
+
+sexpr_image_t::~sexpr_image_t() = default;
+
+
+sexpr_image_t::sexpr_image_t(sexpr_image_t &&image)
+: sexpr_image_t()
+{
+  *this = std::move(image);
+}
+
+
+sexpr_image_t &sexpr_image_t::operator = (sexpr_image_t &&image)
+{
+  if (&image != this) {
+    file_ = std::move(image.file_);
+    data_ = image.data_;
+    size_ = image.size_;
+    nodes_ = image.nodes_;
+    node_count_ = image.node_count_;
+    symbols_ = image.symbols_;
+    symbol_count_ = image.symbol_count_;
+    pool_ = image.pool_;
+    pool_size_ = image.pool_size_;
+    image.data_ = nullptr;
+    image.size_ = 0;
+  }
+  return *this;
+}
+
+
+void sexpr_image_t::load()
+{
+  if (size_ < sizeof(image_header_t)) {
+    image_error("too small for a header");
+  } else if (reinterpret_cast<uintptr_t>(data_) % alignof(image_header_t) != 0) {
+    image_error("not aligned to 8 bytes");
+  }
+
+  image_header_t const &header = *reinterpret_cast<image_header_t const *>(data_);
+  if (std::memcmp(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0) {
+    image_error("bad magic");
+  } else if (header.version != IMAGE_VERSION) {
+    image_error("unsupported version");
+  } else if (header.byte_order != IMAGE_BYTE_ORDER) {
+    image_error("written with a different byte order");
+  }
+
+  auto section_fits = [this](uint64_t offset, uint64_t count, uint64_t width) {
+    return offset <= size_ && count <= (size_ - offset) / width && offset % 8 == 0;
+  };
+
+  if (header.node_count == 0 || !section_fits(header.node_offset, header.node_count, sizeof(sexpr_image_node_t))) {
+    image_error("node array out of bounds");
+  } else if (!section_fits(header.symbol_offset, header.symbol_count, sizeof(symbol_entry_t))) {
+    image_error("symbol table out of bounds");
+  } else if (header.pool_offset > size_ || header.pool_size > size_ - header.pool_offset) {
+    image_error("string pool out of bounds");
+  }
+
+  nodes_ = reinterpret_cast<sexpr_image_node_t const *>(data_ + header.node_offset);
+  node_count_ = std::size_t(header.node_count);
+  symbols_ = reinterpret_cast<symbol_entry_t const *>(data_ + header.symbol_offset);
+  symbol_count_ = std::size_t(header.symbol_count);
+  pool_ = data_ + header.pool_offset;
+  pool_size_ = std::size_t(header.pool_size);
+}
+
+
+void sexpr_image_t::verify() const
+{
+  for (std::size_t index = 0; index < symbol_count_; ++index) {
+    if (symbols_[index].offset > pool_size_ || symbols_[index].size >= pool_size_ - symbols_[index].offset) {
+      image_error("symbol name out of bounds");
+    }
+  }
+
+  for (std::size_t index = 0; index < node_count_; ++index) {
+    sexpr_image_node_t const &node = nodes_[index];
+    switch (node.type) {
+    case sexpr_t::SYMBOL:
+      if (node.payload >= symbol_count_) {
+        image_error("symbol index out of bounds");
+      }
+      break;
+    case sexpr_t::STRING:
+      if (node.payload > pool_size_ || node.size >= pool_size_ - node.payload) {
+        image_error("string out of bounds");
+      }
+      break;
+    case sexpr_t::LIST:
+      // Items always follow their list, so walks of a verified image end.
+      if (node.size == 0 || node.payload <= index || node.payload > node_count_ || node.size > node_count_ - node.payload) {
+        image_error("list items out of bounds");
+      }
+      break;
+    case sexpr_t::NUMBER:
+    case sexpr_t::INTEGER:
+    case sexpr_t::BOOLEAN:
+    case sexpr_t::NIL:
+      break;
+    default:
+      image_error("unknown node type");
+    }
+  }
+}
+
+
+sexpr_image_t sexpr_image_t::open(string_t const &path)
+{
+  sexpr_image_t image;
+  image.file_ = mapped_file_t(path);
+  image.data_ = image.file_.data();
+  image.size_ = image.file_.size();
+  image.load();
+  return image;
+}
+
+
+// Image building
+
+/*
+  Nodes are laid out breadth-first: each list's items are given a contiguous
+  run of nodes when the list itself is encoded, and filled in when the list is
+  reached in the pending queue. Symbols are stored once each, keyed by their
+  interned name.
+*/
+string_t build_sexpr_image(sexpr_t const &root)
+{
+  struct pending_t
+  {
+    sexpr_t const *begin;
+    sexpr_t const *end;
+    std::size_t first;
+  };
+
+  struct symbol_entry_t
+  {
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  std::vector<sexpr_image_node_t> nodes;
+  std::vector<pending_t> pending;
+  std::vector<symbol_entry_t> symbols;
+  // Image symbol index + 1 by symbol id, or 0 if not added yet.
+  std::vector<uint32_t> symbol_indices;
+  string_t pool;
+
+  auto add_chars = [&pool](char const *chars, std::size_t size) -> uint64_t {
+    uint64_t const offset = pool.size();
+    pool.append(chars, size);
+    pool.push_back('\0');
+    return offset;
+  };
+
+  auto encode = [&](sexpr_t const &expr) -> sexpr_image_node_t {
+    sexpr_image_node_t node { uint32_t(expr.type()), 0, 0 };
+    switch (expr.type()) {
+    case sexpr_t::BOOLEAN: node.payload = expr.boolean() ? 1 : 0; break;
+    case sexpr_t::NUMBER: {
+        double const num = expr.number();
+        std::memcpy(&node.payload, &num, sizeof(num));
+        break;
+      }
+    case sexpr_t::INTEGER: node.payload = uint64_t(expr.integer()); break;
+    case sexpr_t::STRING: {
+        string_view_t const str = expr.string();
+        node.size = uint32_t(str.size());
+        node.payload = add_chars(str.data(), str.size());
+        break;
+      }
+    case sexpr_t::SYMBOL: {
+        symbol_t const &sym = expr.symbol();
+        if (sym.id() >= symbol_indices.size()) {
+          symbol_indices.resize(std::max<std::size_t>(sym.id() + 1, symbol_t::count()), 0);
+        }
+        uint32_t &slot = symbol_indices[sym.id()];
+        if (slot == 0) {
+          string_t const &name = sym.value();
+          uint64_t const offset = add_chars(name.data(), name.size());
+          symbols.push_back(symbol_entry_t { uint32_t(offset), uint32_t(name.size()) });
+          slot = uint32_t(symbols.size());
+        }
+        node.payload = slot - 1;
+        break;
+      }
+    case sexpr_t::LIST: {
+        std::size_t const first = nodes.size();
+        node.size = uint32_t(expr.size());
+        node.payload = first;
+        nodes.resize(first + std::size_t(expr.size()));
+        pending.push_back(pending_t { expr.begin(), expr.end(), first });
+        break;
+      }
+    case sexpr_t::NIL:
+      break;
+    }
+    return node;
+  };
+
+  nodes.emplace_back();
+  sexpr_image_node_t const root_node = encode(root);
+  nodes[0] = root_node;
+  for (std::size_t next = 0; next < pending.size(); ++next) {
+    pending_t const work = pending[next];
+    std::size_t index = work.first;
+    for (sexpr_t const *item = work.begin; item != work.end; ++item, ++index) {
+      sexpr_image_node_t const node = encode(*item);
+      nodes[index] = node;
+    }
+  }
+
+  if (pool.size() > UINT32_MAX) {
+    throw std::runtime_error("Too many chars for a sexpr image");
+  }
+
+  image_header_t header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  header.version = IMAGE_VERSION;
+  header.byte_order = IMAGE_BYTE_ORDER;
+  header.node_offset = align8(sizeof(header));
+  header.node_count = nodes.size();
+  header.symbol_offset = align8(header.node_offset + nodes.size() * sizeof(sexpr_image_node_t));
+  header.symbol_count = symbols.size();
+  header.pool_offset = align8(header.symbol_offset + symbols.size() * sizeof(symbol_entry_t));
+  header.pool_size = pool.size();
+
+  string_t image(std::size_t(header.pool_offset + header.pool_size), '\0');
+  std::memcpy(&image[0], &header, sizeof(header));
+  std::memcpy(&image[std::size_t(header.node_offset)], nodes.data(), nodes.size() * sizeof(sexpr_image_node_t));
+  if (!symbols.empty()) {
+    std::memcpy(&image[std::size_t(header.symbol_offset)], symbols.data(), symbols.size() * sizeof(symbol_entry_t));
+  }
+  if (!pool.empty()) {
+    std::memcpy(&image[std::size_t(header.pool_offset)], pool.data(), pool.size());
+  }
+  return image;
+}
+
+
+} // namespace scolex
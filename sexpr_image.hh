@@ -0,0 +1,231 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SEXPR_IMAGE_HH__
+#define __SCOLEX_SEXPR_IMAGE_HH__
+
+#include "scolex_config.hh"
+#include "basestream.hh"
+#include "mapped_file.hh"
+#include "sexpr.hh"
+#include "sexpr_document.hh"
+
+#include <iterator>
+#include <stdexcept>
+
+
+namespace scolex
+{
+
+
+class sexpr_image_t;
+
+
+/*==============================================================================
+
+  Sexpr images
+
+  A flat, position-independent encoding of a tree of sexprs meant to be
+  mapped straight into memory and read in place:
+
+    header        magic, version, byte order and the sections' offsets
+    nodes         16 bytes per node, the root first
+    symbols       offset and length of each distinct symbol's name
+    string pool   the chars of every string and symbol name, NUL-terminated
+
+  Every node is a type, a size and a 64-bit payload: a number's bits, an
+  integer, a boolean, a symbol's index in the symbol table, a string's offset in the
+  pool (its size being the string's length), or for a list, the index of its
+  first item (its size being the item count). A list's items are contiguous
+  in the node array. All offsets are relative to the start of the image, so
+  it can be mapped anywhere, and images are only readable on hosts with the
+  byte order they were written with.
+
+==============================================================================*/
+struct sexpr_image_node_t
+{
+  uint32_t type;
+  uint32_t size;
+  uint64_t payload;
+};
+
+
+/*==============================================================================
+
+  sexpr_view_t
+
+  Read-only view of a node in a sexpr_image_t, with the same accessors as
+  sexpr_t. Views are a few words wide, are made and copied without
+  allocating, and are only valid for as long as their image's bytes. They
+  point into the image data rather than at the sexpr_image_t, so they stay
+  valid when the image object is moved. Like sexpr_t, a list view may be a
+  tail of a list, so cdr() doesn't copy anything.
+
+==============================================================================*/
+class sexpr_view_t
+{
+public:
+  using type_t = sexpr_t::type_t;
+
+  class iterator : public std::iterator<std::random_access_iterator_tag, sexpr_view_t const>
+  {
+    char const *data_;
+    sexpr_image_node_t const *node_;
+
+  public:
+    iterator(char const *data, sexpr_image_node_t const *node) : data_(data), node_(node) {}
+
+    sexpr_view_t operator * () const { return sexpr_view_t(data_, node_, 0); }
+    sexpr_view_t operator [] (std::ptrdiff_t index) const { return sexpr_view_t(data_, node_ + index, 0); }
+
+    iterator &operator ++ () { ++node_; return *this; }
+    iterator operator ++ (int) { iterator prev = *this; ++node_; return prev; }
+    iterator &operator -- () { --node_; return *this; }
+    iterator &operator += (std::ptrdiff_t count) { node_ += count; return *this; }
+    iterator operator + (std::ptrdiff_t count) const { return iterator(data_, node_ + count); }
+    std::ptrdiff_t operator - (iterator const &other) const { return node_ - other.node_; }
+
+    bool operator == (iterator const &other) const { return node_ == other.node_; }
+    bool operator != (iterator const &other) const { return node_ != other.node_; }
+    bool operator < (iterator const &other) const { return node_ < other.node_; }
+  };
+
+  // nil view, not belonging to any image.
+  sexpr_view_t() : data_(nullptr), node_(nullptr), offset_(0) {}
+
+  type_t type() const;
+
+  bool boolean() const;
+  double number() const;
+  int64_t integer() const;
+  string_view_t string() const;
+  // The symbol's name, read in place.
+  string_view_t symbol_name() const;
+  // Interns the symbol's name, so unlike the other accessors this may
+  // allocate.
+  symbol_t symbol() const;
+
+  sexpr_view_t item(int index) const;
+  sexpr_view_t operator [] (int index) const { return item(index); }
+  int size() const;
+
+  iterator begin() const;
+  iterator end() const;
+
+  sexpr_view_t car() const;
+  sexpr_view_t cdr() const;
+
+  bool is_nil() const { return type() == sexpr_t::NIL; }
+  // NIL-test.
+  explicit operator bool () const { return !is_nil(); }
+
+  // Builds a sexpr_t equal to this view, in document if it's non-null.
+  sexpr_t to_sexpr(sexpr_document_t *document = nullptr) const;
+
+private:
+  friend class sexpr_image_t;
+
+  // The start of the image, whose header locates its sections.
+  char const *data_;
+  sexpr_image_node_t const *node_;
+  // For lists, the index of the view's first item within the node's items.
+  uint32_t offset_;
+
+  sexpr_view_t(char const *data, sexpr_image_node_t const *node, uint32_t offset)
+  : data_(data), node_(node), offset_(offset)
+  {
+    /* nop */
+  }
+
+  sexpr_image_node_t const *items() const;
+  void check_type(type_t type, char const *what) const;
+};
+
+
+/*==============================================================================
+
+  sexpr_image_t
+
+  A loaded sexpr image. open() maps an image file read-only (or, where mmap
+  isn't available, reads it into memory); the constructor taking a buffer
+  reads an image already in memory without copying it.
+
+  Loading only checks the header and that its sections lie within the image
+  -- nodes aren't decoded or validated until they're read. Call verify() to
+  check every node of an image that isn't trusted.
+
+==============================================================================*/
+class sexpr_image_t
+{
+public:
+  // Image in [data, data + size), which must outlive it and be aligned to 8
+  // bytes.
+  sexpr_image_t(char const *data, std::size_t size);
+  ~sexpr_image_t();
+
+  sexpr_image_t(sexpr_image_t &&image);
+  sexpr_image_t &operator = (sexpr_image_t &&image);
+  sexpr_image_t(sexpr_image_t const &) = delete;
+  sexpr_image_t &operator = (sexpr_image_t const &) = delete;
+
+  // Maps the image file at path. Throws std::runtime_error if the file can't
+  // be opened or isn't an image.
+  static sexpr_image_t open(string_t const &path);
+
+  sexpr_view_t root() const { return sexpr_view_t(data_, nodes_, 0); }
+
+  std::size_t node_count() const { return node_count_; }
+  std::size_t byte_size() const { return size_; }
+
+  // Checks that every node's payload is in bounds. Throws std::runtime_error
+  // if one isn't.
+  void verify() const;
+
+private:
+  friend class sexpr_view_t;
+
+  struct symbol_entry_t
+  {
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  // Holds the image if it was opened from a file; empty if it's borrowed.
+  mapped_file_t file_;
+  char const *data_;
+  std::size_t size_;
+
+  sexpr_image_node_t const *nodes_;
+  std::size_t node_count_;
+  symbol_entry_t const *symbols_;
+  std::size_t symbol_count_;
+  char const *pool_;
+  std::size_t pool_size_;
+
+  sexpr_image_t();
+  void load();
+};
+
+
+// Encodes root as an image.
+string_t build_sexpr_image(sexpr_t const &root);
+
+
+// Writes root as an image to any stream implementing write(int, void const *).
+template <class STREAM>
+void write_sexpr_image(STREAM &stream, sexpr_t const &root)
+{
+  string_t const image = build_sexpr_image(root);
+  if (image.size() > std::size_t(INT32_MAX)) {
+    throw std::runtime_error("sexpr image too large to write in one go");
+  } else if (::scolex::io::write(stream, int(image.size()), image.data()) != int(image.size())) {
+    throw std::runtime_error("Failed to write sexpr image to stream");
+  }
+}
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SEXPR_IMAGE_HH__ include guard */
@@ -0,0 +1,206 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sexpr_index.hh"
+#include "sexpr_walk.hh"
+
+#include <stdexcept>
+
+
+namespace scolex
+{
+
+
+namespace
+{
+
+
+std::vector<sexpr_index_t::posting_t> const empty_postings;
+
+
+} // namespace
+
+
+sexpr_index_t::sexpr_index_t()
+: forms_()
+, free_forms_()
+, lists_()
+, live_(0)
+, path_()
+{
+  /* nop */
+}
+
+
+uint32_t sexpr_index_t::add(sexpr_t form)
+{
+  uint32_t id;
+  if (!free_forms_.empty()) {
+    id = free_forms_.back();
+    free_forms_.pop_back();
+  } else if (forms_.size() < UINT32_MAX) {
+    id = uint32_t(forms_.size());
+    forms_.push_back(form_entry_t { sexpr_t(), std::vector<int>(), std::vector<occurrence_t>(), false });
+  } else {
+    throw std::runtime_error("Too many forms in sexpr index");
+  }
+
+  form_entry_t &entry = forms_[id];
+  entry.form = std::move(form);
+  entry.live = true;
+  ++live_;
+
+  try {
+    // The first item of each list around the current node, so its index is
+    // its distance from the first item of its parent.
+    walk_stack_t<sexpr_t const *> firsts;
+    path_.clear();
+
+    sexpr_walk_t walk { entry.form };
+    while (walk.next()) {
+      sexpr_t const &node = walk.node();
+      switch (walk.event()) {
+      case sexpr_walk_t::ENTER:
+        if (!firsts.empty()) {
+          path_.push_back(int(&node - firsts.top()));
+        }
+        firsts.push(node.begin());
+        if (node.begin()->type() == sexpr_t::SYMBOL) {
+          add_posting(id, node.begin()->symbol(), HEAD);
+        }
+        break;
+
+      case sexpr_walk_t::LEAVE:
+        firsts.pop();
+        if (!firsts.empty()) {
+          path_.pop_back();
+        }
+        break;
+
+      case sexpr_walk_t::LEAF:
+        // Heads were indexed along with their lists.
+        if (node.type() == sexpr_t::SYMBOL && (firsts.empty() || &node != firsts.top())) {
+          if (!firsts.empty()) {
+            path_.push_back(int(&node - firsts.top()));
+          }
+          add_posting(id, node.symbol(), ARGUMENT);
+          if (!firsts.empty()) {
+            path_.pop_back();
+          }
+        }
+        break;
+      }
+    }
+  } catch (...) {
+    remove(id);
+    throw;
+  }
+
+  return id;
+}
+
+
+void sexpr_index_t::add_posting(uint32_t form, symbol_t const &sym, role_t role)
+{
+  form_entry_t &entry = forms_[form];
+  std::vector<posting_list_t> &lists = lists_[role];
+  if (sym.id() >= lists.size()) {
+    lists.resize(std::size_t(sym.id()) + 1);
+  }
+
+  // Grow both of the list's vectors up front, so that once the occurrence
+  // is recorded, adding the posting can't fail.
+  posting_list_t &list = lists[sym.id()];
+  if (list.postings.size() == list.postings.capacity()) {
+    std::size_t const capacity = list.postings.empty() ? 4 : list.postings.size() * 2;
+    list.postings.reserve(capacity);
+    list.occurrences.reserve(capacity);
+  }
+
+  uint32_t const path = uint32_t(entry.paths.size());
+  entry.paths.insert(entry.paths.end(), path_.begin(), path_.end());
+  entry.occurrences.push_back(occurrence_t { sym.id(), uint32_t(role), uint32_t(list.postings.size()) });
+
+  list.postings.push_back(posting_t { form, path, uint32_t(path_.size()) });
+  list.occurrences.push_back(uint32_t(entry.occurrences.size() - 1));
+}
+
+
+void sexpr_index_t::remove(uint32_t form)
+{
+  if (!contains(form)) {
+    throw std::runtime_error("No such form in sexpr index");
+  }
+
+  form_entry_t &entry = forms_[form];
+  for (occurrence_t const &occurrence : entry.occurrences) {
+    posting_list_t &list = lists_[occurrence.role][occurrence.symbol];
+    std::size_t const last = list.postings.size() - 1;
+    if (occurrence.slot != last) {
+      posting_t const moved = list.postings[last];
+      uint32_t const moved_occurrence = list.occurrences[last];
+      list.postings[occurrence.slot] = moved;
+      list.occurrences[occurrence.slot] = moved_occurrence;
+      forms_[moved.form].occurrences[moved_occurrence].slot = occurrence.slot;
+    }
+    list.postings.pop_back();
+    list.occurrences.pop_back();
+  }
+
+  entry.form = sexpr_t();
+  entry.paths.clear();
+  entry.occurrences.clear();
+  entry.live = false;
+  --live_;
+  free_forms_.push_back(form);
+}
+
+
+bool sexpr_index_t::contains(uint32_t form) const
+{
+  return form < forms_.size() && forms_[form].live;
+}
+
+
+auto sexpr_index_t::entry(uint32_t form) const -> form_entry_t const &
+{
+  if (!contains(form)) {
+    throw std::runtime_error("No such form in sexpr index");
+  }
+  return forms_[form];
+}
+
+
+sexpr_t const &sexpr_index_t::form(uint32_t form) const
+{
+  return entry(form).form;
+}
+
+
+auto sexpr_index_t::postings(symbol_t const &sym, role_t role) const -> std::vector<posting_t> const &
+{
+  std::vector<posting_list_t> const &lists = lists_[role];
+  return sym.id() < lists.size() ? lists[sym.id()].postings : empty_postings;
+}
+
+
+auto sexpr_index_t::path(posting_t const &posting) const -> path_t
+{
+  int const *const first = entry(posting.form).paths.data() + posting.path;
+  return path_t { first, first + posting.depth };
+}
+
+
+sexpr_t const &sexpr_index_t::node(posting_t const &posting) const
+{
+  sexpr_t const *node = &entry(posting.form).form;
+  for (int const index : path(posting)) {
+    node = &node->item(index);
+  }
+  return *node;
+}
+
+
+} // namespace scolex
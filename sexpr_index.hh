@@ -0,0 +1,139 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SEXPR_INDEX_HH__
+#define __SCOLEX_SEXPR_INDEX_HH__
+
+#include "scolex_config.hh"
+#include "sexpr.hh"
+
+#include <vector>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  sexpr_index_t
+
+  Inverted index of the symbols in a forest of top-level forms: for each
+  symbol, a posting list of where it occurs as the head of a list and another
+  of where it occurs anywhere else, as an argument. Queries like "every form
+  headed by quote" read a posting list instead of scanning every form.
+
+  Forms are added one at a time, each getting an id that stays valid until
+  it's removed, after which the id may be handed out again. The index keeps
+  a copy of each form, which shares the form's items rather than copying
+  them.
+
+  A posting is a form id and the path from the form to the occurrence: for
+  a head, the list it heads; for an argument, the symbol itself. A path is
+  the item index taken at each level down from the form, so the path of the
+  form itself is empty. Posting lists aren't in any particular order --
+  removing a form fills each of its postings' places with the last posting
+  in the list -- and adding or removing a form costs time in proportion to
+  its size, not the size of the index.
+
+  Any number of threads may look things up at once, but adding or removing
+  a form must exclude lookups.
+
+==============================================================================*/
+class sexpr_index_t
+{
+public:
+  enum role_t : int { HEAD, ARGUMENT };
+
+  struct posting_t
+  {
+    uint32_t form;
+    // Offset of the path in the form's paths; see path().
+    uint32_t path;
+    // The path's length, so postings can be told apart by depth -- 0 for a
+    // form's own head -- without reading their paths.
+    uint32_t depth;
+  };
+
+  struct path_t
+  {
+    int const *first;
+    int const *last;
+
+    int const *begin() const { return first; }
+    int const *end() const { return last; }
+    std::size_t size() const { return std::size_t(last - first); }
+    bool empty() const { return first == last; }
+  };
+
+  sexpr_index_t();
+
+  // Indexes form, returning its id.
+  uint32_t add(sexpr_t form);
+  // Removes the form with the given id and its postings. Throws
+  // std::runtime_error if there's no such form.
+  void remove(uint32_t form);
+
+  bool contains(uint32_t form) const;
+  // Throws std::runtime_error if there's no such form.
+  sexpr_t const &form(uint32_t form) const;
+  // The number of forms in the index.
+  std::size_t size() const { return live_; }
+
+  // Where sym occurs in the given role. References are invalidated by add()
+  // and remove().
+  std::vector<posting_t> const &postings(symbol_t const &sym, role_t role) const;
+  std::vector<posting_t> const &heads(symbol_t const &sym) const { return postings(sym, HEAD); }
+  std::vector<posting_t> const &arguments(symbol_t const &sym) const { return postings(sym, ARGUMENT); }
+
+  // The posting's path, valid until its form is removed.
+  path_t path(posting_t const &posting) const;
+  // The sexpr at the posting's path: the headed list or the argument.
+  sexpr_t const &node(posting_t const &posting) const;
+
+private:
+  // Where one of a form's postings is, so it can be found when the form is
+  // removed.
+  struct occurrence_t
+  {
+    uint32_t symbol;
+    uint32_t role;
+    uint32_t slot;
+  };
+
+  struct form_entry_t
+  {
+    sexpr_t form;
+    // The indices of each of the form's paths, one path after another.
+    std::vector<int> paths;
+    std::vector<occurrence_t> occurrences;
+    bool live;
+  };
+
+  // A symbol's postings in one role, alongside the index of each posting's
+  // occurrence in its form.
+  struct posting_list_t
+  {
+    std::vector<posting_t> postings;
+    std::vector<uint32_t> occurrences;
+  };
+
+  std::vector<form_entry_t> forms_;
+  std::vector<uint32_t> free_forms_;
+  // By role, then symbol id.
+  std::vector<posting_list_t> lists_[2];
+  std::size_t live_;
+
+  // The path to the node being indexed, reused between add()s.
+  std::vector<int> path_;
+
+  form_entry_t const &entry(uint32_t form) const;
+  void add_posting(uint32_t form, symbol_t const &sym, role_t role);
+};
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SEXPR_INDEX_HH__ include guard */
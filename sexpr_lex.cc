@@ -0,0 +1,77 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sexpr_lex.hh"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+
+namespace scolex
+{
+
+
+namespace lex
+{
+
+
+int format_integer(char *buffer, int64_t value)
+{
+  uint64_t magnitude = value < 0 ? 0 - uint64_t(value) : uint64_t(value);
+  char digits[20];
+  int count = 0;
+  do {
+    digits[count++] = char('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude);
+
+  int length = 0;
+  if (value < 0) {
+    buffer[length++] = '-';
+  }
+  while (count > 0) {
+    buffer[length++] = digits[--count];
+  }
+  buffer[length] = '\0';
+  return length;
+}
+
+
+// Integers that a double holds exactly are formatted by hand, skipping
+// printf.
+int format_number(char *buffer, std::size_t size, double num)
+{
+  double const max_exact = 9007199254740992.0; // 2^53
+  int length = 0;
+  if (std::isnan(num)) {
+    std::memcpy(buffer, NAN_NAME, NON_FINITE_LENGTH + 1);
+    return NON_FINITE_LENGTH;
+  } else if (std::isinf(num)) {
+    std::memcpy(buffer, num < 0 ? NEGATIVE_INFINITY_NAME : INFINITY_NAME, NON_FINITE_LENGTH + 1);
+    return NON_FINITE_LENGTH;
+  } else if (num > -max_exact && num < max_exact && num == double(int64_t(num)) && !(num == 0 && std::signbit(num))) {
+    length = format_integer(buffer, int64_t(num));
+  } else {
+    for (int precision = 15; precision <= 17; ++precision) {
+      length = std::snprintf(buffer, size, "%.*g", precision, num);
+      if (std::strtod(buffer, nullptr) == num) {
+        break;
+      }
+    }
+  }
+
+  if (std::strspn(buffer, "-0123456789") == std::size_t(length)) {
+    std::memcpy(buffer + length, ".0", 3);
+    length += 2;
+  }
+  return length;
+}
+
+
+} // namespace lex
+
+
+} // namespace scolex
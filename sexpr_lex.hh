@@ -0,0 +1,199 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SEXPR_LEX_HH__
+#define __SCOLEX_SEXPR_LEX_HH__
+
+#include "scolex_config.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  scolex::lex
+
+  Character classes and token rules of the sexpr text syntax, shared by the
+  readers that tokenize it (sexpr_reader_t and sexpr_push_parser_t), the
+  scanners that skip over it, and the printers that write numbers into it
+  (operator << and sexpr_writer_t), so that they all agree on where tokens
+  end and how numbers are spelled. Internal to the library.
+
+==============================================================================*/
+namespace lex
+{
+
+
+enum : unsigned char
+{
+  CHAR_SPACE = 0x1,
+  // Ends a symbol, number or # token.
+  CHAR_DELIMITER = 0x2,
+};
+
+
+constexpr unsigned char classify(int c)
+{
+  return
+    (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v')
+      ? (CHAR_SPACE | CHAR_DELIMITER)
+      : (c == '(' || c == ')' || c == '"' || c == ';' || c == '\'')
+        ? CHAR_DELIMITER
+        : 0;
+}
+
+
+#define SCOLEX_CLASSIFY4(N) classify(N), classify(N + 1), classify(N + 2), classify(N + 3)
+#define SCOLEX_CLASSIFY16(N) SCOLEX_CLASSIFY4(N), SCOLEX_CLASSIFY4(N + 4), SCOLEX_CLASSIFY4(N + 8), SCOLEX_CLASSIFY4(N + 12)
+#define SCOLEX_CLASSIFY64(N) SCOLEX_CLASSIFY16(N), SCOLEX_CLASSIFY16(N + 16), SCOLEX_CLASSIFY16(N + 32), SCOLEX_CLASSIFY16(N + 48)
+
+// Constant-initialized, so it's usable from other static initializers.
+unsigned char const char_classes[256] = {
+  SCOLEX_CLASSIFY64(0), SCOLEX_CLASSIFY64(64), SCOLEX_CLASSIFY64(128), SCOLEX_CLASSIFY64(192)
+};
+
+#undef SCOLEX_CLASSIFY64
+#undef SCOLEX_CLASSIFY16
+#undef SCOLEX_CLASSIFY4
+
+
+// The UTF-8 byte order mark, skipped at the very start of the input.
+unsigned char const BOM[3] { 0xEF, 0xBB, 0xBF };
+int const BOM_LENGTH = 3;
+
+
+inline bool is_space(char c)
+{
+  return char_classes[(unsigned char)c] & CHAR_SPACE;
+}
+
+
+inline bool is_delimiter(char c)
+{
+  return char_classes[(unsigned char)c] & CHAR_DELIMITER;
+}
+
+
+inline bool is_digit(char c)
+{
+  return '0' <= c && c <= '9';
+}
+
+
+// Whether a token should be tried as a number before falling back to a
+// symbol: it starts with a digit, or a sign and/or '.' followed by one.
+inline bool looks_numeric(char const *begin, char const *end)
+{
+  if (begin != end && (*begin == '-' || *begin == '+')) {
+    ++begin;
+  }
+  if (begin != end && *begin == '.') {
+    ++begin;
+  }
+  return begin != end && is_digit(*begin);
+}
+
+
+// Parses a token of an optional sign and only digits as an integer. Returns
+// false for anything else, including integers that don't fit in an int64_t,
+// which are left to be read as numbers.
+inline bool parse_integer(char const *begin, char const *end, int64_t &out)
+{
+  bool const negative = begin != end && *begin == '-';
+  if (begin != end && (*begin == '-' || *begin == '+')) {
+    ++begin;
+  }
+  if (begin == end) {
+    return false;
+  }
+
+  uint64_t const limit = negative ? uint64_t(INT64_MAX) + 1 : uint64_t(INT64_MAX);
+  uint64_t value = 0;
+  for (; begin != end; ++begin) {
+    if (!is_digit(*begin)) {
+      return false;
+    }
+    unsigned const digit = unsigned(*begin - '0');
+    if (value > (limit - digit) / 10) {
+      return false;
+    }
+    value = value * 10 + digit;
+  }
+
+  out = negative ? int64_t(0 - value) : int64_t(value);
+  return true;
+}
+
+
+// Spellings of the doubles that aren't finite, which printf would write as
+// inf and nan. Like any token, they're only numbers when they stand alone:
+// +inf.0x is a symbol.
+char const INFINITY_NAME[] = "+inf.0";
+char const NEGATIVE_INFINITY_NAME[] = "-inf.0";
+char const NAN_NAME[] = "+nan.0";
+int const NON_FINITE_LENGTH = 6;
+
+
+// Parses a token spelling an infinity or NaN. -nan.0 is read as NaN too,
+// though it's never written.
+inline bool parse_non_finite(char const *begin, char const *end, double &out)
+{
+  if (end - begin != NON_FINITE_LENGTH || (*begin != '+' && *begin != '-')) {
+    return false;
+  }
+
+  bool const negative = *begin == '-';
+  if (std::memcmp(begin + 1, INFINITY_NAME + 1, NON_FINITE_LENGTH - 1) == 0) {
+    out = negative ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity();
+    return true;
+  } else if (std::memcmp(begin + 1, NAN_NAME + 1, NON_FINITE_LENGTH - 1) == 0) {
+    out = std::numeric_limits<double>::quiet_NaN();
+    return true;
+  }
+  return false;
+}
+
+
+// Enough room for any number or integer format_number() and format_integer()
+// write, with a NUL.
+std::size_t const NUMBER_BUFFER_SIZE = 32;
+
+
+// Formats value into buffer, NUL-terminated. Returns the formatted length.
+int format_integer(char *buffer, int64_t value);
+
+
+// Formats num into buffer, NUL-terminated, with the fewest significant digits
+// (of 15, 16 or 17) that parse back to exactly num. Returns the formatted
+// length. Doubles that would print as plain digits get a ".0" so they read
+// back as numbers rather than integers, and infinities and NaN are spelled
+// as above rather than as printf's inf and nan, which would read back as
+// symbols.
+int format_number(char *buffer, std::size_t size, double num);
+
+
+// Whether [begin, end) starts with a whole byte order mark.
+inline bool has_BOM(char const *begin, char const *end)
+{
+  return end - begin >= BOM_LENGTH &&
+    (unsigned char)begin[0] == BOM[0] &&
+    (unsigned char)begin[1] == BOM[1] &&
+    (unsigned char)begin[2] == BOM[2];
+}
+
+
+} // namespace lex
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SEXPR_LEX_HH__ include guard */
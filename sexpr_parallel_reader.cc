@@ -0,0 +1,197 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sexpr_parallel_reader.hh"
+#include "mapped_file.hh"
+#include "sexpr_lex.hh"
+#include "sexpr_reader.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+
+namespace scolex
+{
+
+
+namespace
+{
+
+
+// Pieces per worker, so that workers finishing early have more to take.
+std::size_t const PIECES_PER_THREAD = 4;
+// Below this, a piece isn't worth handing to another thread.
+std::size_t const MIN_PIECE_SIZE = 256 * 1024;
+
+
+} // namespace
+
+
+std::vector<std::size_t> split_sexpr_forms(char const *begin, char const *end, std::size_t pieces)
+{
+  std::size_t const size = std::size_t(end - begin);
+  std::vector<std::size_t> starts { 0 };
+  if (pieces <= 1 || size == 0) {
+    return starts;
+  }
+
+  long depth = 0;
+  bool in_string = false;
+  bool in_comment = false;
+  // A top-level quote hasn't been followed by its datum yet.
+  bool quote_pending = false;
+  std::size_t next_piece = 1;
+  std::size_t target = size / pieces;
+
+  for (char const *cur = begin; cur != end; ++cur) {
+    char const c = *cur;
+
+    if (in_comment) {
+      in_comment = c != '\n';
+      continue;
+    } else if (in_string) {
+      if (c == '\\') {
+        if (++cur == end) {
+          break;
+        }
+      } else if (c == '"') {
+        in_string = false;
+      }
+      continue;
+    }
+
+    switch (c) {
+    case '"':
+      in_string = true;
+      quote_pending = quote_pending && depth != 0;
+      break;
+    case ';':
+      in_comment = true;
+      break;
+    case '(':
+      quote_pending = quote_pending && depth != 0;
+      ++depth;
+      break;
+    case ')':
+      --depth;
+      break;
+    case '\'':
+      quote_pending = quote_pending || depth == 0;
+      break;
+    default:
+      if (!lex::is_space(c)) {
+        quote_pending = quote_pending && depth != 0;
+      } else if (depth == 0 && !quote_pending && std::size_t(cur - begin) >= target) {
+        starts.push_back(std::size_t(cur - begin));
+        if (++next_piece == pieces) {
+          return starts;
+        }
+        target = size / pieces * next_piece;
+      }
+      break;
+    }
+  }
+
+  return starts;
+}
+
+
+sexpr_forms_t read_sexprs_parallel(char const *begin, char const *end, unsigned threads, parallel_storage_t storage)
+{
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  std::size_t const size = std::size_t(end - begin);
+  std::size_t const pieces = threads == 1
+    ? 1
+    : std::max<std::size_t>(1, std::min<std::size_t>(threads * PIECES_PER_THREAD, size / MIN_PIECE_SIZE));
+  std::vector<std::size_t> const starts = split_sexpr_forms(begin, end, pieces);
+  threads = unsigned(std::min<std::size_t>(threads, starts.size()));
+
+  sexpr_forms_t out;
+  if (storage == PARALLEL_DOCUMENTS) {
+    for (unsigned worker = 0; worker < threads; ++worker) {
+      out.documents.emplace_back(new sexpr_document_t());
+    }
+  }
+
+  // Declared after out, so they're released before its documents.
+  std::vector<list_t> results(starts.size());
+  std::vector<std::exception_ptr> errors(starts.size());
+  std::atomic<std::size_t> next_piece { 0 };
+
+  auto work = [&](unsigned worker) {
+    sexpr_document_t *const document = out.documents.empty() ? nullptr : out.documents[worker].get();
+    for (;;) {
+      std::size_t const piece = next_piece.fetch_add(1, std::memory_order_relaxed);
+      if (piece >= starts.size()) {
+        return;
+      }
+
+      char const *const piece_end = piece + 1 < starts.size() ? begin + starts[piece + 1] : end;
+      try {
+        sexpr_buffer_reader_t reader { begin + starts[piece], piece_end };
+        reader.set_document(document);
+        sexpr_t form;
+        while (reader.read(form)) {
+          results[piece].push_back(std::move(form));
+        }
+      } catch (...) {
+        errors[piece] = std::current_exception();
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned worker = 1; worker < threads; ++worker) {
+    try {
+      workers.emplace_back(work, worker);
+    } catch (std::system_error const &) {
+      // Out of threads: the ones already started pick up the slack.
+      break;
+    }
+  }
+  work(0);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  for (std::size_t piece = 0; piece < errors.size(); ++piece) {
+    if (!errors[piece]) {
+      continue;
+    }
+    try {
+      std::rethrow_exception(errors[piece]);
+    } catch (std::runtime_error const &ex) {
+      throw std::runtime_error(string_t(ex.what()) + " (in the piece starting at byte " + std::to_string(starts[piece]) + ")");
+    }
+  }
+
+  std::size_t form_count = 0;
+  for (list_t const &result : results) {
+    form_count += result.size();
+  }
+  out.forms.reserve(form_count);
+  for (list_t &result : results) {
+    std::move(result.begin(), result.end(), std::back_inserter(out.forms));
+  }
+  return out;
+}
+
+
+sexpr_forms_t read_sexpr_file_parallel(string_t const &path, unsigned threads, parallel_storage_t storage)
+{
+  mapped_file_t const file { path };
+  return read_sexprs_parallel(file.data(), file.data() + file.size(), threads, storage);
+}
+
+
+} // namespace scolex
@@ -0,0 +1,83 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SEXPR_PARALLEL_READER_HH__
+#define __SCOLEX_SEXPR_PARALLEL_READER_HH__
+
+#include "scolex_config.hh"
+#include "sexpr.hh"
+#include "sexpr_document.hh"
+
+#include <memory>
+#include <vector>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  Parallel reading
+
+  Text made of many independent top-level forms can be read on several
+  threads at once: it's cut into pieces at top-level form boundaries, each
+  piece is read by a sexpr_buffer_reader_t on a worker thread, and the forms
+  are put back together in their original order.
+
+  Boundaries are found by a single sequential scan that only tracks parens,
+  strings (and their escapes), comments and quotes -- a fraction of the cost
+  of reading -- and stops as soon as the last boundary is found. A piece
+  always starts at whitespace outside of any form, so a paren in a string or
+  comment never splits a form, and neither does the space in ' x.
+
+  Malformed input throws std::runtime_error, as reading it with a single
+  reader would, though the offset in the message is relative to the start of
+  the piece it's in (which the message also gives).
+
+==============================================================================*/
+
+
+// Where read_sexprs_parallel builds forms.
+enum parallel_storage_t : int
+{
+  // Each form on the heap, as sexpr_reader_t does by default.
+  PARALLEL_HEAP,
+  // In one sexpr_document_t per worker thread.
+  PARALLEL_DOCUMENTS,
+};
+
+
+// Forms read in parallel, along with the documents they were built in, if
+// any. The forms are only valid for as long as the documents.
+struct sexpr_forms_t
+{
+  // Declared before forms so that the forms are released first.
+  std::vector<std::unique_ptr<sexpr_document_t>> documents;
+  list_t forms;
+};
+
+
+// Returns the offsets at which [begin, end) can be cut into at most pieces
+// runs of whole top-level forms of about equal size. The first offset is
+// always 0; fewer offsets are returned if there aren't enough boundaries.
+std::vector<std::size_t> split_sexpr_forms(char const *begin, char const *end, std::size_t pieces);
+
+
+// Reads every top-level form in [begin, end) on threads worker threads (or
+// one per hardware thread if threads is 0), in order. The calling thread is
+// one of the workers.
+sexpr_forms_t read_sexprs_parallel(char const *begin, char const *end,
+  unsigned threads = 0, parallel_storage_t storage = PARALLEL_HEAP);
+
+// Maps the file at path and reads every top-level form in it in parallel.
+// The forms don't refer to the file, which is unmapped before returning.
+sexpr_forms_t read_sexpr_file_parallel(string_t const &path,
+  unsigned threads = 0, parallel_storage_t storage = PARALLEL_HEAP);
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SEXPR_PARALLEL_READER_HH__ include guard */
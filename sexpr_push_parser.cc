@@ -0,0 +1,434 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sexpr_push_parser.hh"
+#include "parse.hh"
+#include "sexpr_lex.hh"
+#include "utf8.hh"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace scolex
+{
+
+
+namespace
+{
+
+
+// Whether [begin, end) decodes as UTF-8. ASCII is skipped a byte at a time
+// without going through the decoder.
+bool is_valid_utf8(char const *begin, char const *end)
+{
+  while (begin != end) {
+    if ((unsigned char)*begin < 0x80) {
+      ++begin;
+    } else if (utf8::next_code(begin, end) == UTF8_INVALID_CODE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+char unescape(char c)
+{
+  switch (c) {
+  case 'n': return '\n';
+  case 'b': return '\b';
+  case 'a': return '\a';
+  case 'r': return '\r';
+  case 't': return '\t';
+  case 'e': return '\x1b';
+  case 'f': return '\f';
+  case 'v': return '\v';
+  case '0': return '\0';
+  default: return c; // \\, \" and unknown escapes stand for the character
+  }
+}
+
+
+string_view_t const QUOTE_NAME { "quote", 5 };
+
+
+} // namespace
+
+
+sexpr_push_parser_t::sexpr_push_parser_t(sexpr_handler_t &handler)
+: handler_(handler)
+, state_(SPACE)
+, validate_utf8_(true)
+, base_(nullptr)
+, cur_(nullptr)
+, end_(nullptr)
+, consumed_(0)
+, at_start_(true)
+, bom_matched_(0)
+, frames_()
+, pending_quotes_(0)
+, pending_open_(false)
+, token_()
+{
+  /* nop */
+}
+
+
+void sexpr_push_parser_t::reset()
+{
+  state_ = SPACE;
+  frames_.clear();
+  pending_quotes_ = 0;
+  pending_open_ = false;
+  token_.clear();
+  at_start_ = true;
+  bom_matched_ = 0;
+}
+
+
+void sexpr_push_parser_t::fail(char const *what) const
+{
+  throw std::runtime_error("sexpr read error at byte " + std::to_string(offset()) + ": " + what);
+}
+
+
+void sexpr_push_parser_t::feed(char const *data, std::size_t size)
+{
+  base_ = cur_ = data;
+  end_ = data + size;
+
+  if (at_start_) {
+    skip_BOM();
+  }
+
+  while (cur_ != end_) {
+    switch (state_) {
+    case COMMENT: {
+        void const *newline = std::memchr(cur_, '\n', size_t(end_ - cur_));
+        if (!newline) {
+          cur_ = end_;
+        } else {
+          cur_ = static_cast<char const *>(newline) + 1;
+          state_ = SPACE;
+        }
+        break;
+      }
+
+    case TOKEN: {
+        char const *const run = cur_;
+        advance_while<false>(cur_, end_, [](char c) { return lex::is_delimiter(c); });
+        token_.append(run, cur_);
+        if (cur_ != end_) {
+          state_ = SPACE;
+          emit_token(token_.data(), token_.data() + token_.size());
+        }
+        break;
+      }
+
+    case STRING:
+    case STRING_ESCAPE:
+      continue_string();
+      break;
+
+    case SPACE:
+      advance_while(cur_, end_, [](char c) { return lex::is_space(c); });
+      if (cur_ == end_) {
+        break;
+      }
+
+      switch (*cur_) {
+      case ';':
+        ++cur_;
+        state_ = COMMENT;
+        break;
+
+      case '(':
+        ++cur_;
+        open_list();
+        break;
+
+      case ')':
+        ++cur_;
+        close_list();
+        break;
+
+      case '\'':
+        ++cur_;
+        quote();
+        break;
+
+      case '"': {
+          // Strings without escapes that end in this chunk are reported
+          // straight from it; anything else is assembled in token_.
+          char const *const run = ++cur_;
+          advance_while<false>(cur_, end_, [](char c) { return c == '"' || c == '\\'; });
+          if (cur_ != end_ && *cur_ == '"') {
+            ++cur_;
+            emit_string(run, cur_ - 1);
+          } else {
+            token_.assign(run, cur_);
+            state_ = STRING;
+            if (cur_ != end_) {
+              ++cur_;
+              state_ = STRING_ESCAPE;
+            }
+          }
+          break;
+        }
+
+      default: {
+          // Likewise, tokens followed by a delimiter in this chunk are
+          // reported in place, and the delimiter keeps strtod from reading
+          // past them.
+          char const *const run = cur_;
+          advance_while<false>(cur_, end_, [](char c) { return lex::is_delimiter(c); });
+          if (cur_ != end_) {
+            emit_token(run, cur_);
+          } else {
+            token_.assign(run, cur_);
+            state_ = TOKEN;
+          }
+          break;
+        }
+      }
+      break;
+    }
+  }
+
+  consumed_ += long(size);
+  base_ = cur_ = end_;
+}
+
+
+void sexpr_push_parser_t::finish()
+{
+  if (at_start_ && bom_matched_ != 0) {
+    // The input was only the start of a byte order mark.
+    resolve_BOM();
+  }
+
+  switch (state_) {
+  case TOKEN:
+    state_ = SPACE;
+    emit_token(token_.data(), token_.data() + token_.size());
+    break;
+  case STRING:
+    fail("unterminated string");
+  case STRING_ESCAPE:
+    fail("unterminated string escape");
+  case COMMENT:
+  case SPACE:
+    state_ = SPACE;
+    break;
+  }
+
+  if (depth() != 0) {
+    fail("unexpected end of input inside a list");
+  }
+}
+
+
+// Skips as much of a byte order mark at the start of the input as the chunk
+// holds. A mark cut off at the end of the chunk is picked up by the next one.
+void sexpr_push_parser_t::skip_BOM()
+{
+  while (cur_ != end_ && bom_matched_ < lex::BOM_LENGTH) {
+    if ((unsigned char)*cur_ != lex::BOM[bom_matched_]) {
+      resolve_BOM();
+      return;
+    }
+    ++cur_;
+    ++bom_matched_;
+  }
+
+  if (bom_matched_ == lex::BOM_LENGTH) {
+    at_start_ = false;
+  }
+}
+
+
+// Ends the search for a byte order mark short of a whole one. The bytes that
+// matched so far are the start of a token.
+void sexpr_push_parser_t::resolve_BOM()
+{
+  at_start_ = false;
+  if (bom_matched_ != 0) {
+    token_.assign(reinterpret_cast<char const *>(lex::BOM), bom_matched_);
+    state_ = TOKEN;
+  }
+}
+
+
+// Reads the rest of a string from the chunk, reporting it and returning true
+// if it ends there.
+bool sexpr_push_parser_t::continue_string()
+{
+  for (;;) {
+    if (state_ == STRING_ESCAPE) {
+      if (cur_ == end_) {
+        return false;
+      }
+      token_.push_back(unescape(*cur_++));
+      state_ = STRING;
+    }
+
+    char const *const run = cur_;
+    advance_while<false>(cur_, end_, [](char c) { return c == '"' || c == '\\'; });
+    token_.append(run, cur_);
+
+    if (cur_ == end_) {
+      return false;
+    } else if (*cur_++ == '"') {
+      state_ = SPACE;
+      emit_string(token_.data(), token_.data() + token_.size());
+      return true;
+    }
+    state_ = STRING_ESCAPE;
+  }
+}
+
+
+void sexpr_push_parser_t::open_list()
+{
+  // A paren already waiting has something in it now, so it's a list.
+  if (pending_open_) {
+    flush_pending();
+  }
+  pending_open_ = true;
+}
+
+
+void sexpr_push_parser_t::close_list()
+{
+  if (pending_open_) {
+    // () is nil, and so is any number of quotes of it.
+    pending_open_ = false;
+    pending_quotes_ = 0;
+    handler_.nil();
+    end_datum();
+    return;
+  } else if (pending_quotes_ != 0 || frames_.empty()) {
+    fail("unexpected ')'");
+  }
+
+  frames_.pop_back();
+  handler_.end_list();
+  end_datum();
+}
+
+
+void sexpr_push_parser_t::quote()
+{
+  if (pending_open_) {
+    flush_pending();
+  }
+  ++pending_quotes_;
+}
+
+
+// Reports the lists and quotes waiting on the datum about to be reported.
+void sexpr_push_parser_t::flush_pending()
+{
+  for (; pending_quotes_ != 0; --pending_quotes_) {
+    frames_.push_back(QUOTE_FRAME);
+    handler_.begin_list();
+    handler_.symbol(QUOTE_NAME);
+  }
+
+  if (pending_open_) {
+    pending_open_ = false;
+    frames_.push_back(LIST_FRAME);
+    handler_.begin_list();
+  }
+}
+
+
+// Closes the quotes a datum that was just reported completes, and the form if
+// it's at the top level.
+void sexpr_push_parser_t::end_datum()
+{
+  while (!frames_.empty() && frames_.back() == QUOTE_FRAME) {
+    frames_.pop_back();
+    handler_.end_list();
+  }
+
+  if (frames_.empty()) {
+    handler_.end_form();
+  }
+}
+
+
+void sexpr_push_parser_t::emit_string(char const *begin, char const *end)
+{
+  if (validate_utf8_ && !is_valid_utf8(begin, end)) {
+    fail("string is not valid UTF-8");
+  }
+  flush_pending();
+  handler_.string(string_view_t { begin, size_t(end - begin) });
+  end_datum();
+}
+
+
+// Reports a symbol, number or # token. The token must be followed by a char
+// that can't continue a number.
+void sexpr_push_parser_t::emit_token(char const *begin, char const *end)
+{
+  size_t const length = size_t(end - begin);
+
+  if (*begin == '#') {
+    bool value;
+    if ((length == 3 && std::memcmp(begin, "#!t", 3) == 0) ||
+        (length == 2 && std::memcmp(begin, "#t", 2) == 0)) {
+      value = true;
+    } else if ((length == 3 && std::memcmp(begin, "#!f", 3) == 0) ||
+        (length == 2 && std::memcmp(begin, "#f", 2) == 0)) {
+      value = false;
+    } else {
+      fail("unrecognized # syntax");
+    }
+    flush_pending();
+    handler_.boolean(value);
+    end_datum();
+    return;
+  }
+
+  if (lex::looks_numeric(begin, end)) {
+    int64_t integer;
+    if (lex::parse_integer(begin, end, integer)) {
+      flush_pending();
+      handler_.integer(integer);
+      end_datum();
+      return;
+    }
+    char *number_end = nullptr;
+    double const number = std::strtod(begin, &number_end);
+    if (number_end == end) {
+      flush_pending();
+      handler_.number(number);
+      end_datum();
+      return;
+    }
+  } else {
+    double number;
+    if (lex::parse_non_finite(begin, end, number)) {
+      flush_pending();
+      handler_.number(number);
+      end_datum();
+      return;
+    }
+  }
+
+  if (validate_utf8_ && !is_valid_utf8(begin, end)) {
+    fail("symbol is not valid UTF-8");
+  }
+  flush_pending();
+  handler_.symbol(string_view_t { begin, length });
+  end_datum();
+}
+
+
+} // namespace scolex
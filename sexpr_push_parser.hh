@@ -0,0 +1,158 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SEXPR_PUSH_PARSER_HH__
+#define __SCOLEX_SEXPR_PUSH_PARSER_HH__
+
+#include "scolex_config.hh"
+#include "string_view.hh"
+
+#include <vector>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  sexpr_handler_t
+
+  Receives the events of a sexpr_push_parser_t. Every event does nothing by
+  default, so handlers only override what they care about. The views passed
+  to symbol() and string() are only valid for the duration of the call.
+
+  A form is reported as it's read, in order: (a "b" 1) is begin_list(),
+  symbol("a"), string("b"), integer(1), end_list(), and then end_form(),
+  since it's at the top level. Events match the tree sexpr_reader_t would build:
+  'x is reported as the list (quote x), and () and '() are both reported as
+  nil().
+
+==============================================================================*/
+class sexpr_handler_t
+{
+public:
+  virtual ~sexpr_handler_t() = default;
+
+  virtual void begin_list() { /* nop */ }
+  virtual void end_list() { /* nop */ }
+  virtual void nil() { /* nop */ }
+  virtual void symbol(string_view_t name) { (void)name; }
+  virtual void string(string_view_t str) { (void)str; }
+  virtual void number(double num) { (void)num; }
+  // Integers go to number() unless this is overridden.
+  virtual void integer(int64_t num) { number(double(num)); }
+  virtual void boolean(bool value) { (void)value; }
+
+  // Called once each top-level form is complete.
+  virtual void end_form() { /* nop */ }
+};
+
+
+/*==============================================================================
+
+  sexpr_push_parser_t
+
+  Parses the same text as sexpr_reader_t, but is fed input rather than
+  pulling it, and reports what it reads to a sexpr_handler_t instead of
+  building sexprs. Input may be split into chunks anywhere -- mid-token,
+  mid-string, mid-escape -- so it can be fed bytes as they arrive; tokens
+  that fit in a chunk are reported straight out of it, and only tokens that
+  span chunks are copied. Memory use is bounded by the nesting depth and the
+  longest token, not the size of the input.
+
+  Symbols and strings are checked against utf8.hh's decoding rules unless
+  that's turned off with set_validate_utf8(false). A UTF-8 byte order mark
+  at the start of the input is skipped, as sexpr_reader_t does, even if it's
+  split across chunks; reset() starts new input, which may have its own.
+
+  Malformed input throws std::runtime_error, from either feed() or finish(),
+  after which the parser must be reset() before being fed again.
+
+==============================================================================*/
+class sexpr_push_parser_t
+{
+public:
+  explicit sexpr_push_parser_t(sexpr_handler_t &handler);
+
+  // Parses the next size bytes of input.
+  void feed(char const *data, std::size_t size);
+  void feed(string_view_t data) { feed(data.data(), data.size()); }
+
+  // Ends the input, reporting any token it cut off. Throws if it ends inside
+  // a list or string.
+  void finish();
+
+  // Discards any partially read form so the parser can start on new input.
+  void reset();
+
+  // Whether to check that symbols and strings are valid UTF-8 (the default).
+  void set_validate_utf8(bool validate) { validate_utf8_ = validate; }
+
+  // Number of bytes of input consumed so far.
+  long offset() const { return consumed_ + long(cur_ - base_); }
+
+  // Number of lists (including quotes) currently open.
+  int depth() const { return int(frames_.size()) + int(pending_quotes_) + (pending_open_ ? 1 : 0); }
+
+private:
+  enum state_t : int
+  {
+    // Between tokens.
+    SPACE,
+    COMMENT,
+    // Inside a symbol, number or # token, whose start is in token_.
+    TOKEN,
+    // Inside a string, whose chars so far are in token_.
+    STRING,
+    // After a backslash in a string.
+    STRING_ESCAPE,
+  };
+
+  enum frame_t : unsigned char { LIST_FRAME, QUOTE_FRAME };
+
+  sexpr_handler_t &handler_;
+  state_t state_;
+  bool validate_utf8_;
+
+  char const *base_;
+  char const *cur_;
+  char const *end_;
+  long consumed_;
+  // Whether a byte order mark may still be skipped, and how many of its bytes
+  // have been seen.
+  bool at_start_;
+  int bom_matched_;
+
+  // Lists and quotes whose begin_list() has been reported.
+  std::vector<frame_t> frames_;
+  // Quotes and an open paren that haven't been reported yet, since until the
+  // next token it's not known whether they're nil. The open paren, if any,
+  // comes after the quotes.
+  unsigned pending_quotes_;
+  bool pending_open_;
+
+  string_t token_;
+
+  void open_list();
+  void close_list();
+  void quote();
+  void flush_pending();
+  void end_datum();
+
+  void skip_BOM();
+  void resolve_BOM();
+
+  bool continue_string();
+  void emit_string(char const *begin, char const *end);
+  void emit_token(char const *begin, char const *end);
+
+  [[noreturn]] void fail(char const *what) const;
+};
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SEXPR_PUSH_PARSER_HH__ include guard */
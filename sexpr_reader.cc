@@ -0,0 +1,374 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sexpr_reader.hh"
+#include "sexpr_lex.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace scolex
+{
+
+
+namespace
+{
+
+
+symbol_t const &quote_symbol()
+{
+  static symbol_t const sym { "quote" };
+  return sym;
+}
+
+
+} // namespace
+
+
+sexpr_reader_base_t::sexpr_reader_base_t(int chunk_size)
+: buffer_(size_t(chunk_size > 0 ? std::max<int>(chunk_size, lex::BOM_LENGTH) : DEFAULT_CHUNK_SIZE))
+, base_(buffer_.data())
+, cur_(base_)
+, end_(base_)
+, consumed_(0)
+, at_end_(false)
+, stack_()
+, depth_(0)
+, token_()
+, document_(nullptr)
+{
+  /* nop */
+}
+
+
+sexpr_reader_base_t::sexpr_reader_base_t(char const *begin, char const *end)
+: buffer_()
+, base_(begin)
+, cur_(begin)
+, end_(end)
+, consumed_(0)
+, at_end_(false)
+, stack_()
+, depth_(0)
+, token_()
+, document_(nullptr)
+{
+  if (lex::has_BOM(cur_, end_)) {
+    cur_ += lex::BOM_LENGTH;
+  }
+}
+
+
+bool sexpr_reader_base_t::fill()
+{
+  if (at_end_) {
+    return false;
+  }
+
+  // Nothing has been read into the buffer before the first fill.
+  bool const first = end_ == buffer_.data() && consumed_ == 0;
+  consumed_ += long(cur_ - base_);
+
+  int const capacity = int(buffer_.size());
+  int count = buffer_.empty() ? 0 : refill(buffer_.data(), capacity);
+  if (count <= 0) {
+    at_end_ = true;
+    base_ = cur_ = end_;
+    return false;
+  }
+
+  base_ = cur_ = buffer_.data();
+
+  if (first) {
+    // Top up a short first chunk so a byte order mark can't be split across
+    // chunks, then skip it.
+    while (count < lex::BOM_LENGTH) {
+      int const more = refill(buffer_.data() + count, capacity - count);
+      if (more <= 0) {
+        break;
+      }
+      count += more;
+    }
+    if (lex::has_BOM(cur_, cur_ + count)) {
+      cur_ += lex::BOM_LENGTH;
+    }
+  }
+
+  end_ = base_ + count;
+  return true;
+}
+
+
+void sexpr_reader_base_t::push_frame(bool quote)
+{
+  if (depth_ == stack_.size()) {
+    stack_.emplace_back();
+  }
+
+  frame_t &frame = stack_[depth_++];
+  frame.items.clear();
+  frame.quote = quote;
+}
+
+
+void sexpr_reader_base_t::fail(char const *what) const
+{
+  throw std::runtime_error("sexpr read error at byte " + std::to_string(offset()) + ": " + what);
+}
+
+
+bool sexpr_reader_base_t::skip_space()
+{
+  bool in_comment = false;
+
+  for (;;) {
+    while (cur_ != end_) {
+      if (in_comment) {
+        void const *newline = std::memchr(cur_, '\n', size_t(end_ - cur_));
+        if (!newline) {
+          cur_ = end_;
+          break;
+        }
+        cur_ = static_cast<char const *>(newline) + 1;
+        in_comment = false;
+      } else if (lex::is_space(*cur_)) {
+        ++cur_;
+      } else if (*cur_ == ';') {
+        in_comment = true;
+      } else {
+        return true;
+      }
+    }
+
+    if (!fill()) {
+      return false;
+    }
+  }
+}
+
+
+// Consumes a token and returns a pointer to its first character, storing the
+// end of the token in token_end. If the token lies entirely in the buffer and
+// is followed by a delimiter, it is returned in place; otherwise it spans
+// chunks (or ends the input) and is assembled in token_. Either way the token
+// is followed by a character that can't continue a number.
+char const *sexpr_reader_base_t::scan_token(char const *&token_end)
+{
+  char const *start = cur_;
+  while (cur_ != end_ && !lex::is_delimiter(*cur_)) {
+    ++cur_;
+  }
+
+  if (cur_ != end_) {
+    token_end = cur_;
+    return start;
+  }
+
+  token_.assign(start, cur_);
+  while (fill()) {
+    start = cur_;
+    while (cur_ != end_ && !lex::is_delimiter(*cur_)) {
+      ++cur_;
+    }
+    token_.append(start, cur_);
+    if (cur_ != end_) {
+      break;
+    }
+  }
+
+  token_end = token_.data() + token_.size();
+  return token_.data();
+}
+
+
+sexpr_t sexpr_reader_base_t::make_string(char const *begin, char const *end)
+{
+  string_view_t const str { begin, size_t(end - begin) };
+  return document_ ? document_->string(str) : sexpr_t(str);
+}
+
+
+sexpr_t sexpr_reader_base_t::read_string()
+{
+  char const *run = cur_;
+  while (cur_ != end_ && *cur_ != '"' && *cur_ != '\\') {
+    ++cur_;
+  }
+
+  // Strings without escapes that end in this chunk are built straight from
+  // the buffer; anything else is assembled in token_.
+  if (cur_ != end_ && *cur_ == '"') {
+    ++cur_;
+    return make_string(run, cur_ - 1);
+  }
+
+  token_.assign(run, cur_);
+
+  for (;;) {
+    if (cur_ == end_) {
+      if (!fill()) {
+        fail("unterminated string");
+      }
+    } else if (*cur_ == '"') {
+      ++cur_;
+      return make_string(token_.data(), token_.data() + token_.size());
+    } else {
+      ++cur_;
+      if (cur_ == end_ && !fill()) {
+        fail("unterminated string escape");
+      }
+
+      char c = *cur_++;
+      switch (c) {
+      case 'n': c = '\n'; break;
+      case 'b': c = '\b'; break;
+      case 'a': c = '\a'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+      case 'e': c = '\x1b'; break;
+      case 'f': c = '\f'; break;
+      case 'v': c = '\v'; break;
+      case '0': c = '\0'; break;
+      default: break; // \\, \" and unknown escapes stand for the character
+      }
+      token_.push_back(c);
+    }
+
+    run = cur_;
+    while (cur_ != end_ && *cur_ != '"' && *cur_ != '\\') {
+      ++cur_;
+    }
+    token_.append(run, cur_);
+  }
+}
+
+
+sexpr_t sexpr_reader_base_t::read_hash()
+{
+  char const *end = nullptr;
+  char const *start = scan_token(end);
+  size_t const length = size_t(end - start);
+
+  if ((length == 3 && std::memcmp(start, "#!t", 3) == 0) ||
+      (length == 2 && std::memcmp(start, "#t", 2) == 0)) {
+    return sexpr_t(true);
+  } else if ((length == 3 && std::memcmp(start, "#!f", 3) == 0) ||
+      (length == 2 && std::memcmp(start, "#f", 2) == 0)) {
+    return sexpr_t(false);
+  }
+
+  fail("unrecognized # syntax");
+}
+
+
+sexpr_t sexpr_reader_base_t::read_atom()
+{
+  char const *end = nullptr;
+  char const *start = scan_token(end);
+
+  if (lex::looks_numeric(start, end)) {
+    int64_t integer;
+    if (lex::parse_integer(start, end, integer)) {
+      return sexpr_t(integer);
+    }
+    char *number_end = nullptr;
+    double const number = std::strtod(start, &number_end);
+    if (number_end == end) {
+      return sexpr_t(number);
+    }
+  } else {
+    double number;
+    if (lex::parse_non_finite(start, end, number)) {
+      return sexpr_t(number);
+    }
+  }
+
+  return sexpr_t(symbol_t(start, std::size_t(end - start)));
+}
+
+
+bool sexpr_reader_base_t::read(sexpr_t &out)
+{
+  depth_ = 0;
+
+  for (;;) {
+    if (!skip_space()) {
+      if (depth_ != 0) {
+        fail("unexpected end of input inside a list");
+      }
+      return false;
+    }
+
+    sexpr_t value;
+
+    switch (*cur_) {
+    case '(':
+      ++cur_;
+      push_frame(false);
+      continue;
+
+    case '\'':
+      ++cur_;
+      push_frame(true);
+      continue;
+
+    case ')':
+      if (depth_ == 0 || stack_[depth_ - 1].quote) {
+        fail("unexpected ')'");
+      }
+      ++cur_;
+      --depth_;
+      if (document_) {
+        value = document_->list(std::move(stack_[depth_].items));
+      } else {
+        value = sexpr_t(std::move(stack_[depth_].items));
+      }
+      break;
+
+    case '"':
+      ++cur_;
+      value = read_string();
+      break;
+
+    case '#':
+      value = read_hash();
+      break;
+
+    default:
+      value = read_atom();
+      break;
+    }
+
+    // Hand the value to the innermost open list, closing any quotes waiting
+    // on it along the way. '() is nil rather than (quote ()).
+    for (;;) {
+      if (depth_ == 0) {
+        out = std::move(value);
+        return true;
+      }
+
+      frame_t &top = stack_[depth_ - 1];
+      if (!top.quote) {
+        top.items.push_back(std::move(value));
+        break;
+      }
+
+      --depth_;
+      if (value.is_nil()) {
+        continue;
+      } else if (document_) {
+        value = document_->list({ sexpr_t(quote_symbol()), std::move(value) });
+      } else {
+        value = sexpr_t { quote_symbol(), std::move(value) };
+      }
+    }
+  }
+}
+
+
+} // namespace scolex
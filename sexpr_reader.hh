@@ -0,0 +1,188 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SEXPR_READER_HH__
+#define __SCOLEX_SEXPR_READER_HH__
+
+#include "scolex_config.hh"
+#include "basestream.hh"
+#include "sexpr.hh"
+#include "sexpr_document.hh"
+
+#include <vector>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  sexpr_reader_base_t
+
+  Reads sexprs from text in the form written by operator << (sexpr_t):
+
+    #!t #!f           booleans (#t and #f are accepted too)
+    -2 42             integers, if they fit in an int64_t
+    1.5 2.0 3e+06     numbers, and integers too big to be int64_ts
+    +inf.0 -inf.0     infinities
+    +nan.0            NaN (-nan.0 is accepted too)
+    "a\n\"b\""        strings, with the same escapes the printer writes
+    foo +             symbols
+    (a b c)           lists
+    '() ()            nil
+    'x                (quote x)
+    ; ...             comments, to the end of the line
+
+  Text is consumed a chunk at a time from a buffer; the stream (or whatever
+  backs the reader) is only asked for more when the buffer runs dry, so a
+  chunk is tokenized with plain pointer scans. Nesting is tracked with an
+  explicit stack, so deeply nested input doesn't recurse. A UTF-8 byte order
+  mark at the start of the input is skipped.
+
+  Malformed input throws std::runtime_error.
+
+==============================================================================*/
+class sexpr_reader_base_t
+{
+public:
+  enum : int { DEFAULT_CHUNK_SIZE = 64 * 1024 };
+
+  virtual ~sexpr_reader_base_t() = default;
+
+  // Reads the next top-level form into out. Returns false, leaving out
+  // untouched, if there are no more forms.
+  bool read(sexpr_t &out);
+
+  // Builds lists read from here on in document, or on the heap if document is
+  // null (the default). The document must outlive the forms read into it.
+  void set_document(sexpr_document_t *document) { document_ = document; }
+
+  // Number of bytes of input consumed so far.
+  long offset() const { return consumed_ + long(cur_ - base_); }
+
+protected:
+  // Reader with a chunk buffer of chunk_size bytes (at least 3, so it can
+  // hold a byte order mark), filled by refill().
+  explicit sexpr_reader_base_t(int chunk_size);
+  // Reader over [begin, end), which must outlive the reader. refill() is never
+  // called.
+  sexpr_reader_base_t(char const *begin, char const *end);
+
+  // Fills up to capacity bytes of buffer with further input, returning the
+  // number of bytes written. Returns 0 at the end of the input.
+  virtual int refill(char *buffer, int capacity) = 0;
+
+private:
+  struct frame_t
+  {
+    list_t items;
+    bool quote;
+  };
+
+  std::vector<char> buffer_;
+  char const *base_;
+  char const *cur_;
+  char const *end_;
+  long consumed_;
+  bool at_end_;
+
+  // Frames [0, depth_) are open lists. Frames past depth_ are kept around so
+  // their item vectors' capacity is reused by later lists.
+  std::vector<frame_t> stack_;
+  std::size_t depth_;
+  string_t token_;
+  sexpr_document_t *document_;
+
+  void push_frame(bool quote);
+
+  bool fill();
+  bool skip_space();
+  sexpr_t make_string(char const *begin, char const *end);
+  sexpr_t read_string();
+  sexpr_t read_hash();
+  sexpr_t read_atom();
+  char const *scan_token(char const *&token_end);
+
+  [[noreturn]] void fail(char const *what) const;
+};
+
+
+/*==============================================================================
+
+  sexpr_reader_t<STREAM>
+
+  Reads sexprs from any stream implementing read(int, void *) (see
+  basestream.hh), pulling chunk_size bytes per read.
+
+==============================================================================*/
+template <class STREAM>
+class sexpr_reader_t final : public sexpr_reader_base_t
+{
+  STREAM &stream_;
+
+public:
+  explicit sexpr_reader_t(STREAM &stream, int chunk_size = DEFAULT_CHUNK_SIZE)
+  : sexpr_reader_base_t(chunk_size)
+  , stream_(stream)
+  {
+    /* nop */
+  }
+
+protected:
+  int refill(char *buffer, int capacity) override
+  {
+    int const result = ::scolex::io::read(stream_, capacity, buffer);
+    if (result < 0) {
+      throw std::runtime_error("Failed to read sexpr input from stream");
+    }
+    return result;
+  }
+};
+
+
+/*==============================================================================
+
+  sexpr_buffer_reader_t
+
+  Reads sexprs directly out of an in-memory buffer without copying it.
+
+==============================================================================*/
+class sexpr_buffer_reader_t final : public sexpr_reader_base_t
+{
+public:
+  sexpr_buffer_reader_t(char const *begin, char const *end)
+  : sexpr_reader_base_t(begin, end)
+  {
+    /* nop */
+  }
+
+protected:
+  int refill(char *buffer, int capacity) override
+  {
+    (void)buffer;
+    (void)capacity;
+    return 0;
+  }
+};
+
+
+// Reads every top-level form remaining in stream.
+template <class STREAM>
+list_t read_sexprs(STREAM &stream)
+{
+  sexpr_reader_t<STREAM> reader { stream };
+  list_t forms;
+  sexpr_t form;
+  while (reader.read(form)) {
+    forms.push_back(std::move(form));
+  }
+  return forms;
+}
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SEXPR_READER_HH__ include guard */
@@ -0,0 +1,206 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "memstream.hh"
+#include "sexpr_push_parser.hh"
+#include "sexpr_reader.hh"
+#include "sexpr_writer.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+
+using namespace scolex;
+
+
+namespace
+{
+
+
+int failures = 0;
+
+
+void check(char const *label, bool passed)
+{
+  std::cout << label << " => " << std::boolalpha << passed << std::endl;
+  if (!passed) {
+    ++failures;
+  }
+}
+
+
+// Writes the events it's handed out as text, one per line, so that parses can
+// be compared as strings.
+class event_log_t final : public sexpr_handler_t
+{
+public:
+  string_t log;
+
+  void begin_list() override { log += "(\n"; }
+  void end_list() override { log += ")\n"; }
+  void nil() override { log += "nil\n"; }
+  void symbol(string_view_t name) override { log += "symbol " + string_t(name.data(), name.size()) + "\n"; }
+  void string(string_view_t str) override { log += "string " + string_t(str.data(), str.size()) + "\n"; }
+  void number(double num) override { log += "number " + std::to_string(num) + "\n"; }
+  void integer(int64_t num) override { log += "integer " + std::to_string(num) + "\n"; }
+  void boolean(bool value) override { log += value ? "#t\n" : "#f\n"; }
+  void end_form() override { log += "end\n"; }
+};
+
+
+// The events text gives fed to a push parser chunk_size bytes at a time.
+string_t push_events(string_t const &text, std::size_t chunk_size)
+{
+  event_log_t events;
+  sexpr_push_parser_t parser { events };
+  parser.set_validate_utf8(false);
+  for (std::size_t offset = 0; offset < text.size(); offset += chunk_size) {
+    parser.feed(text.data() + offset, std::min(chunk_size, text.size() - offset));
+  }
+  parser.finish();
+  return events.log;
+}
+
+
+// Whether the push parser reports the same events for text at every chunk
+// size from 1 to its length.
+bool push_events_at_every_chunk_size(string_t const &text, string_t const &expected)
+{
+  for (std::size_t chunk_size = 1; chunk_size <= text.size(); ++chunk_size) {
+    if (push_events(text, chunk_size) != expected) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// Every form in text, read chunk_size bytes at a time.
+list_t pull_forms(string_t const &text, int chunk_size)
+{
+  memstream_t stream { text };
+  sexpr_reader_t<memstream_t> reader { stream, chunk_size };
+  list_t forms;
+  sexpr_t form;
+  while (reader.read(form)) {
+    forms.push_back(std::move(form));
+  }
+  return forms;
+}
+
+
+// The forms text reads as, straight out of a buffer.
+list_t read_text(string_t const &text)
+{
+  sexpr_buffer_reader_t reader { text.data(), text.data() + text.size() };
+  list_t forms;
+  sexpr_t form;
+  while (reader.read(form)) {
+    forms.push_back(std::move(form));
+  }
+  return forms;
+}
+
+
+string_t write_text(list_t const &forms)
+{
+  memstream_t stream;
+  write_sexprs(stream, forms);
+  return stream.data();
+}
+
+
+// Whether the pull reader reads text as expected at every chunk size from 1
+// to its length, and straight out of a buffer.
+bool pull_forms_at_every_chunk_size(string_t const &text, list_t const &expected)
+{
+  for (int chunk_size = 1; chunk_size <= int(text.size()); ++chunk_size) {
+    if (pull_forms(text, chunk_size) != expected) {
+      return false;
+    }
+  }
+
+  return read_text(text) == expected;
+}
+
+
+} // namespace
+
+
+int main(int argc, char const *argv[])
+{
+  (void)argc;
+  (void)argv;
+
+  string_t const bom { "\xEF\xBB\xBF" };
+
+  check("push: BOM skipped at every chunk size",
+    push_events_at_every_chunk_size(bom + "abc ", "symbol abc\nend\n"));
+  check("push: BOM skipped before a list at every chunk size",
+    push_events_at_every_chunk_size(bom + "(a)", "(\nsymbol a\n)\nend\n"));
+  check("push: part of a BOM starts a symbol at every chunk size",
+    push_events_at_every_chunk_size("\xEF\xBBx a", "symbol \xEF\xBBx\nend\nsymbol a\nend\n"));
+  check("push: part of a BOM before a delimiter is a symbol at every chunk size",
+    push_events_at_every_chunk_size("\xEF\xBB()", "symbol \xEF\xBB\nend\nnil\nend\n"));
+  check("push: input of only part of a BOM is a symbol",
+    push_events("\xEF\xBB", 1) == "symbol \xEF\xBB\nend\n");
+  check("push: only one BOM is skipped",
+    push_events_at_every_chunk_size(bom + bom + "a", "symbol " + bom + "a\nend\n"));
+
+  list_t const abc { sexpr_t(symbol_t("abc")) };
+  check("pull: BOM skipped at every chunk size", pull_forms_at_every_chunk_size(bom + "abc ", abc));
+  check("pull: BOM skipped at the end of the input", pull_forms_at_every_chunk_size(bom + "abc", abc));
+  check("pull: part of a BOM starts a symbol",
+    pull_forms_at_every_chunk_size("\xEF\xBBx", list_t { sexpr_t(symbol_t("\xEF\xBBx")) }));
+  check("pull: only one BOM is skipped",
+    pull_forms_at_every_chunk_size(bom + bom + "a", list_t { sexpr_t(symbol_t(bom + "a")) }));
+
+  {
+    list_t const bounds = read_text("9223372036854775807 -9223372036854775808 9223372036854775808 -9223372036854775809");
+    check("int64 bounds read as integers", bounds.size() == 4 &&
+      bounds[0] == sexpr_t(std::numeric_limits<int64_t>::max()) &&
+      bounds[1] == sexpr_t(std::numeric_limits<int64_t>::min()));
+    check("integers past the int64 bounds read as numbers", bounds.size() == 4 &&
+      bounds[2] == sexpr_t(9223372036854775808.0) &&
+      bounds[3] == sexpr_t(-9223372036854775808.0));
+    check("push: int64 bounds at every chunk size",
+      push_events_at_every_chunk_size("9223372036854775807 -9223372036854775808 9223372036854775808 ",
+        "integer 9223372036854775807\nend\ninteger -9223372036854775808\nend\n"
+        "number 9223372036854775808.000000\nend\n"));
+  }
+
+  double const inf = std::numeric_limits<double>::infinity();
+  list_t const non_finite { sexpr_t { symbol_t("x"), inf, -inf, 1.5 } };
+  string_t const non_finite_text = write_text(non_finite);
+  check(R"raw(infinities are written as +inf.0 and -inf.0)raw", non_finite_text == "(x +inf.0 -inf.0 1.5)\n");
+  check("infinities round trip", read_text(non_finite_text) == non_finite);
+  check("NaN is written as +nan.0",
+    write_text(list_t { sexpr_t(std::numeric_limits<double>::quiet_NaN()) }) == "+nan.0\n");
+  {
+    list_t const nans = read_text("+nan.0 -nan.0");
+    check("+nan.0 and -nan.0 read as NaN", nans.size() == 2 &&
+      nans[0].type() == sexpr_t::NUMBER && std::isnan(nans[0].number()) &&
+      nans[1].type() == sexpr_t::NUMBER && std::isnan(nans[1].number()));
+  }
+  check("inf, +inf and +inf.0x are symbols",
+    read_text("inf +inf +inf.0x") == list_t { sexpr_t(symbol_t("inf")), sexpr_t(symbol_t("+inf")), sexpr_t(symbol_t("+inf.0x")) });
+  check("push: non-finite numbers at every chunk size",
+    push_events_at_every_chunk_size("+inf.0 -inf.0 +inf ", "number inf\nend\nnumber -inf\nend\nsymbol +inf\nend\n"));
+
+  {
+    sexpr_t const mixed { symbol_t("f"), 2.0, 3, 1.25, -0.0, 1e300, inf };
+    std::ostringstream printed;
+    printed << mixed;
+    check("operator << keeps numbers apart from integers",
+      printed.str() == "(f 2.0 3 1.25 -0.0 1e+300 +inf.0)");
+    check("operator << output reads back", read_text(printed.str()) == list_t { mixed });
+    check("operator << and the writer agree", write_text(list_t { mixed }) == printed.str() + "\n");
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,362 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sexpr_scan.hh"
+#include "sexpr_lex.hh"
+
+#include <cstring>
+#include <stdexcept>
+
+// The vector kernels need GCC-style target attributes, so AVX2 can be used
+// without building everything for it, and __builtin_cpu_supports to check
+// for it at runtime.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && defined(__SSE2__)
+# define SCOLEX_SCAN_X86 1
+# include <immintrin.h>
+#else
+# define SCOLEX_SCAN_X86 0
+#endif
+
+
+namespace scolex
+{
+
+
+namespace
+{
+
+
+// Bitmasks of a 64-byte block, bit N standing for byte N.
+struct block_masks_t
+{
+  uint64_t quote;
+  uint64_t backslash;
+  uint64_t semicolon;
+  uint64_t space;
+  // ( ) and '
+  uint64_t op;
+};
+
+
+int count_ones(uint64_t bits)
+{
+#if defined(__GNUC__)
+  return __builtin_popcountll(bits);
+#else
+  int count = 0;
+  for (; bits; bits &= bits - 1) {
+    ++count;
+  }
+  return count;
+#endif
+}
+
+
+int count_trailing_zeros(uint64_t bits)
+{
+#if defined(__GNUC__)
+  return __builtin_ctzll(bits);
+#else
+  int count = 0;
+  for (; !(bits & 1); bits >>= 1) {
+    ++count;
+  }
+  return count;
+#endif
+}
+
+
+// Bit N of the result is the XOR of bits 0 through N of bits, so between an
+// opening quote's bit and its closing quote's, everything is set.
+uint64_t prefix_xor(uint64_t bits)
+{
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+
+// Bits of the bytes escaped by a backslash, given the block's backslashes and
+// whether the last byte of the previous block was an unescaped backslash.
+// A byte is escaped if it follows an odd-length run of backslashes, which is
+// found by adding each run's start to the run: the carry out of a run lands
+// one past its end, on an even or odd bit depending on where the run started
+// and how long it was. Updates carry for the next block.
+uint64_t find_escaped(uint64_t backslash, bool &carry)
+{
+  uint64_t const EVEN_BITS = 0x5555555555555555ull;
+
+  if (backslash == 0) {
+    uint64_t const escaped = uint64_t(carry);
+    carry = false;
+    return escaped;
+  }
+
+  backslash &= ~uint64_t(carry);
+  uint64_t const follows_escape = (backslash << 1) | uint64_t(carry);
+  uint64_t const odd_starts = backslash & ~EVEN_BITS & ~follows_escape;
+  uint64_t const even_starts = odd_starts + backslash;
+  carry = even_starts < odd_starts;
+  return (EVEN_BITS ^ (even_starts << 1)) & follows_escape;
+}
+
+
+void append_offsets(uint64_t bits, uint32_t base, std::vector<uint32_t> &index)
+{
+  std::size_t const at = index.size();
+  index.resize(at + std::size_t(count_ones(bits)));
+  uint32_t *out = index.data() + at;
+  for (; bits; bits &= bits - 1) {
+    *out++ = base + uint32_t(count_trailing_zeros(bits));
+  }
+}
+
+
+#if SCOLEX_SCAN_X86
+
+
+struct sse2_classifier_t
+{
+  static void classify(char const *block, block_masks_t &masks)
+  {
+    masks = block_masks_t { 0, 0, 0, 0, 0 };
+    for (int lane = 0; lane < 4; ++lane) {
+      __m128i const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const *>(block + lane * 16));
+      auto match = [&bytes](char c) { return _mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)); };
+      auto bits = [lane](__m128i matched) { return uint64_t(uint16_t(_mm_movemask_epi8(matched))) << (lane * 16); };
+
+      // \t through \r are 0 through 4 after subtracting \t.
+      __m128i const control = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+      __m128i const control_space = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8(4)), control);
+
+      masks.quote |= bits(match('"'));
+      masks.backslash |= bits(match('\\'));
+      masks.semicolon |= bits(match(';'));
+      masks.space |= bits(_mm_or_si128(match(' '), control_space));
+      masks.op |= bits(_mm_or_si128(_mm_or_si128(match('('), match(')')), match('\'')));
+    }
+  }
+};
+
+
+struct avx2_classifier_t
+{
+  __attribute__((target("avx2")))
+  static void classify(char const *block, block_masks_t &masks)
+  {
+    masks = block_masks_t { 0, 0, 0, 0, 0 };
+    for (int lane = 0; lane < 2; ++lane) {
+      __m256i const bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(block + lane * 32));
+      __m256i const quote = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"'));
+      __m256i const backslash = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\\'));
+      __m256i const semicolon = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(';'));
+      __m256i const control = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+      __m256i const space = _mm256_or_si256(
+        _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8(4)), control));
+      __m256i const op = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('(')), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(')'))),
+        _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\'')));
+
+      int const shift = lane * 32;
+      masks.quote |= uint64_t(uint32_t(_mm256_movemask_epi8(quote))) << shift;
+      masks.backslash |= uint64_t(uint32_t(_mm256_movemask_epi8(backslash))) << shift;
+      masks.semicolon |= uint64_t(uint32_t(_mm256_movemask_epi8(semicolon))) << shift;
+      masks.space |= uint64_t(uint32_t(_mm256_movemask_epi8(space))) << shift;
+      masks.op |= uint64_t(uint32_t(_mm256_movemask_epi8(op))) << shift;
+    }
+  }
+};
+
+
+#endif // SCOLEX_SCAN_X86
+
+
+} // namespace
+
+
+sexpr_scanner_t::sexpr_scanner_t(sexpr_scan_kernel_t kernel)
+: kernel_(SCAN_SCALAR)
+, offset_(0)
+, in_string_(false)
+, in_comment_(false)
+, escaped_(false)
+, in_atom_(false)
+{
+  if (kernel == SCAN_BEST || !supported(kernel)) {
+    kernel = supported(SCAN_AVX2) ? SCAN_AVX2 : supported(SCAN_SSE2) ? SCAN_SSE2 : SCAN_SCALAR;
+  }
+  kernel_ = kernel;
+}
+
+
+bool sexpr_scanner_t::supported(sexpr_scan_kernel_t kernel)
+{
+  switch (kernel) {
+  case SCAN_SCALAR:
+  case SCAN_BEST:
+    return true;
+#if SCOLEX_SCAN_X86
+  case SCAN_SSE2:
+    return true;
+  case SCAN_AVX2:
+    return __builtin_cpu_supports("avx2");
+#else
+  case SCAN_SSE2:
+  case SCAN_AVX2:
+    return false;
+#endif
+  }
+  return false;
+}
+
+
+void sexpr_scanner_t::reset()
+{
+  offset_ = 0;
+  in_string_ = false;
+  in_comment_ = false;
+  escaped_ = false;
+  in_atom_ = false;
+}
+
+
+void sexpr_scanner_t::scan(char const *data, std::size_t size, std::vector<uint32_t> &index)
+{
+  if (size > uint64_t(UINT32_MAX) + 1 - offset_) {
+    throw std::runtime_error("Cannot index more than 4 GiB of sexpr text");
+  }
+
+  switch (kernel_) {
+#if SCOLEX_SCAN_X86
+  case SCAN_SSE2:
+    scan_blocks<sse2_classifier_t>(data, size, index);
+    break;
+  case SCAN_AVX2:
+    scan_blocks<avx2_classifier_t>(data, size, index);
+    break;
+#endif
+  default:
+    break;
+  }
+
+  scan_scalar(data, size, index);
+}
+
+
+// The reference kernel: one byte at a time, as the reader sees them.
+void sexpr_scanner_t::scan_scalar(char const *data, std::size_t size, std::vector<uint32_t> &index)
+{
+  uint32_t const base = uint32_t(offset_);
+
+  for (std::size_t at = 0; at < size; ++at) {
+    char const c = data[at];
+
+    if (in_comment_) {
+      void const *newline = std::memchr(data + at, '\n', size - at);
+      if (!newline) {
+        break;
+      }
+      at = std::size_t(static_cast<char const *>(newline) - data);
+      in_comment_ = false;
+      continue;
+    } else if (in_string_) {
+      if (escaped_) {
+        escaped_ = false;
+      } else if (c == '\\') {
+        escaped_ = true;
+      } else if (c == '"') {
+        in_string_ = false;
+      }
+      continue;
+    }
+
+    switch (c) {
+    case '(':
+    case ')':
+    case '\'':
+      index.push_back(base + uint32_t(at));
+      in_atom_ = false;
+      break;
+    case '"':
+      index.push_back(base + uint32_t(at));
+      in_string_ = true;
+      in_atom_ = false;
+      break;
+    case ';':
+      in_comment_ = true;
+      in_atom_ = false;
+      break;
+    default:
+      if (lex::is_space(c)) {
+        in_atom_ = false;
+      } else if (!in_atom_) {
+        index.push_back(base + uint32_t(at));
+        in_atom_ = true;
+      }
+      break;
+    }
+  }
+
+  offset_ += size;
+}
+
+
+// Scans whole 64-byte blocks from data, leaving data and size at the rest.
+template <class CLASSIFIER>
+void sexpr_scanner_t::scan_blocks(char const *&data, std::size_t &size, std::vector<uint32_t> &index)
+{
+  for (; size >= 64; data += 64, size -= 64) {
+    block_masks_t masks;
+    CLASSIFIER::classify(data, masks);
+
+    // Comments can't be told from masks: a ';' only starts one outside a
+    // string, and a '"' only starts a string outside a comment.
+    if (in_comment_ || masks.semicolon) {
+      scan_scalar(data, 64, index);
+      continue;
+    }
+
+    bool escape_carry = escaped_;
+    uint64_t const escaped = find_escaped(masks.backslash, escape_carry);
+    uint64_t const quotes = masks.quote & ~escaped;
+    uint64_t const strings = prefix_xor(quotes) ^ (in_string_ ? ~uint64_t(0) : 0);
+
+    // Backslashes only escape in strings; one outside a string is part of a
+    // token, and whatever it was taken to escape above wasn't.
+    if (masks.backslash & ~strings) {
+      scan_scalar(data, 64, index);
+      continue;
+    }
+
+    uint64_t const atoms = ~(masks.space | masks.op | masks.quote | masks.semicolon | strings);
+    uint64_t const atom_starts = atoms & ~((atoms << 1) | uint64_t(in_atom_));
+    // An opening quote's bit is set in strings; a closing quote's isn't.
+    uint64_t const tokens = (masks.op & ~strings) | (quotes & strings) | atom_starts;
+
+    append_offsets(tokens, uint32_t(offset_), index);
+
+    in_string_ = (strings >> 63) != 0;
+    in_atom_ = (atoms >> 63) != 0;
+    escaped_ = escape_carry;
+    offset_ += 64;
+  }
+}
+
+
+std::vector<uint32_t> sexpr_token_index(char const *begin, char const *end, sexpr_scan_kernel_t kernel)
+{
+  std::vector<uint32_t> index;
+  sexpr_scanner_t scanner { kernel };
+  scanner.scan(begin, std::size_t(end - begin), index);
+  return index;
+}
+
+
+} // namespace scolex
@@ -0,0 +1,112 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SEXPR_SCAN_HH__
+#define __SCOLEX_SEXPR_SCAN_HH__
+
+#include "scolex_config.hh"
+
+#include <vector>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  Structural scanning
+
+  Finds where every token in sexpr text starts without tokenizing it, giving
+  a token index: the offsets of each
+
+    ( ) '         outside strings and comments
+    "             that opens a string
+    first byte    of each symbol, number or # token
+
+  in order. Whitespace, comments, string contents and the rest of each token
+  are skipped, so a reader can jump from token to token.
+
+  Text is classified 64 bytes at a time into bitmasks of quotes,
+  backslashes, whitespace and so on, with SSE2 or AVX2 compares where
+  available. Escaped quotes are found from the runs of backslashes before
+  them and strings from a prefix XOR over the unescaped quotes, so nothing
+  branches on the bytes themselves. Blocks where that can't be done with
+  masks alone -- ones holding a ';' or continuing a comment, or with a
+  backslash outside a string -- are handed to the scalar kernel, which is
+  also the reference the vector kernels are tested against.
+
+==============================================================================*/
+
+
+enum sexpr_scan_kernel_t : int
+{
+  SCAN_SCALAR,
+  SCAN_SSE2,
+  SCAN_AVX2,
+  // The fastest kernel the CPU supports.
+  SCAN_BEST,
+};
+
+
+/*==============================================================================
+
+  sexpr_scanner_t
+
+  Builds a token index over text fed to it in chunks of any size; state
+  carries over from one chunk to the next, and offsets are from the start of
+  the first chunk. Input is limited to 4 GiB.
+
+==============================================================================*/
+class sexpr_scanner_t
+{
+public:
+  explicit sexpr_scanner_t(sexpr_scan_kernel_t kernel = SCAN_BEST);
+
+  // Whether this CPU can run kernel.
+  static bool supported(sexpr_scan_kernel_t kernel);
+
+  // The kernel in use -- never SCAN_BEST. Unsupported kernels fall back to
+  // the best supported one.
+  sexpr_scan_kernel_t kernel() const { return kernel_; }
+
+  // Appends the offsets of the tokens starting in [data, data + size) to
+  // index. Throws std::runtime_error past 4 GiB of input.
+  void scan(char const *data, std::size_t size, std::vector<uint32_t> &index);
+
+  // Starts over at offset 0, outside of any string or comment.
+  void reset();
+
+  // Bytes scanned so far.
+  uint64_t offset() const { return offset_; }
+  // Whether the text so far ends inside a string or comment.
+  bool in_string() const { return in_string_; }
+  bool in_comment() const { return in_comment_; }
+
+private:
+  sexpr_scan_kernel_t kernel_;
+  uint64_t offset_;
+
+  bool in_string_;
+  bool in_comment_;
+  // The last byte was a backslash escaping the next one (in a string).
+  bool escaped_;
+  // The last byte was part of a symbol, number or # token.
+  bool in_atom_;
+
+  void scan_scalar(char const *data, std::size_t size, std::vector<uint32_t> &index);
+
+  template <class CLASSIFIER>
+  void scan_blocks(char const *&data, std::size_t &size, std::vector<uint32_t> &index);
+};
+
+
+// Returns the token index of [begin, end).
+std::vector<uint32_t> sexpr_token_index(char const *begin, char const *end, sexpr_scan_kernel_t kernel = SCAN_BEST);
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SEXPR_SCAN_HH__ include guard */
@@ -0,0 +1,161 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sexpr_scan.hh"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+
+using namespace scolex;
+
+
+namespace
+{
+
+
+int failures = 0;
+
+
+void check(char const *label, bool passed)
+{
+  std::cout << label << " => " << std::boolalpha << passed << std::endl;
+  if (!passed) {
+    ++failures;
+  }
+}
+
+
+// Index of text fed to a scanner chunk_size bytes at a time.
+std::vector<uint32_t> chunked_index(string_t const &text, sexpr_scan_kernel_t kernel, std::size_t chunk_size)
+{
+  std::vector<uint32_t> index;
+  sexpr_scanner_t scanner { kernel };
+  for (std::size_t offset = 0; offset < text.size(); offset += chunk_size) {
+    scanner.scan(text.data() + offset, std::min(chunk_size, text.size() - offset), index);
+  }
+  return index;
+}
+
+
+// Random text drawn mostly from the bytes the scanner cares about, so that
+// strings, escapes, comments and runs of backslashes land at every position
+// in a block and cross block boundaries.
+string_t random_text(std::mt19937 &rng, std::size_t size, bool comments)
+{
+  static char const alphabet[] = "()'\"\\\\\\;\n\t abc1#.";
+  std::size_t const alphabet_size = sizeof(alphabet) - 1;
+  std::uniform_int_distribution<std::size_t> pick(0, alphabet_size - 1);
+
+  string_t text;
+  while (text.size() < size) {
+    char const c = alphabet[pick(rng)];
+    if (c != ';' || comments) {
+      text.push_back(c);
+    }
+  }
+  return text;
+}
+
+
+// Random well-formed forms whose backslashes are all in strings, so the
+// vector kernels take their fast path rather than falling back to the
+// scalar kernel.
+string_t random_forms(std::mt19937 &rng, std::size_t size)
+{
+  static char const *const pieces[] = {
+    "(", ")", "'", " ", "\n", "sym", "12.5", "#t", "\"str\"", "\"a\\\"b\"", "\"\\\\\"",
+    "\"(\\\\\\\")\"", "\"\\\\\\\\\\\\\\\\\"", "x\"y\"z",
+  };
+  std::uniform_int_distribution<std::size_t> pick(0, sizeof(pieces) / sizeof(pieces[0]) - 1);
+
+  string_t text;
+  while (text.size() < size) {
+    text += pieces[pick(rng)];
+  }
+  return text;
+}
+
+
+// Whether every kernel gives the scalar kernel's index for text, in one go
+// and fed in chunks of every size in chunk_sizes.
+bool kernels_agree(string_t const &text)
+{
+  std::vector<uint32_t> const expected = sexpr_token_index(text.data(), text.data() + text.size(), SCAN_SCALAR);
+  sexpr_scan_kernel_t const kernels[] = { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+  std::size_t const chunk_sizes[] = { 1, 7, 63, 64, 65, 128, 1000 };
+
+  for (sexpr_scan_kernel_t kernel : kernels) {
+    if (sexpr_token_index(text.data(), text.data() + text.size(), kernel) != expected) {
+      return false;
+    }
+    for (std::size_t chunk_size : chunk_sizes) {
+      if (chunked_index(text, kernel, chunk_size) != expected) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+
+} // namespace
+
+
+int main(int argc, char const *argv[])
+{
+  (void)argc;
+  (void)argv;
+
+  std::cout << "kernels: scalar"
+    << (sexpr_scanner_t::supported(SCAN_SSE2) ? " sse2" : "")
+    << (sexpr_scanner_t::supported(SCAN_AVX2) ? " avx2" : "") << std::endl;
+
+  {
+    string_t const text = "(foo \"a (b\" 'c) ; d (e\n12 #t\"x\"y";
+    std::vector<uint32_t> const expected { 0, 1, 5, 12, 13, 14, 23, 26, 28, 31 };
+    check("scalar index of a small form", sexpr_token_index(text.data(), text.data() + text.size(), SCAN_SCALAR) == expected);
+    check("every kernel agrees on a small form", kernels_agree(text));
+  }
+
+  {
+    string_t const text = string_t(60, ' ') + "\"a\\\\\\\"b\\\\\" x" + string_t(60, ' ') + "\"\\\"(\" )";
+    check("escaped quotes across a block boundary", kernels_agree(text));
+  }
+
+  {
+    string_t const text = string_t(63, 'a') + "\\\"(b c\")" + string_t(70, '\\') + " \"" + string_t(130, '\\') + "\")";
+    check("backslashes outside strings", kernels_agree(text));
+  }
+
+  std::mt19937 rng { 1234 };
+  bool random_agree = true;
+  bool random_comments_agree = true;
+  for (int round = 0; round < 200; ++round) {
+    std::size_t const size = std::size_t(round) * 7 + 1;
+    random_agree = random_agree && kernels_agree(random_text(rng, size, false));
+    random_comments_agree = random_comments_agree && kernels_agree(random_text(rng, size, true));
+  }
+  check("random text without comments", random_agree);
+  check("random text with comments", random_comments_agree);
+
+  bool forms_agree = true;
+  for (int round = 0; round < 50; ++round) {
+    forms_agree = forms_agree && kernels_agree(random_forms(rng, std::size_t(round) * 97 + 10));
+  }
+  check("random forms", forms_agree && kernels_agree(random_forms(rng, 1 << 20)));
+
+  {
+    sexpr_scanner_t scanner;
+    std::vector<uint32_t> index;
+    scanner.scan("(a \"b", 5, index);
+    bool const open_string = scanner.in_string() && !scanner.in_comment();
+    scanner.scan("\" ; c", 5, index);
+    check("string and comment state carry between chunks", open_string && scanner.in_comment() && !scanner.in_string());
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,582 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sexpr_vm.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+
+namespace scolex
+{
+
+
+namespace
+{
+
+
+enum opcode_t : uint8_t
+{
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_MIN,
+  OP_MAX,
+  OP_NEG,
+  OP_LT,
+  OP_LE,
+  OP_GT,
+  OP_GE,
+  OP_EQ,
+  OP_NOT,
+  OP_MOV,
+  OP_JUMP,
+  OP_JUMP_IF_FALSE,
+  OP_JUMP_IF_TRUE,
+  OP_RETURN,
+};
+
+
+char const *const opcode_names[] = {
+  "add", "sub", "mul", "div", "min", "max", "neg",
+  "lt", "le", "gt", "ge", "eq", "not", "mov",
+  "jump", "jump-if-false", "jump-if-true", "return",
+};
+
+
+enum form_t : int
+{
+  // Folds its operands with op: (+ a b c) is (a + b) + c.
+  FORM_ARITH,
+  // Chains op over neighbouring operands: (< a b c) is a < b and b < c.
+  FORM_COMPARE,
+  FORM_AND,
+  FORM_OR,
+  FORM_NOT,
+  FORM_IF,
+};
+
+
+struct operator_t
+{
+  char const *name;
+  form_t form;
+  opcode_t op;
+};
+
+
+operator_t const operators[] = {
+  { "+", FORM_ARITH, OP_ADD },
+  { "-", FORM_ARITH, OP_SUB },
+  { "*", FORM_ARITH, OP_MUL },
+  { "/", FORM_ARITH, OP_DIV },
+  { "min", FORM_ARITH, OP_MIN },
+  { "max", FORM_ARITH, OP_MAX },
+  { "<", FORM_COMPARE, OP_LT },
+  { "<=", FORM_COMPARE, OP_LE },
+  { ">", FORM_COMPARE, OP_GT },
+  { ">=", FORM_COMPARE, OP_GE },
+  { "=", FORM_COMPARE, OP_EQ },
+  { "and", FORM_AND, OP_JUMP_IF_FALSE },
+  { "or", FORM_OR, OP_JUMP_IF_TRUE },
+  { "not", FORM_NOT, OP_NOT },
+  { "if", FORM_IF, OP_JUMP_IF_FALSE },
+};
+
+
+// The operator named by sym, or null. Symbols are interned, so each lookup
+// is a handful of pointer comparisons.
+operator_t const *find_operator(symbol_t const &sym)
+{
+  struct entry_t
+  {
+    symbol_t sym;
+    operator_t const *op;
+  };
+
+  static std::vector<entry_t> const table = [] {
+    std::vector<entry_t> entries;
+    for (operator_t const &op : operators) {
+      entries.push_back(entry_t { symbol_t(op.name), &op });
+    }
+    return entries;
+  }();
+
+  for (entry_t const &entry : table) {
+    if (entry.sym == sym) {
+      return entry.op;
+    }
+  }
+  return nullptr;
+}
+
+
+} // namespace
+
+
+/*
+  Compiles one expression into a sexpr_program_t. Registers are numbered by
+  class while compiling -- parameters, constants and temporaries each from
+  zero -- since the number of constants isn't known until the end, and only
+  mapped to final register numbers by finish().
+
+  Temporaries are allocated like a stack: compiling an operand may use any
+  temporaries above the current top, and they're released once its value
+  has been consumed.
+*/
+class sexpr_compiler_t
+{
+public:
+  sexpr_compiler_t(sexpr_program_t &program, std::vector<symbol_t> const &params)
+  : program_(program)
+  , params_(params)
+  , code_()
+  , constants_()
+  , temp_top_(0)
+  , temp_count_(0)
+  , label_(0)
+  , depth_(0)
+  {
+    /* nop */
+  }
+
+  void compile(sexpr_t const &expr)
+  {
+    check_registers();
+    sexpr_t::type_t type;
+    int const result = compile_expr(expr, type);
+    emit(OP_RETURN, 0, result, 0);
+    program_.result_type_ = type;
+    finish();
+  }
+
+private:
+  enum : int
+  {
+    PARAM = 0x00000,
+    CONSTANT = 0x10000,
+    TEMP = 0x20000,
+    CLASS_MASK = 0x30000,
+  };
+
+  struct instr_t
+  {
+    opcode_t op;
+    int dst;
+    int a;
+    int b;
+  };
+
+  sexpr_program_t &program_;
+  std::vector<symbol_t> const &params_;
+  std::vector<instr_t> code_;
+  std::unordered_map<uint64_t, int> constants_;
+  int temp_top_;
+  int temp_count_;
+  // The index of the last instruction a jump was pointed at.
+  std::size_t label_;
+  // Operator forms being compiled, since the compiler recurses once for each.
+  int depth_;
+
+  [[noreturn]] static void fail(string_t const &what, sexpr_t const &expr)
+  {
+    std::ostringstream message;
+    message << "Cannot compile " << expr << ": " << what;
+    throw std::runtime_error(message.str());
+  }
+
+  // Throws if the registers allocated so far are more than a program can have.
+  void check_registers() const
+  {
+    int const register_count = int(params_.size()) + int(program_.constants_.size()) + temp_count_;
+    if (register_count > sexpr_program_t::MAX_REGISTERS) {
+      throw std::runtime_error("Cannot compile expression: needs more than 256 registers");
+    }
+  }
+
+  std::size_t emit(opcode_t op, int dst, int a, int b)
+  {
+    if (code_.size() == sexpr_program_t::MAX_INSTRUCTIONS) {
+      throw std::runtime_error("Cannot compile expression: more than 65536 instructions");
+    }
+    code_.push_back(instr_t { op, dst, a, b });
+    return code_.size() - 1;
+  }
+
+  // Points the jump at index to the next instruction emitted.
+  void land(std::size_t index)
+  {
+    code_[index].dst = int(code_.size());
+    label_ = code_.size();
+  }
+
+  // Copies value into dst. If value is a temporary the last instruction just
+  // wrote, and nothing jumps past that instruction, it writes dst instead.
+  void move(int dst, int value)
+  {
+    if ((value & CLASS_MASK) == TEMP && !code_.empty() && label_ != code_.size()) {
+      instr_t &last = code_.back();
+      if (last.dst == value && last.op < OP_JUMP) {
+        last.dst = dst;
+        return;
+      }
+    }
+    emit(OP_MOV, dst, value, 0);
+  }
+
+  int temp()
+  {
+    int const reg = TEMP | temp_top_++;
+    temp_count_ = std::max(temp_count_, temp_top_);
+    check_registers();
+    return reg;
+  }
+
+  int constant(double value)
+  {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    auto const found = constants_.emplace(bits, int(constants_.size()));
+    if (found.second) {
+      program_.constants_.push_back(value);
+      check_registers();
+    }
+    return CONSTANT | found.first->second;
+  }
+
+  int compile_typed(sexpr_t const &expr, sexpr_t::type_t expected, sexpr_t const &form)
+  {
+    sexpr_t::type_t type;
+    int const reg = compile_expr(expr, type);
+    if (type != expected) {
+      fail(expected == sexpr_t::NUMBER ? "expected a number" : "expected a boolean", form);
+    }
+    return reg;
+  }
+
+  int compile_expr(sexpr_t const &expr, sexpr_t::type_t &type)
+  {
+    switch (expr.type()) {
+    case sexpr_t::NUMBER:
+    case sexpr_t::INTEGER:
+      // Registers hold doubles, so integers are compiled as numbers.
+      type = sexpr_t::NUMBER;
+      return constant(expr.number());
+
+    case sexpr_t::BOOLEAN:
+      type = sexpr_t::BOOLEAN;
+      return constant(expr.boolean() ? 1.0 : 0.0);
+
+    case sexpr_t::SYMBOL: {
+        auto const param = std::find(params_.begin(), params_.end(), expr.symbol());
+        if (param == params_.end()) {
+          fail("unknown symbol", expr);
+        }
+        type = sexpr_t::NUMBER;
+        return PARAM | int(param - params_.begin());
+      }
+
+    case sexpr_t::LIST:
+      return compile_form(expr, type);
+
+    default:
+      fail("not a number, boolean, parameter or operator form", expr);
+    }
+  }
+
+  int compile_form(sexpr_t const &form, sexpr_t::type_t &type)
+  {
+    if (depth_ == sexpr_program_t::MAX_DEPTH) {
+      throw std::runtime_error("Cannot compile expression: nested more than 1024 deep");
+    }
+    ++depth_;
+    int const reg = compile_operator(form, type);
+    --depth_;
+    return reg;
+  }
+
+  int compile_operator(sexpr_t const &form, sexpr_t::type_t &type)
+  {
+    sexpr_t const &head = form.car();
+    operator_t const *const op = head.type() == sexpr_t::SYMBOL ? find_operator(head.symbol()) : nullptr;
+    if (!op) {
+      fail("unknown operator", form);
+    }
+
+    sexpr_t const *const args = form.begin() + 1;
+    int const arg_count = form.size() - 1;
+    int const mark = temp_top_;
+
+    switch (op->form) {
+    case FORM_ARITH: {
+        type = sexpr_t::NUMBER;
+        if (arg_count == 0) {
+          if (op->op == OP_ADD || op->op == OP_MUL) {
+            return constant(op->op == OP_ADD ? 0.0 : 1.0);
+          }
+          fail("expected at least one operand", form);
+        }
+
+        int const first = compile_typed(args[0], sexpr_t::NUMBER, form);
+        if (arg_count == 1) {
+          if (op->op != OP_SUB && op->op != OP_DIV) {
+            return first;
+          }
+          temp_top_ = mark;
+          int const dst = temp();
+          if (op->op == OP_SUB) {
+            emit(OP_NEG, dst, first, 0);
+          } else {
+            emit(OP_DIV, dst, constant(1.0), first);
+          }
+          return dst;
+        }
+
+        int const second = compile_typed(args[1], sexpr_t::NUMBER, form);
+        temp_top_ = mark;
+        int const dst = temp();
+        emit(op->op, dst, first, second);
+        for (int index = 2; index < arg_count; ++index) {
+          int const next = compile_typed(args[index], sexpr_t::NUMBER, form);
+          temp_top_ = mark + 1;
+          emit(op->op, dst, dst, next);
+        }
+        return dst;
+      }
+
+    case FORM_COMPARE: {
+        type = sexpr_t::BOOLEAN;
+        if (arg_count < 2) {
+          fail("expected at least two operands", form);
+        }
+
+        // Each operand but the last is compared twice, so operands stay live
+        // until the end of the chain; a false link skips the rest.
+        int const dst = temp();
+        int prev = compile_typed(args[0], sexpr_t::NUMBER, form);
+        int next = compile_typed(args[1], sexpr_t::NUMBER, form);
+        emit(op->op, dst, prev, next);
+
+        std::vector<std::size_t> exits;
+        for (int index = 2; index < arg_count; ++index) {
+          exits.push_back(emit(OP_JUMP_IF_FALSE, 0, dst, 0));
+          prev = next;
+          next = compile_typed(args[index], sexpr_t::NUMBER, form);
+          emit(op->op, dst, prev, next);
+        }
+        for (std::size_t exit : exits) {
+          land(exit);
+        }
+        temp_top_ = mark + 1;
+        return dst;
+      }
+
+    case FORM_AND:
+    case FORM_OR: {
+        type = sexpr_t::BOOLEAN;
+        if (arg_count == 0) {
+          return constant(op->form == FORM_AND ? 1.0 : 0.0);
+        }
+
+        int const dst = temp();
+        std::vector<std::size_t> exits;
+        for (int index = 0; index < arg_count; ++index) {
+          int const value = compile_typed(args[index], sexpr_t::BOOLEAN, form);
+          move(dst, value);
+          temp_top_ = mark + 1;
+          if (index + 1 < arg_count) {
+            exits.push_back(emit(op->op, 0, dst, 0));
+          }
+        }
+        for (std::size_t exit : exits) {
+          land(exit);
+        }
+        return dst;
+      }
+
+    case FORM_NOT: {
+        type = sexpr_t::BOOLEAN;
+        if (arg_count != 1) {
+          fail("expected one operand", form);
+        }
+        int const value = compile_typed(args[0], sexpr_t::BOOLEAN, form);
+        temp_top_ = mark;
+        int const dst = temp();
+        emit(OP_NOT, dst, value, 0);
+        return dst;
+      }
+
+    case FORM_IF: {
+        if (arg_count != 3) {
+          fail("expected a condition, a then and an else", form);
+        }
+
+        int const dst = temp();
+        int const condition = compile_typed(args[0], sexpr_t::BOOLEAN, form);
+        std::size_t const to_else = emit(OP_JUMP_IF_FALSE, 0, condition, 0);
+        temp_top_ = mark + 1;
+
+        int const then_value = compile_expr(args[1], type);
+        move(dst, then_value);
+        std::size_t const to_end = emit(OP_JUMP, 0, 0, 0);
+        temp_top_ = mark + 1;
+
+        land(to_else);
+        sexpr_t::type_t else_type;
+        int const else_value = compile_expr(args[2], else_type);
+        if (else_type != type) {
+          fail("then and else have different types", form);
+        }
+        move(dst, else_value);
+        land(to_end);
+        temp_top_ = mark + 1;
+        return dst;
+      }
+    }
+
+    fail("unknown operator", form);
+  }
+
+  void finish()
+  {
+    int const param_count = int(params_.size());
+    int const constant_count = int(program_.constants_.size());
+    int const register_count = param_count + constant_count + temp_count_;
+
+    auto reg = [param_count, constant_count](int operand) -> uint8_t {
+      int const index = operand & ~CLASS_MASK;
+      switch (operand & CLASS_MASK) {
+      case CONSTANT: return uint8_t(param_count + index);
+      case TEMP: return uint8_t(param_count + constant_count + index);
+      default: return uint8_t(index);
+      }
+    };
+
+    program_.code_.reserve(code_.size());
+    for (instr_t const &instr : code_) {
+      sexpr_instr_t out;
+      out.op = instr.op;
+      if (instr.op == OP_JUMP || instr.op == OP_JUMP_IF_FALSE || instr.op == OP_JUMP_IF_TRUE) {
+        out.dst = uint8_t(instr.dst & 0xFF);
+        out.b = uint8_t(instr.dst >> 8);
+        out.a = instr.op == OP_JUMP ? 0 : reg(instr.a);
+      } else {
+        out.dst = reg(instr.dst);
+        out.a = reg(instr.a);
+        out.b = reg(instr.b);
+      }
+      program_.code_.push_back(out);
+    }
+
+    program_.param_count_ = param_count;
+    program_.register_count_ = register_count;
+  }
+};
+
+
+sexpr_program_t::sexpr_program_t()
+: code_()
+, constants_()
+, param_count_(0)
+, register_count_(0)
+, result_type_(sexpr_t::NUMBER)
+{
+  /* nop */
+}
+
+
+sexpr_program_t sexpr_program_t::compile(sexpr_t const &expr, std::vector<symbol_t> const &params)
+{
+  sexpr_program_t program;
+  sexpr_compiler_t compiler { program, params };
+  compiler.compile(expr);
+  return program;
+}
+
+
+double sexpr_program_t::run(double const *params) const
+{
+  double regs[MAX_REGISTERS];
+  std::copy(params, params + param_count_, regs);
+  std::copy(constants_.begin(), constants_.end(), regs + param_count_);
+
+  sexpr_instr_t const *const code = code_.data();
+  sexpr_instr_t const *ip = code;
+
+  for (;;) {
+    sexpr_instr_t const instr = *ip++;
+    double const a = regs[instr.a];
+    double const b = regs[instr.b];
+
+    switch (instr.op) {
+    case OP_ADD: regs[instr.dst] = a + b; break;
+    case OP_SUB: regs[instr.dst] = a - b; break;
+    case OP_MUL: regs[instr.dst] = a * b; break;
+    case OP_DIV: regs[instr.dst] = a / b; break;
+    case OP_MIN: regs[instr.dst] = b < a ? b : a; break;
+    case OP_MAX: regs[instr.dst] = a < b ? b : a; break;
+    case OP_NEG: regs[instr.dst] = -a; break;
+    case OP_LT: regs[instr.dst] = a < b ? 1.0 : 0.0; break;
+    case OP_LE: regs[instr.dst] = a <= b ? 1.0 : 0.0; break;
+    case OP_GT: regs[instr.dst] = a > b ? 1.0 : 0.0; break;
+    case OP_GE: regs[instr.dst] = a >= b ? 1.0 : 0.0; break;
+    case OP_EQ: regs[instr.dst] = a == b ? 1.0 : 0.0; break;
+    case OP_NOT: regs[instr.dst] = a != 0.0 ? 0.0 : 1.0; break;
+    case OP_MOV: regs[instr.dst] = a; break;
+    case OP_JUMP: ip = code + (instr.dst | (instr.b << 8)); break;
+    case OP_JUMP_IF_FALSE: if (a == 0.0) { ip = code + (instr.dst | (instr.b << 8)); } break;
+    case OP_JUMP_IF_TRUE: if (a != 0.0) { ip = code + (instr.dst | (instr.b << 8)); } break;
+    case OP_RETURN: return a;
+    }
+  }
+}
+
+
+sexpr_t sexpr_program_t::eval(std::initializer_list<double> params) const
+{
+  if (int(params.size()) != param_count_) {
+    throw std::runtime_error("Wrong number of parameters for program");
+  }
+  double const result = run(params.begin());
+  return result_type_ == sexpr_t::BOOLEAN ? sexpr_t(result != 0.0) : sexpr_t(result);
+}
+
+
+void sexpr_program_t::disassemble(std::ostream &out) const
+{
+  for (std::size_t index = 0; index < code_.size(); ++index) {
+    sexpr_instr_t const &instr = code_[index];
+    out << index << ": " << opcode_names[instr.op];
+    switch (instr.op) {
+    case OP_JUMP:
+      out << " @" << (instr.dst | (instr.b << 8));
+      break;
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:
+      out << " r" << int(instr.a) << " @" << (instr.dst | (instr.b << 8));
+      break;
+    case OP_RETURN:
+      out << " r" << int(instr.a);
+      break;
+    case OP_NEG:
+    case OP_NOT:
+    case OP_MOV:
+      out << " r" << int(instr.dst) << " r" << int(instr.a);
+      break;
+    default:
+      out << " r" << int(instr.dst) << " r" << int(instr.a) << " r" << int(instr.b);
+      break;
+    }
+    out << '\n';
+  }
+}
+
+
+} // namespace scolex
@@ -0,0 +1,101 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SEXPR_VM_HH__
+#define __SCOLEX_SEXPR_VM_HH__
+
+#include "scolex_config.hh"
+#include "sexpr.hh"
+
+#include <initializer_list>
+#include <iosfwd>
+#include <vector>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  Compiled arithmetic and logic
+
+  sexpr_program_t compiles a form made of numbers, booleans, parameters and
+  these operators
+
+    (+ x ...) (- x ...) (* x ...) (/ x ...) (min x ...) (max x ...)
+    (< x y ...) (<= x y ...) (> x y ...) (>= x y ...) (= x y ...)
+    (and b ...) (or b ...) (not b) (if b then else)
+
+  to bytecode for a small register machine, so that it can be evaluated over
+  and over without walking the tree. Operators are looked up by symbol once,
+  when compiling, and every operand's type is checked then too: running a
+  program never compares symbols or checks types, and never throws.
+
+  Parameters are numbers, named by the symbols given to compile() and passed
+  to run() in the same order. - and / of one operand negate and invert it,
+  comparisons of more than two operands are chained, and and/or
+  short-circuit. Registers hold doubles, so integer constants are read as
+  numbers.
+
+==============================================================================*/
+
+
+// One VM instruction. Operands name registers; jumps keep their target in
+// dst (low byte) and b (high byte).
+struct sexpr_instr_t
+{
+  uint8_t op;
+  uint8_t dst;
+  uint8_t a;
+  uint8_t b;
+};
+
+
+class sexpr_program_t
+{
+public:
+  enum : int { MAX_REGISTERS = 256, MAX_INSTRUCTIONS = 0x10000, MAX_DEPTH = 1024 };
+
+  // Compiles expr. Throws std::runtime_error if it uses an unknown operator
+  // or symbol, gives an operator the wrong number or type of operands, needs
+  // more than MAX_REGISTERS registers or MAX_INSTRUCTIONS instructions, or
+  // nests operator forms more than MAX_DEPTH deep. Limits are checked as the
+  // compiler goes, so oversized input fails early.
+  static sexpr_program_t compile(sexpr_t const &expr, std::vector<symbol_t> const &params = {});
+
+  // NUMBER or BOOLEAN.
+  sexpr_t::type_t result_type() const { return result_type_; }
+  int param_count() const { return param_count_; }
+  int register_count() const { return register_count_; }
+  std::size_t code_size() const { return code_.size(); }
+
+  // Evaluates the program for param_count() parameters. Boolean results are
+  // 1 or 0. Safe to call from any number of threads at once.
+  double run(double const *params) const;
+
+  // Evaluates the program, returning a number or boolean sexpr.
+  sexpr_t eval(std::initializer_list<double> params) const;
+
+  // Writes a listing of the program's instructions, one per line.
+  void disassemble(std::ostream &out) const;
+
+private:
+  // Registers are laid out as parameters, then constants, then temporaries.
+  std::vector<sexpr_instr_t> code_;
+  std::vector<double> constants_;
+  int param_count_;
+  int register_count_;
+  sexpr_t::type_t result_type_;
+
+  sexpr_program_t();
+
+  friend class sexpr_compiler_t;
+};
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SEXPR_VM_HH__ include guard */
@@ -0,0 +1,224 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SEXPR_WALK_HH__
+#define __SCOLEX_SEXPR_WALK_HH__
+
+#include "scolex_config.hh"
+#include "sexpr.hh"
+
+#include <iterator>
+#include <vector>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  walk_stack_t<T, INLINE_SIZE>
+
+  Explicit stack for walking trees without recursion. The first INLINE_SIZE
+  entries are held in the stack itself, so shallow walks don't allocate;
+  deeper ones spill onto the heap. T must be trivially copyable.
+
+  References returned by top() are invalidated by push().
+
+==============================================================================*/
+template <typename T, std::size_t INLINE_SIZE = 32>
+class walk_stack_t
+{
+  static_assert(std::is_trivially_copyable<T>::value, "walk_stack_t entries must be trivially copyable");
+
+  std::size_t size_ = 0;
+  T inline_[INLINE_SIZE];
+  std::vector<T> spill_;
+
+public:
+  bool empty() const { return size_ == 0; }
+  std::size_t size() const { return size_; }
+
+  T &top()
+  {
+    return size_ <= INLINE_SIZE ? inline_[size_ - 1] : spill_[size_ - INLINE_SIZE - 1];
+  }
+
+  void push(T const &value)
+  {
+    if (size_ < INLINE_SIZE) {
+      inline_[size_] = value;
+    } else {
+      spill_.push_back(value);
+    }
+    ++size_;
+  }
+
+  void pop()
+  {
+    if (size_ > INLINE_SIZE) {
+      spill_.pop_back();
+    }
+    --size_;
+  }
+};
+
+
+/*==============================================================================
+
+  sexpr_walk_t
+
+  Walks a tree of sexprs depth-first, one event per call to next():
+
+    LEAF    node() is a non-list sexpr
+    ENTER   node() is a list whose items come next
+    LEAVE   node() is the list whose items were just walked
+
+  Nesting is tracked with a walk_stack_t, so trees of any depth are walked in
+  bounded native stack. The tree must not change during the walk.
+
+    sexpr_walk_t walk { expr };
+    while (walk.next()) {
+      ...
+    }
+
+==============================================================================*/
+class sexpr_walk_t
+{
+public:
+  enum event_t : int { LEAF, ENTER, LEAVE };
+
+  explicit sexpr_walk_t(sexpr_t const &root)
+  : pending_(&root)
+  , node_(nullptr)
+  , event_(LEAF)
+  {
+    /* nop */
+  }
+
+  // Advances to the next event. Returns false once the whole tree has been
+  // walked.
+  bool next()
+  {
+    if (pending_) {
+      visit(pending_);
+      pending_ = nullptr;
+      return true;
+    } else if (stack_.empty()) {
+      return false;
+    }
+
+    frame_t &frame = stack_.top();
+    if (frame.cur != frame.end) {
+      visit(frame.cur++);
+    } else {
+      node_ = frame.list;
+      event_ = LEAVE;
+      stack_.pop();
+    }
+    return true;
+  }
+
+  // After an ENTER, skips the list's items so the next event is its LEAVE.
+  void skip()
+  {
+    frame_t &frame = stack_.top();
+    frame.cur = frame.end;
+  }
+
+  event_t event() const { return event_; }
+  sexpr_t const &node() const { return *node_; }
+
+  // Number of lists enclosing the current node.
+  std::size_t depth() const { return event_ == ENTER ? stack_.size() - 1 : stack_.size(); }
+
+private:
+  struct frame_t
+  {
+    sexpr_t const *list;
+    sexpr_t const *cur;
+    sexpr_t const *end;
+  };
+
+  sexpr_t const *pending_;
+  sexpr_t const *node_;
+  event_t event_;
+  walk_stack_t<frame_t> stack_;
+
+  void visit(sexpr_t const *node)
+  {
+    node_ = node;
+    if (node->type() == sexpr_t::LIST) {
+      event_ = ENTER;
+      stack_.push(frame_t { node, node->begin(), node->end() });
+    } else {
+      event_ = LEAF;
+    }
+  }
+};
+
+
+/*==============================================================================
+
+  sexpr_order_t<SKIPPED>
+
+  Range over every node in a tree, in preorder (each list before its items)
+  or postorder (each list after its items). Its iterators are single-pass.
+
+    for (sexpr_t const &node : preorder(expr)) { ... }
+
+==============================================================================*/
+template <sexpr_walk_t::event_t SKIPPED>
+class sexpr_order_t
+{
+  sexpr_walk_t walk_;
+
+public:
+  class iterator : public std::iterator<std::input_iterator_tag, sexpr_t const>
+  {
+    sexpr_walk_t *walk_;
+
+  public:
+    explicit iterator(sexpr_walk_t *walk = nullptr) : walk_(walk) { advance(); }
+
+    sexpr_t const &operator * () const { return walk_->node(); }
+    sexpr_t const *operator -> () const { return &walk_->node(); }
+
+    iterator &operator ++ () { advance(); return *this; }
+
+    bool operator == (iterator const &other) const { return walk_ == other.walk_; }
+    bool operator != (iterator const &other) const { return walk_ != other.walk_; }
+
+  private:
+    void advance()
+    {
+      while (walk_) {
+        if (!walk_->next()) {
+          walk_ = nullptr;
+        } else if (walk_->event() != SKIPPED) {
+          break;
+        }
+      }
+    }
+  };
+
+  explicit sexpr_order_t(sexpr_t const &root) : walk_(root) { /* nop */ }
+
+  iterator begin() { return iterator(&walk_); }
+  iterator end() { return iterator(); }
+};
+
+
+using sexpr_preorder_t = sexpr_order_t<sexpr_walk_t::LEAVE>;
+using sexpr_postorder_t = sexpr_order_t<sexpr_walk_t::ENTER>;
+
+
+inline sexpr_preorder_t preorder(sexpr_t const &root) { return sexpr_preorder_t(root); }
+inline sexpr_postorder_t postorder(sexpr_t const &root) { return sexpr_postorder_t(root); }
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SEXPR_WALK_HH__ include guard */
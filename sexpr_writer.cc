@@ -0,0 +1,194 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sexpr_writer.hh"
+#include "sexpr_lex.hh"
+#include "sexpr_walk.hh"
+
+#include <cstring>
+
+
+namespace scolex
+{
+
+
+namespace
+{
+
+
+// The char following a backslash in a string's escape for c, or 0 if c is
+// written as is. Matches the escapes operator << writes.
+constexpr char escape_for(int c)
+{
+  return
+    c == '\n' ? 'n' :
+    c == '\b' ? 'b' :
+    c == '\a' ? 'a' :
+    c == '\r' ? 'r' :
+    c == '\t' ? 't' :
+    c == '\x1b' ? 'e' :
+    c == '\f' ? 'f' :
+    c == '\v' ? 'v' :
+    c == '\0' ? '0' :
+    c == '\\' ? '\\' :
+    c == '"' ? '"' :
+    0;
+}
+
+
+#define ESCAPE4(N) escape_for(N), escape_for(N + 1), escape_for(N + 2), escape_for(N + 3)
+#define ESCAPE16(N) ESCAPE4(N), ESCAPE4(N + 4), ESCAPE4(N + 8), ESCAPE4(N + 12)
+#define ESCAPE64(N) ESCAPE16(N), ESCAPE16(N + 16), ESCAPE16(N + 32), ESCAPE16(N + 48)
+
+char const escapes[256] = {
+  ESCAPE64(0), ESCAPE64(64), ESCAPE64(128), ESCAPE64(192)
+};
+
+#undef ESCAPE64
+#undef ESCAPE16
+#undef ESCAPE4
+
+
+} // namespace
+
+
+sexpr_writer_base_t::sexpr_writer_base_t(int buffer_size)
+: buffer_(size_t(buffer_size > 0 ? buffer_size : DEFAULT_BUFFER_SIZE))
+, cur_(buffer_.data())
+, end_(buffer_.data() + buffer_.size())
+, drained_(0)
+{
+  /* nop */
+}
+
+
+void sexpr_writer_base_t::flush()
+{
+  int const size = int(cur_ - buffer_.data());
+  if (size > 0) {
+    cur_ = buffer_.data();
+    drained_ += size;
+    drain(buffer_.data(), size);
+  }
+}
+
+
+void sexpr_writer_base_t::put(char const *chars, std::size_t size)
+{
+  if (size > std::size_t(end_ - cur_)) {
+    flush();
+    // Anything that won't fit in an empty buffer is drained directly.
+    if (size > buffer_.size()) {
+      drained_ += long(size);
+      drain(chars, int(size));
+      return;
+    }
+  }
+  std::memcpy(cur_, chars, size);
+  cur_ += size;
+}
+
+
+void sexpr_writer_base_t::put_number(double num)
+{
+  char buffer[lex::NUMBER_BUFFER_SIZE];
+  int const length = lex::format_number(buffer, sizeof(buffer), num);
+  put(buffer, std::size_t(length));
+}
+
+
+void sexpr_writer_base_t::put_integer(int64_t num)
+{
+  char buffer[lex::NUMBER_BUFFER_SIZE];
+  int const length = lex::format_integer(buffer, num);
+  put(buffer, std::size_t(length));
+}
+
+
+void sexpr_writer_base_t::put_string(string_view_t str)
+{
+  put('"');
+
+  char const *run = str.begin();
+  char const *const end = str.end();
+  for (char const *cur = run; cur != end; ++cur) {
+    char const escape = escapes[(unsigned char)*cur];
+    if (escape) {
+      put(run, std::size_t(cur - run));
+      put('\\');
+      put(escape);
+      run = cur + 1;
+    }
+  }
+  put(run, std::size_t(end - run));
+
+  put('"');
+}
+
+
+void sexpr_writer_base_t::put_atom(sexpr_t const &expr)
+{
+  switch (expr.type()) {
+  case sexpr_t::BOOLEAN: put(expr.boolean() ? "#!t" : "#!f", 3); break;
+  case sexpr_t::NUMBER: put_number(expr.number()); break;
+  case sexpr_t::INTEGER: put_integer(expr.integer()); break;
+  case sexpr_t::NIL: put("'()", 3); break;
+  case sexpr_t::SYMBOL: {
+      string_t const &name = expr.symbol().value();
+      put(name.data(), name.size());
+      break;
+    }
+  case sexpr_t::STRING: put_string(expr.string()); break;
+  case sexpr_t::LIST: break;
+  }
+}
+
+
+void sexpr_writer_base_t::write(sexpr_t const &expr)
+{
+  sexpr_walk_t walk { expr };
+  bool separate = false;
+
+  while (walk.next()) {
+    switch (walk.event()) {
+    case sexpr_walk_t::ENTER:
+      if (separate) {
+        put(' ');
+      }
+      put('(');
+      separate = false;
+      break;
+    case sexpr_walk_t::LEAVE:
+      put(')');
+      separate = true;
+      break;
+    case sexpr_walk_t::LEAF:
+      if (separate) {
+        put(' ');
+      }
+      put_atom(walk.node());
+      separate = true;
+      break;
+    }
+  }
+}
+
+
+void sexpr_writer_base_t::write_lines(sexpr_t const *begin, sexpr_t const *end)
+{
+  for (; begin != end; ++begin) {
+    write(*begin);
+    put('\n');
+  }
+}
+
+
+void sexpr_writer_base_t::write_raw(char const *chars, std::size_t size)
+{
+  put(chars, size);
+}
+
+
+} // namespace scolex
@@ -0,0 +1,141 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SEXPR_WRITER_HH__
+#define __SCOLEX_SEXPR_WRITER_HH__
+
+#include "scolex_config.hh"
+#include "basestream.hh"
+#include "sexpr.hh"
+
+#include <stdexcept>
+#include <vector>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  sexpr_writer_base_t
+
+  Writes sexprs as text in the form sexpr_reader_base_t reads. Output is
+  the same as operator << (sexpr_t): numbers are written with the fewest
+  digits that read back as exactly the same double, and with a ".0" if
+  they'd otherwise read back as integers. Infinities and NaN are written as
+  +inf.0, -inf.0 and +nan.0, which the readers take as numbers; NaN's sign
+  and payload aren't kept.
+
+  Output is collected in a buffer and handed to drain() a buffer at a time.
+  Runs of string chars that don't need escaping are copied in bulk. Trees
+  are walked with sexpr_walk_t, so nesting depth isn't limited by the stack.
+
+  Call flush() once done writing to drain whatever is still buffered.
+
+==============================================================================*/
+class sexpr_writer_base_t
+{
+public:
+  enum : int { DEFAULT_BUFFER_SIZE = 64 * 1024 };
+
+  virtual ~sexpr_writer_base_t() = default;
+
+  // Writes expr.
+  void write(sexpr_t const &expr);
+  // Writes each of forms followed by a newline.
+  void write_lines(sexpr_t const *begin, sexpr_t const *end);
+  // Writes raw chars, such as separators between forms.
+  void write_raw(char const *chars, std::size_t size);
+
+  // Drains the buffer.
+  void flush();
+
+  // Number of bytes written so far, including any still buffered.
+  long offset() const { return drained_ + long(cur_ - buffer_.data()); }
+
+protected:
+  explicit sexpr_writer_base_t(int buffer_size);
+
+  // Writes all size bytes of data to the output, throwing on failure.
+  virtual void drain(char const *data, int size) = 0;
+
+private:
+  std::vector<char> buffer_;
+  char *cur_;
+  char *end_;
+  long drained_;
+
+  void put(char c)
+  {
+    if (cur_ == end_) {
+      flush();
+    }
+    *cur_++ = c;
+  }
+
+  void put(char const *chars, std::size_t size);
+  void put_number(double num);
+  void put_integer(int64_t num);
+  void put_string(string_view_t str);
+  void put_atom(sexpr_t const &expr);
+};
+
+
+/*==============================================================================
+
+  sexpr_writer_t<STREAM>
+
+  Writes sexprs to any stream implementing write(int, void const *) (see
+  basestream.hh), such as fstream_t, memstream_t or nulstream_t. The
+  destructor flushes anything left in the buffer, ignoring errors, so call
+  flush() first to find out whether that succeeded.
+
+==============================================================================*/
+template <class STREAM>
+class sexpr_writer_t final : public sexpr_writer_base_t
+{
+  STREAM &stream_;
+
+public:
+  explicit sexpr_writer_t(STREAM &stream, int buffer_size = DEFAULT_BUFFER_SIZE)
+  : sexpr_writer_base_t(buffer_size)
+  , stream_(stream)
+  {
+    /* nop */
+  }
+
+  ~sexpr_writer_t()
+  {
+    try {
+      flush();
+    } catch (...) {
+      /* nop */
+    }
+  }
+
+protected:
+  void drain(char const *data, int size) override
+  {
+    if (::scolex::io::write(stream_, size, data) != size) {
+      throw std::runtime_error("Failed to write sexpr output to stream");
+    }
+  }
+};
+
+
+// Writes each of forms to stream, one per line, and flushes.
+template <class STREAM>
+void write_sexprs(STREAM &stream, list_t const &forms)
+{
+  sexpr_writer_t<STREAM> writer { stream };
+  writer.write_lines(forms.data(), forms.data() + forms.size());
+  writer.flush();
+}
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SEXPR_WRITER_HH__ include guard */
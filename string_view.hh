@@ -0,0 +1,73 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_STRING_VIEW_HH__
+#define __SCOLEX_STRING_VIEW_HH__
+
+#include "scolex_config.hh"
+
+#include <cstring>
+#include <ostream>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  string_view_t
+
+  Non-owning, read-only view of a run of chars. Only valid for as long as
+  the storage it refers to.
+
+==============================================================================*/
+struct string_view_t
+{
+  constexpr string_view_t() : data_(nullptr), size_(0) {}
+  constexpr string_view_t(char const *data, std::size_t size) : data_(data), size_(size) {}
+  string_view_t(char const *cstr) : data_(cstr), size_(std::strlen(cstr)) {}
+  string_view_t(string_t const &str) : data_(str.data()), size_(str.size()) {}
+
+  constexpr char const *data() const { return data_; }
+  constexpr std::size_t size() const { return size_; }
+  constexpr bool empty() const { return size_ == 0; }
+
+  constexpr char const *begin() const { return data_; }
+  constexpr char const *end() const { return data_ + size_; }
+
+  constexpr char operator [] (std::size_t index) const { return data_[index]; }
+
+  // Copies the viewed chars into a string.
+  string_t str() const { return string_t(data_, size_); }
+
+  bool operator == (string_view_t const &other) const
+  {
+    return size_ == other.size_ && (data_ == other.data_ || std::memcmp(data_, other.data_, size_) == 0);
+  }
+
+  bool operator != (string_view_t const &other) const { return !operator == (other); }
+
+private:
+  char const *data_;
+  std::size_t size_;
+};
+
+
+inline bool operator == (string_t const &lhs, string_view_t const &rhs) { return string_view_t(lhs) == rhs; }
+inline bool operator == (char const *lhs, string_view_t const &rhs) { return string_view_t(lhs) == rhs; }
+inline bool operator != (string_t const &lhs, string_view_t const &rhs) { return string_view_t(lhs) != rhs; }
+inline bool operator != (char const *lhs, string_view_t const &rhs) { return string_view_t(lhs) != rhs; }
+
+
+inline std::ostream &operator << (std::ostream &out, string_view_t const &in)
+{
+  return out.write(in.data(), std::streamsize(in.size()));
+}
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_STRING_VIEW_HH__ include guard */
@@ -0,0 +1,392 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "scolex_config.hh"
+#include "sexpr.hh"
+#include "bench.hh"
+#include "bench_alloc.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+using namespace scolex;
+using namespace scolex::bench;
+
+
+namespace
+{
+
+
+int const NUM_NAMES = 10000;
+int const LOOKUPS_PER_THREAD = 1000000;
+
+
+std::vector<string_t> make_names(char const *prefix, int count)
+{
+  std::vector<string_t> names;
+  names.reserve(size_t(count));
+  for (int index = 0; index < count; ++index) {
+    names.push_back(string_t(prefix) + std::to_string(index));
+  }
+  return names;
+}
+
+
+std::vector<int> thread_counts()
+{
+  int const cores = std::max(1, int(std::thread::hardware_concurrency()));
+  std::vector<int> counts;
+  for (int threads = 1; threads < cores; threads *= 2) {
+    counts.push_back(threads);
+  }
+  counts.push_back(cores);
+  return counts;
+}
+
+
+// Runs fn(thread_index) on num_threads threads at once and returns the wall
+// time taken for all of them to finish.
+template <typename FN>
+double run_threads(int num_threads, FN &&fn)
+{
+  std::atomic<int> ready { 0 };
+  std::atomic<bool> go { false };
+  std::vector<std::thread> threads;
+
+  for (int index = 0; index < num_threads; ++index) {
+    threads.emplace_back([&, index] {
+      ready.fetch_add(1);
+      while (!go.load()) {
+        std::this_thread::yield();
+      }
+      fn(index);
+    });
+  }
+
+  while (ready.load() != num_threads) {
+    std::this_thread::yield();
+  }
+
+  return time_seconds([&] {
+    go.store(true);
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+  });
+}
+
+
+// The intern table as it was before it was sharded: one mutex around an
+// unordered_map. Kept here only to compare against.
+struct global_lock_table_t
+{
+  std::hash<string_t> hash_fn;
+  std::unordered_map<size_t, std::unique_ptr<string_t>> symbols;
+  std::mutex lock;
+
+  string_t const *intern(string_t const &str)
+  {
+    std::lock_guard<std::mutex> guard { lock };
+    size_t const hash = hash_fn(str);
+    auto sym = symbols.find(hash);
+    if (sym != symbols.end()) {
+      return sym->second.get();
+    }
+    return symbols.emplace(hash, std::unique_ptr<string_t>(new string_t(str))).first->second.get();
+  }
+};
+
+
+void report_scaling(char const *label, int threads, double seconds, double base_rate)
+{
+  double const ops = double(threads) * LOOKUPS_PER_THREAD;
+  double const rate = ops / seconds;
+  std::printf("%-12s threads=%-3d %8.2f Mops/s  (x%.2f vs 1 thread)\n",
+    label, threads, rate / 1e6, base_rate > 0 ? rate / base_rate : 1.0);
+}
+
+
+void bench_intern_hit()
+{
+  std::vector<string_t> const names = make_names("hit-", NUM_NAMES);
+  global_lock_table_t legacy;
+
+  for (string_t const &name : names) {
+    symbol_t sym { name };
+    legacy.intern(name);
+  }
+
+  double sharded_base = 0;
+  double legacy_base = 0;
+
+  for (int threads : thread_counts()) {
+    double const seconds = run_threads(threads, [&](int thread) {
+      size_t acc = 0;
+      for (int op = 0; op < LOOKUPS_PER_THREAD; ++op) {
+        symbol_t sym { names[size_t((op * 7 + thread) % NUM_NAMES)] };
+        acc += sym.hash();
+      }
+      keep(acc);
+    });
+
+    double const legacy_seconds = run_threads(threads, [&](int thread) {
+      size_t acc = 0;
+      for (int op = 0; op < LOOKUPS_PER_THREAD; ++op) {
+        acc += legacy.intern(names[size_t((op * 7 + thread) % NUM_NAMES)])->size();
+      }
+      keep(acc);
+    });
+
+    if (threads == 1) {
+      sharded_base = double(LOOKUPS_PER_THREAD) / seconds;
+      legacy_base = double(LOOKUPS_PER_THREAD) / legacy_seconds;
+    }
+
+    report_scaling("sharded", threads, seconds, sharded_base);
+    report_scaling("global-lock", threads, legacy_seconds, legacy_base);
+  }
+}
+
+
+void bench_intern_miss()
+{
+  for (int threads : thread_counts()) {
+    std::vector<std::vector<string_t>> names;
+    for (int thread = 0; thread < threads; ++thread) {
+      string_t const prefix = "miss-" + std::to_string(threads) + "-" + std::to_string(thread) + "-";
+      names.push_back(make_names(prefix.c_str(), NUM_NAMES));
+    }
+
+    double const seconds = run_threads(threads, [&](int thread) {
+      for (string_t const &name : names[size_t(thread)]) {
+        symbol_t sym { name };
+        keep(sym);
+      }
+    });
+
+    std::printf("threads=%-3d %8.2f Minserts/s\n",
+      threads, double(threads) * NUM_NAMES / seconds / 1e6);
+  }
+}
+
+
+// Looks up a handler for each of a stream of symbols, keyed the only way a
+// symbol could be before ids (by the address of its interned string) and by
+// symbol id, and tests membership in a set of symbols with a bitset by id.
+void bench_dispatch()
+{
+  int const NUM_HANDLERS = 64;
+  int const STREAM_LENGTH = 1000000;
+
+  std::vector<symbol_t> stream;
+  for (string_t const &name : make_names("dispatch-", NUM_HANDLERS * 2)) {
+    stream.emplace_back(name);
+  }
+  std::vector<symbol_t> const names = stream;
+  while (int(stream.size()) < STREAM_LENGTH) {
+    stream.push_back(names[stream.size() * 7919 % names.size()]);
+  }
+
+  std::unordered_map<string_t const *, int> by_address;
+  std::vector<int> by_id(symbol_t::count(), -1);
+  std::vector<bool> handled(symbol_t::count(), false);
+  for (int index = 0; index < NUM_HANDLERS; ++index) {
+    by_address.emplace(&names[size_t(index)].value(), index);
+    by_id[names[size_t(index)].id()] = index;
+    handled[names[size_t(index)].id()] = true;
+  }
+
+  long sum = 0;
+  double const map_seconds = best_of(5, [&] {
+    for (symbol_t const &sym : stream) {
+      auto const found = by_address.find(&sym.value());
+      sum += found == by_address.end() ? -1 : found->second;
+    }
+  });
+  double const array_seconds = best_of(5, [&] {
+    for (symbol_t const &sym : stream) {
+      sum += by_id[sym.id()];
+    }
+  });
+  double const bitset_seconds = best_of(5, [&] {
+    for (symbol_t const &sym : stream) {
+      sum += handled[sym.id()];
+    }
+  });
+  keep(sum);
+
+  std::printf("sizeof(symbol_t) = %d\n", int(sizeof(symbol_t)));
+  std::printf("%-14s %8.2f ns/lookup\n", "hash-map", map_seconds * 1e9 / STREAM_LENGTH);
+  std::printf("%-14s %8.2f ns/lookup\n", "array-by-id", array_seconds * 1e9 / STREAM_LENGTH);
+  std::printf("%-14s %8.2f ns/lookup\n", "bitset-by-id", bitset_seconds * 1e9 / STREAM_LENGTH);
+}
+
+
+// Looks up interned symbols named by ranges of a buffer, as a parser would:
+// by copying each name to a string first, by interning straight from the
+// buffer, and with find().
+void bench_lookup_buffer()
+{
+  std::vector<string_t> const names = make_names("buffer-lookup-symbol-", NUM_NAMES);
+  string_t buffer;
+  std::vector<std::pair<std::size_t, std::size_t>> ranges;
+  for (string_t const &name : names) {
+    symbol_t sym { name };
+    keep(sym);
+    ranges.emplace_back(buffer.size(), name.size());
+    buffer += name;
+    buffer += ' ';
+  }
+
+  int const ROUNDS = 100;
+  char const *const chars = buffer.data();
+  auto report = [&](char const *label, double seconds, alloc_counts_t allocs) {
+    double const lookups = double(ROUNDS) * ranges.size();
+    std::printf("%-14s %8.2f ns/lookup  %6.2f allocs/lookup\n",
+      label, seconds * 1e9 / lookups, double(allocs.allocs) / lookups);
+  };
+
+  double seconds = 0;
+  alloc_counts_t allocs = count_allocs([&] {
+    seconds = time_seconds([&] {
+      for (int round = 0; round < ROUNDS; ++round) {
+        for (auto const &range : ranges) {
+          symbol_t sym { string_t(chars + range.first, range.second) };
+          keep(sym);
+        }
+      }
+    });
+  });
+  report("via-string", seconds, allocs);
+
+  allocs = count_allocs([&] {
+    seconds = time_seconds([&] {
+      for (int round = 0; round < ROUNDS; ++round) {
+        for (auto const &range : ranges) {
+          symbol_t sym { chars + range.first, range.second };
+          keep(sym);
+        }
+      }
+    });
+  });
+  report("from-buffer", seconds, allocs);
+
+  allocs = count_allocs([&] {
+    seconds = time_seconds([&] {
+      symbol_t found { names[0] };
+      for (int round = 0; round < ROUNDS; ++round) {
+        for (auto const &range : ranges) {
+          keep(symbol_t::find(string_view_t(chars + range.first, range.second), found));
+        }
+      }
+    });
+  });
+  report("find", seconds, allocs);
+}
+
+
+// Interns 100k-symbol vocabularies one symbol at a time and in one batch,
+// first when none of a vocabulary is interned yet and then again once all of
+// it is. New vocabularies are interned alternately with each method, so both
+// see a table of about the same size.
+void bench_intern_batch()
+{
+  int const VOCABULARY_SIZE = 100000;
+  int const ROUNDS = 5;
+
+  auto intern_one_at_a_time = [](std::vector<string_t> const &names) {
+    std::vector<symbol_t> symbols;
+    symbols.reserve(names.size());
+    for (string_t const &name : names) {
+      symbols.emplace_back(name);
+    }
+    keep(symbols.back());
+  };
+  auto intern_batch = [](std::vector<string_t> const &names) {
+    std::vector<symbol_t> const symbols = symbol_t::intern_all(names.begin(), names.end());
+    keep(symbols.back());
+  };
+
+  double one_new = 0;
+  double batch_new = 0;
+  std::vector<string_t> one_names;
+  std::vector<string_t> batch_names;
+  for (int round = 0; round < ROUNDS; ++round) {
+    string_t const suffix = std::to_string(round) + "-";
+    one_names = make_names(("vocabulary-one-" + suffix).c_str(), VOCABULARY_SIZE);
+    batch_names = make_names(("vocabulary-batch-" + suffix).c_str(), VOCABULARY_SIZE);
+
+    double const one_seconds = time_seconds([&] { intern_one_at_a_time(one_names); });
+    double const batch_seconds = time_seconds([&] { intern_batch(batch_names); });
+    one_new = round == 0 ? one_seconds : std::min(one_new, one_seconds);
+    batch_new = round == 0 ? batch_seconds : std::min(batch_new, batch_seconds);
+  }
+
+  double const one_existing = best_of(ROUNDS, [&] { intern_one_at_a_time(one_names); });
+  double const batch_existing = best_of(ROUNDS, [&] { intern_batch(batch_names); });
+
+  std::printf("%-14s %8.3f ms new  %8.3f ms existing\n", "one-at-a-time", one_new * 1e3, one_existing * 1e3);
+  std::printf("%-14s %8.3f ms new  %8.3f ms existing\n", "batch", batch_new * 1e3, batch_existing * 1e3);
+}
+
+
+// Interns a fresh set of identifiers every round, as a long-running server
+// interning names from its requests would, keeping only a few of each round's
+// symbols for the next round and collecting after every round. Without
+// SCOLEX_RECLAIM_SYMBOLS every symbol lives forever and the table and RSS grow
+// each round; with it, both should level off.
+void bench_churn()
+{
+  int const ROUNDS = 20;
+  int const NAMES_PER_ROUND = 50000;
+  int const KEPT_PER_ROUND = 1000;
+
+  std::printf("reclaimable symbols: %s\n", SCOLEX_RECLAIM_SYMBOLS ? "yes" : "no");
+  size_t const rss_before = resident_bytes();
+  std::vector<symbol_t> kept;
+  for (int round = 0; round < ROUNDS; ++round) {
+    std::vector<string_t> const names = make_names(("request-" + std::to_string(round) + "-ident-").c_str(), NAMES_PER_ROUND);
+    double const intern_seconds = time_seconds([&] {
+      std::vector<symbol_t> symbols;
+      symbols.reserve(names.size());
+      for (string_t const &name : names) {
+        symbols.emplace_back(name);
+      }
+      kept.assign(symbols.begin(), symbols.begin() + KEPT_PER_ROUND);
+    });
+
+    size_t freed = 0;
+    double const collect_seconds = time_seconds([&] { freed = symbol_t::collect(); });
+    if (round % 4 == 3 || round == ROUNDS - 1) {
+      std::printf("round %2d  intern %7.3f ms  collect %7.3f ms  freed %6d  ids %8u  rss +%6.1f MB\n",
+        round + 1, intern_seconds * 1e3, collect_seconds * 1e3, int(freed), symbol_t::count(),
+        (double(resident_bytes()) - double(rss_before)) / 1e6);
+    }
+  }
+}
+
+
+bench_case_t const cases[] = {
+  { "symbol/intern-hit", bench_intern_hit },
+  { "symbol/intern-miss", bench_intern_miss },
+  { "symbol/dispatch", bench_dispatch },
+  { "symbol/lookup-buffer", bench_lookup_buffer },
+  { "symbol/intern-batch", bench_intern_batch },
+  { "symbol/churn", bench_churn },
+};
+
+
+} // namespace
+
+
+int main(int argc, char const *argv[])
+{
+  return run_cases(argc, argv, std::begin(cases), std::end(cases));
+}
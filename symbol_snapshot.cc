@@ -0,0 +1,180 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "symbol_snapshot.hh"
+#include "mapped_file.hh"
+
+#include <cstring>
+#include <vector>
+
+
+namespace scolex
+{
+
+
+namespace
+{
+
+
+uint32_t const SNAPSHOT_VERSION = 1;
+uint32_t const SNAPSHOT_BYTE_ORDER = 0x01020304;
+char const SNAPSHOT_MAGIC[4] = { 'S', 'X', 'S', 'Y' };
+// Hashed when writing and loading a snapshot: if the hashes differ, so does
+// the symbol hash function, and the snapshot's hashes can't be used.
+char const HASH_CHECK_STRING[] = "scolex symbol snapshot";
+
+
+struct snapshot_header_t
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t hash_size;
+  uint64_t hash_check;
+  uint64_t symbol_count;
+  uint64_t entry_offset;
+  uint64_t pool_offset;
+  uint64_t pool_size;
+};
+
+
+struct snapshot_entry_t
+{
+  uint64_t hash;
+  uint32_t offset;
+  uint32_t size;
+};
+
+
+std::size_t align8(std::size_t size)
+{
+  return (size + 7) & ~std::size_t(7);
+}
+
+
+uint64_t hash_check()
+{
+  return uint64_t(symbol_t::hash_name(HASH_CHECK_STRING, sizeof(HASH_CHECK_STRING) - 1));
+}
+
+
+// Snapshots need a symbol for every id below symbol_t::count(), which there
+// won't be once collect() has reclaimed any.
+symbol_t snapshot_symbol(uint32_t id)
+{
+  try {
+    return symbol_t::from_id(id);
+  } catch (std::out_of_range const &) {
+    throw std::runtime_error("Cannot snapshot symbols once any have been reclaimed");
+  }
+}
+
+
+[[noreturn]] void snapshot_error(char const *what)
+{
+  throw std::runtime_error(string_t("Invalid symbol snapshot: ") + what);
+}
+
+
+} // namespace
+
+
+string_t build_symbol_snapshot()
+{
+  uint32_t const count = symbol_t::count();
+  std::vector<snapshot_entry_t> entries;
+  entries.reserve(count);
+  string_t pool;
+
+  for (uint32_t id = 0; id < count; ++id) {
+    symbol_t const sym = snapshot_symbol(id);
+    string_t const &name = sym.value();
+    if (pool.size() + name.size() >= UINT32_MAX) {
+      throw std::runtime_error("Too many chars for a symbol snapshot");
+    }
+    entries.push_back(snapshot_entry_t { uint64_t(sym.hash()), uint32_t(pool.size()), uint32_t(name.size()) });
+    pool.append(name);
+    pool.push_back('\0');
+  }
+
+  snapshot_header_t header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+  header.hash_size = sizeof(hash_t);
+  header.hash_check = hash_check();
+  header.symbol_count = count;
+  header.entry_offset = align8(sizeof(header));
+  header.pool_offset = align8(header.entry_offset + entries.size() * sizeof(snapshot_entry_t));
+  header.pool_size = pool.size();
+
+  string_t snapshot(std::size_t(header.pool_offset + header.pool_size), '\0');
+  std::memcpy(&snapshot[0], &header, sizeof(header));
+  if (!entries.empty()) {
+    std::memcpy(&snapshot[std::size_t(header.entry_offset)], entries.data(), entries.size() * sizeof(snapshot_entry_t));
+  }
+  if (!pool.empty()) {
+    std::memcpy(&snapshot[std::size_t(header.pool_offset)], pool.data(), pool.size());
+  }
+  return snapshot;
+}
+
+
+void load_symbol_snapshot(char const *data, std::size_t size)
+{
+  if (size < sizeof(snapshot_header_t)) {
+    snapshot_error("too small for a header");
+  }
+
+  snapshot_header_t header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+    snapshot_error("bad magic");
+  } else if (header.version != SNAPSHOT_VERSION) {
+    snapshot_error("unsupported version");
+  } else if (header.byte_order != SNAPSHOT_BYTE_ORDER) {
+    snapshot_error("written with a different byte order");
+  } else if (header.symbol_count >= UINT32_MAX) {
+    snapshot_error("too many symbols");
+  } else if (header.entry_offset > size || header.symbol_count > (size - header.entry_offset) / sizeof(snapshot_entry_t)) {
+    snapshot_error("symbol table out of bounds");
+  } else if (header.pool_offset > size || header.pool_size > size - header.pool_offset) {
+    snapshot_error("name pool out of bounds");
+  }
+
+  uint32_t const count = uint32_t(header.symbol_count);
+  char const *const pool = data + header.pool_offset;
+  bool const same_hash = header.hash_size == sizeof(hash_t) && header.hash_check == hash_check();
+
+  std::vector<string_view_t> names;
+  std::vector<hash_t> hashes;
+  names.reserve(count);
+  hashes.reserve(same_hash ? count : 0);
+
+  for (uint32_t id = 0; id < count; ++id) {
+    snapshot_entry_t entry;
+    std::memcpy(&entry, data + header.entry_offset + id * sizeof(entry), sizeof(entry));
+    if (entry.offset > header.pool_size || entry.size >= header.pool_size - entry.offset) {
+      snapshot_error("symbol name out of bounds");
+    }
+    names.push_back(string_view_t(pool + entry.offset, entry.size));
+    if (same_hash) {
+      hashes.push_back(hash_t(entry.hash));
+    }
+  }
+
+  symbol_t::preload(names.data(), same_hash ? hashes.data() : nullptr, count);
+}
+
+
+void load_symbol_snapshot_file(string_t const &path)
+{
+  mapped_file_t const file { path };
+  load_symbol_snapshot(file.data(), file.size());
+}
+
+
+} // namespace scolex
@@ -0,0 +1,74 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef __SCOLEX_SYMBOL_SNAPSHOT_HH__
+#define __SCOLEX_SYMBOL_SNAPSHOT_HH__
+
+#include "scolex_config.hh"
+#include "io_ops.hh"
+#include "sexpr.hh"
+
+#include <stdexcept>
+
+
+namespace scolex
+{
+
+
+/*==============================================================================
+
+  Symbol snapshots
+
+  A snapshot is a file holding every symbol interned when it was taken, with
+  its id and hash, so a program that interns the same well-known symbols on
+  every start can instead load them in one go: no per-symbol locking or
+  rehashing, and the symbol records are allocated together. Symbols keep the
+  ids they had when the snapshot was taken, so ids stored alongside a
+  snapshot stay valid across restarts.
+
+  Loading has to happen before any symbol is interned, since ids are handed
+  out in order. Hashes are only reused if the snapshot was written by a
+  build hashing names the same way; otherwise they're recomputed. Reused
+  hashes aren't checked against their names, so a snapshot is trusted to be
+  one build_symbol_snapshot() wrote. Preloaded symbols are never reclaimed,
+  and since ids have to be dense, a snapshot can't be taken once collect()
+  has reclaimed any symbol.
+
+  The layout is a header, a table of { hash, offset, size } entries indexed
+  by id, and a pool of NUL-terminated names, all in the writer's byte order.
+
+==============================================================================*/
+
+
+// Encodes every symbol interned so far as a snapshot.
+string_t build_symbol_snapshot();
+
+
+// Interns every symbol in the snapshot in [data, data + size), which needn't
+// outlive the call. Throws std::runtime_error if the snapshot is invalid or
+// any symbol has already been interned.
+void load_symbol_snapshot(char const *data, std::size_t size);
+
+
+// Loads the snapshot file at path.
+void load_symbol_snapshot_file(string_t const &path);
+
+
+// Writes a snapshot to any stream implementing write(int, void const *).
+template <class STREAM>
+void write_symbol_snapshot(STREAM &stream)
+{
+  string_t const snapshot = build_symbol_snapshot();
+  if (snapshot.size() > std::size_t(INT32_MAX)) {
+    throw std::runtime_error("Symbol snapshot too large to write in one go");
+  } else if (::scolex::io::write(stream, int(snapshot.size()), snapshot.data()) != int(snapshot.size())) {
+    throw std::runtime_error("Failed to write symbol snapshot to stream");
+  }
+}
+
+
+} // namespace scolex
+
+#endif /* end __SCOLEX_SYMBOL_SNAPSHOT_HH__ include guard */
@@ -0,0 +1,199 @@
+// Copyright Noel Cower 2014.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "scolex_config.hh"
+#include "sexpr.hh"
+#include "symbol_snapshot.hh"
+#include "fstream.hh"
+#include "mapped_file.hh"
+#include "bench.hh"
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+# include <sys/wait.h>
+# include <unistd.h>
+# define SCOLEX_BENCH_FORK 1
+#else
+# define SCOLEX_BENCH_FORK 0
+#endif
+
+
+using namespace scolex;
+using namespace scolex::bench;
+
+
+namespace
+{
+
+
+int const NUM_SYMBOLS = 50000;
+char const *const SNAPSHOT_FILE = "symbol_snapshot_bench.snapshot";
+
+
+// Well-known symbols of a range of lengths, some short enough to be stored
+// inline in a string and some not.
+std::vector<string_t> make_names()
+{
+  static char const *const prefixes[] = { "k", "attr-", "well-known-symbol-", "schema/element/attribute-" };
+  std::vector<string_t> names;
+  names.reserve(NUM_SYMBOLS);
+  for (int index = 0; index < NUM_SYMBOLS; ++index) {
+    names.push_back(prefixes[index % 4] + std::to_string(index));
+  }
+  return names;
+}
+
+
+#if SCOLEX_BENCH_FORK
+
+
+// Runs fn in a child process, which starts with an empty intern table since
+// this program interns nothing up front, and returns the seconds fn returned
+// or -1 if it failed.
+template <typename FN>
+double time_in_child(FN &&fn)
+{
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return -1;
+  }
+
+  std::fflush(stdout);
+  pid_t const pid = fork();
+  if (pid == 0) {
+    double seconds = -1;
+    try {
+      seconds = fn();
+    } catch (std::exception const &ex) {
+      std::fprintf(stderr, "%s\n", ex.what());
+    }
+    ssize_t const written = write(fds[1], &seconds, sizeof(seconds));
+    _exit(written == ssize_t(sizeof(seconds)) ? 0 : 1);
+  }
+
+  double seconds = -1;
+  if (pid > 0) {
+    if (read(fds[0], &seconds, sizeof(seconds)) != ssize_t(sizeof(seconds))) {
+      seconds = -1;
+    }
+    waitpid(pid, nullptr, 0);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  return seconds;
+}
+
+
+template <typename FN>
+double best_in_child(int reps, FN &&fn)
+{
+  double best = -1;
+  for (int rep = 0; rep < reps; ++rep) {
+    double const seconds = time_in_child(fn);
+    if (seconds < 0) {
+      return -1;
+    } else if (best < 0 || seconds < best) {
+      best = seconds;
+    }
+  }
+  return best;
+}
+
+
+void report_startup(char const *label, double seconds)
+{
+  if (seconds < 0) {
+    std::printf("%-18s failed\n", label);
+  } else {
+    std::printf("%-18s %8.3f ms  %7.1f ns/symbol\n", label, seconds * 1e3, seconds * 1e9 / NUM_SYMBOLS);
+  }
+}
+
+
+// Compares interning a program's well-known symbols one by one at startup
+// against loading a snapshot of them, and loading a snapshot and then looking
+// each symbol up by name, as a program would to get hold of them.
+void bench_startup()
+{
+  std::vector<string_t> const names = make_names();
+
+  double const write_seconds = time_in_child([&] {
+    for (string_t const &name : names) {
+      symbol_t sym { name };
+      keep(sym);
+    }
+    fstream_t file { SNAPSHOT_FILE, STREAM_WRITE };
+    write_symbol_snapshot(file);
+    return 0.0;
+  });
+  if (write_seconds < 0) {
+    std::printf("failed to write %s\n", SNAPSHOT_FILE);
+    return;
+  }
+  std::printf("%d symbols, %d byte snapshot\n", NUM_SYMBOLS, int(mapped_file_t(SNAPSHOT_FILE).size()));
+
+  report_startup("intern", best_in_child(5, [&] {
+    return time_seconds([&] {
+      for (string_t const &name : names) {
+        symbol_t sym { name };
+        keep(sym);
+      }
+    });
+  }));
+
+  report_startup("snapshot", best_in_child(5, [&] {
+    return time_seconds([&] {
+      load_symbol_snapshot_file(SNAPSHOT_FILE);
+    });
+  }));
+
+  report_startup("snapshot+lookup", best_in_child(5, [&] {
+    double const seconds = time_seconds([&] {
+      load_symbol_snapshot_file(SNAPSHOT_FILE);
+      for (string_t const &name : names) {
+        symbol_t sym { name };
+        keep(sym);
+      }
+    });
+    // Every symbol keeps the id it had when the snapshot was written.
+    for (uint32_t id = 0; id < uint32_t(names.size()); ++id) {
+      if (symbol_t(names[id]).id() != id || symbol_t::count() != names.size()) {
+        return -1.0;
+      }
+    }
+    return seconds;
+  }));
+
+  std::remove(SNAPSHOT_FILE);
+}
+
+
+#else
+
+
+void bench_startup()
+{
+  std::printf("skipped: needs fork() to start each run with an empty intern table\n");
+}
+
+
+#endif
+
+
+bench_case_t const cases[] = {
+  { "symbol/startup", bench_startup },
+};
+
+
+} // namespace
+
+
+int main(int argc, char const *argv[])
+{
+  return run_cases(argc, argv, std::begin(cases), std::end(cases));
+}